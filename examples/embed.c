@@ -0,0 +1,65 @@
+// Compiles fy kernels in-process with libfy and calls them.
+// usage: embed (path to fy's lib directory, default "lib")
+#include "libfy.h"
+#include <stdio.h>
+
+const char *kernels = "include \"std/io\"\n"
+                      "let calls = 0\n"
+                      "fun square always_compile(true) (x: int): int {\n"
+                      "  calls += 1\n"
+                      "  x * x\n"
+                      "}\n"
+                      "fun scaled_sum always_compile(true) (n: int, scale: "
+                      "int): int {\n"
+                      "  let total = 0\n"
+                      "  for(let i = 0; i < n; i += 1)\n"
+                      "    total += i * scale\n"
+                      "  total\n"
+                      "}\n"
+                      "fun greet always_compile(true) (): int {\n"
+                      "  print(\"Hello from fy!\\n\")\n"
+                      "  calls\n"
+                      "}\n";
+
+int main(int argc, char **argv) {
+  fy_session *session = fy_session_create();
+  fy_session_add_include_path(session, argc > 1 ? argv[1] : "lib");
+  fy_session_add_source(session, "kernels.fy", kernels);
+  // scaled_sum is specialized below
+  fy_session_enable_specialize(session);
+  if (fy_session_compile(session, 2) != 0) {
+    fprintf(stderr, "%s\n", fy_session_error(session));
+    return 1;
+  }
+  int (*square)(int) = (int (*)(int))fy_session_lookup(session, "square");
+  int (*greet)(void) = (int (*)(void))fy_session_lookup(session, "greet");
+  if (!square || !greet) {
+    fprintf(stderr, "%s\n", fy_session_error(session));
+    return 1;
+  }
+  printf("square(7) = %d\n", square(7));
+  printf("calls = %d\n", greet());
+
+  // n is known from here on, the loop folds away in the specialization
+  int n = 100;
+  fy_arg fixed_n = {0, &n};
+  int (*sum_100)(int, int) = (int (*)(int, int))fy_session_specialize(
+      session, "scaled_sum", &fixed_n, 1);
+  if (!sum_100) {
+    fprintf(stderr, "%s\n", fy_session_error(session));
+    return 1;
+  }
+  printf("scaled_sum(100, 3) = %d\n", sum_100(n, 3));
+
+  // sessions are isolated, errors stay in the session that caused them
+  fy_session *broken = fy_session_create();
+  fy_session_add_source(broken, "broken.fy",
+                        "fun f always_compile(true) () undefined_name");
+  if (fy_session_compile(broken, 0) != 0)
+    printf("broken.fy: %s\n", fy_session_error(broken));
+  fy_session_destroy(broken);
+
+  printf("square(9) = %d\n", square(9));
+  fy_session_destroy(session);
+  return 0;
+}
@@ -32,23 +32,52 @@ std::string Identifier::to_str() {
 ExprAST::~ExprAST() {}
 bool ExprAST::is_constant() { return false; }
 
-std::vector<std::pair<LLVMValueRef, ExprAST *>> inits;
+thread_local std::vector<std::pair<LLVMValueRef, ExprAST *>> inits;
+thread_local std::unordered_set<LLVMValueRef> shared_inits;
 void add_store_before_main(LLVMValueRef ptr, ExprAST *val) {
   inits.push_back({ptr, val});
 }
-extern std::unordered_set<LLVMValueRef> removed_globals; // defined in UCR
+extern thread_local std::unordered_set<LLVMValueRef>
+    removed_globals; // defined in UCR
+// stores the value in a global of shared_inits unless its linkonce_odr flag
+// says another unit already did, the blocks go before `entry`
+static void gen_shared_init(LLVMValueRef ptr, ExprAST *expr,
+                            LLVMBasicBlockRef entry) {
+  LLVMTypeRef i1 = LLVMInt1TypeInContext(curr_ctx);
+  std::string name = std::string(LLVMGetValueName(ptr)) + ".initialized";
+  LLVMValueRef flag = LLVMGetNamedGlobal(curr_module, name.c_str());
+  if (!flag) {
+    flag = LLVMAddGlobal(curr_module, i1, name.c_str());
+    LLVMSetInitializer(flag, LLVMConstNull(i1));
+    LLVMSetLinkage(flag, LLVMLinkOnceODRLinkage);
+  }
+  LLVMBasicBlockRef store = LLVMInsertBasicBlockInContext(curr_ctx, entry, UN);
+  LLVMBasicBlockRef after = LLVMInsertBasicBlockInContext(curr_ctx, entry, UN);
+  LLVMBuildCondBr(curr_builder, LLVMBuildLoad2(curr_builder, i1, flag, UN),
+                  after, store);
+  LLVMPositionBuilderAtEnd(curr_builder, store);
+  LLVMBuildStore(curr_builder, LLVMConstInt(i1, 1, false), flag);
+  LLVMBuildStore(curr_builder, expr->gen_value()->gen_val(), ptr);
+  LLVMBuildBr(curr_builder, after);
+  LLVMPositionBuilderAtEnd(curr_builder, after);
+}
 void add_stores_before_main(LLVMValueRef main_func) {
   if (inits.size() == 0)
     return; // nothing to do
   LLVMBasicBlockRef entry = LLVMGetEntryBasicBlock(main_func);
   LLVMBasicBlockRef store_block =
-      LLVMAppendBasicBlock(main_func, "global_vars");
+      LLVMAppendBasicBlockInContext(curr_ctx, main_func, "global_vars");
   LLVMMoveBasicBlockBefore(store_block, entry);
   LLVMPositionBuilderAtEnd(curr_builder, store_block);
   bool has_non_constant_init = false;
   for (auto &[ptr, expr] : inits)
     // UCR can remove globals, so we need to check if the global still exists
     if (removed_globals.count(ptr) == 0) {
+      if (shared_inits.count(ptr)) {
+        gen_shared_init(ptr, expr, entry);
+        has_non_constant_init = true;
+        continue;
+      }
       LLVMValueRef val = expr->gen_value()->gen_val();
       if (LLVMIsConstant(val))
         LLVMSetInitializer(ptr, val);
@@ -69,7 +98,7 @@ AssignExprAST::AssignExprAST(ExprAST *LHS, ExprAST *RHS) : LHS(LHS), RHS(RHS) {}
 Type *AssignExprAST::get_type() { return LHS->get_type(); }
 Value *AssignExprAST::gen_value() {
   CastValue *val = RHS->gen_value()->cast_to(LHS->get_type());
-  LLVMBuildStore(curr_builder, val->gen_val(), LHS->gen_value()->gen_ptr());
+  gen_store(val, LHS->gen_value()->gen_ptr());
   return val;
 }
 
@@ -86,11 +115,34 @@ Type *BlockExprAST::get_type() {
   pop_scope();
   return type;
 }
+// return, break and continue leave the builder in a new block that nothing
+// jumps to
+static bool is_unreachable(LLVMBasicBlockRef block) {
+  return block && !LLVMGetFirstInstruction(block) &&
+         !LLVMGetFirstUse(LLVMBasicBlockAsValue(block)) &&
+         block != LLVMGetEntryBasicBlock(LLVMGetBasicBlockParent(block));
+}
 Value *BlockExprAST::gen_value() {
   push_scope();
   // generate code for all exprs and only return last expr
-  for (size_t i = 0; i < exprs.size() - 1; i++)
+  for (size_t i = 0; i < exprs.size() - 1; i++) {
     exprs[i]->gen_value();
+    if (is_unreachable(LLVMGetInsertBlock(curr_builder))) {
+      // the rest is dead code up to a label goto can jump to, only its types
+      // are checked
+      size_t next = i + 1;
+      while (next < exprs.size() - 1 &&
+             !dynamic_cast<LabelExprAST *>(exprs[next]))
+        exprs[next++]->get_type();
+      if (dynamic_cast<LabelExprAST *>(exprs[next])) {
+        i = next - 1;
+        continue;
+      }
+      Value *value = null_value(exprs.back()->get_type());
+      pop_scope();
+      return value;
+    }
+  }
   Value *value = exprs.back()->gen_value();
   pop_scope();
   return value;
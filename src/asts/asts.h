@@ -4,6 +4,7 @@
 #include "../utils.h"
 #include "../values.h"
 #include "functions.h"
+#include <map>
 
 /// ExprAST - Base class for all expression nodes.
 class ExprAST {
@@ -56,8 +57,8 @@ struct Scope {
   void set_generic(std::string name, Generic *value);
   std::string get_prefix();
 };
-extern Scope global_scope;
-extern Scope *curr_scope;
+extern thread_local Scope global_scope;
+extern thread_local Scope *curr_scope;
 
 Value *get_variable(Identifier id, Scope *base = curr_scope);
 FunctionAST *get_function(Identifier id, Scope *base = curr_scope);
@@ -73,7 +74,23 @@ struct LoopState {
   LLVMBasicBlockRef break_block;
   LLVMBasicBlockRef continue_block;
 };
-extern std::vector<LoopState> loop_stack;
+extern thread_local std::vector<LoopState> loop_stack;
+/// LabelState - the labels of a function body being generated. Their blocks
+/// are created when first used and placed where the label is.
+struct LabelState {
+  std::map<std::string, LLVMBasicBlockRef> blocks;
+  // the labels whose address is taken, every `goto *` can jump to them
+  std::vector<LLVMBasicBlockRef> address_taken;
+  std::vector<LLVMValueRef> indirect_branches;
+  // the variables in scope at each goto to a label that isn't placed yet,
+  // the label can't have others, their declarations would be skipped
+  std::map<std::string, std::vector<std::unordered_set<Value *>>> pending;
+  // the same for the `goto *`s, for labels placed after them
+  std::vector<std::unordered_set<Value *>> pending_indirect;
+};
+extern thread_local std::vector<LabelState> label_stack;
+// ends the innermost label state, adding the destinations of its `goto *`s
+void finish_labels();
 
 Value *build_malloc(Type *type);
 
@@ -95,12 +112,18 @@ class NumberExprAST : public ExprAST {
 
 public:
   NumType type;
+  // written without a type suffix, it can take the type of the other side of
+  // a binary operator
+  bool untyped = false;
   NumberExprAST(std::string val, char type_char, bool has_dot,
                 unsigned int base);
   NumberExprAST(unsigned long long val, char type_char);
   NumberExprAST(unsigned long long val, NumType type);
   Type *get_type();
+  // whether the value can be represented in `to`
+  bool fits(NumType *to);
   Value *gen_value();
+  Value *gen_value(NumType *as);
   bool is_constant();
 };
 /// BoolExprAST - Expression class for boolean literals (true or false).
@@ -135,7 +158,9 @@ public:
   bool is_constant();
 };
 
-extern std::vector<std::pair<LLVMValueRef, ExprAST *>> inits;
+extern thread_local std::vector<std::pair<LLVMValueRef, ExprAST *>> inits;
+// globals of inits every unit has (libraries' ones), they're initialized once
+extern thread_local std::unordered_set<LLVMValueRef> shared_inits;
 void add_store_before_main(LLVMValueRef ptr, ExprAST *val);
 #include "../ucr.h"
 void add_stores_before_main(LLVMValueRef main_func);
@@ -149,6 +174,8 @@ public:
   TypeAST *type;
   ExprAST *value;
   bool constant;
+  // the type of an untyped variable if it isn't the value's, set by loops
+  Type *inferred_type = nullptr;
   LetExprAST(std::string id, TypeAST *type, ExprAST *value, bool constant);
   LLVMValueRef gen_toplevel();
   Value *gen_value();
@@ -217,6 +244,9 @@ public:
   bool is_constant() { return true; }
 };
 
+// the type both sides of a binary operator on numbers are converted to: the
+// floating-point or wider one, or the unsigned one if they're as wide
+NumType *num_binop_type(int op, NumType *lhs_nt, NumType *rhs_nt);
 LLVMValueRef gen_num_num_binop(int op, LLVMValueRef L, LLVMValueRef R,
                                NumType *lhs_nt, NumType *rhs_nt);
 LLVMValueRef gen_ptr_num_binop(int op, LLVMValueRef ptr, LLVMValueRef num,
@@ -230,9 +260,8 @@ Value *gen_binop(int op, LLVMValueRef L, LLVMValueRef R, Type *lhs_t,
                  Type *rhs_t);
 
 class AssignExprAST : public ExprAST {
-  ExprAST *LHS, *RHS;
-
 public:
+  ExprAST *LHS, *RHS;
   AssignExprAST(ExprAST *LHS, ExprAST *RHS);
   Type *get_type();
   Value *gen_value();
@@ -240,10 +269,9 @@ public:
 
 /// BinaryExprAST - Expression class for a binary operator.
 class BinaryExprAST : public ExprAST {
+public:
   int op;
   ExprAST *LHS, *RHS;
-
-public:
   BinaryExprAST(int op, ExprAST *LHS, ExprAST *RHS);
 
   Type *get_type();
@@ -253,10 +281,9 @@ public:
 };
 /// UnaryExprAST - Expression class for a unary operator.
 class UnaryExprAST : public ExprAST {
+public:
   int op;
   ExprAST *operand;
-
-public:
   UnaryExprAST(int op, ExprAST *operand);
   Type *get_type();
   Value *gen_value();
@@ -324,6 +351,19 @@ public:
   Value *gen_value();
 };
 
+/// BoundsCheckExprAST - Expression class for checking that an index is below
+/// a length with --bounds-check (__bounds_check__(i, this.length)). Without
+/// it nothing is evaluated.
+class BoundsCheckExprAST : public ExprAST {
+  ExprAST *index;
+  ExprAST *length;
+
+public:
+  BoundsCheckExprAST(ExprAST *index, ExprAST *length);
+  Type *get_type();
+  Value *gen_value();
+};
+
 /// NumAccessExprAST - Expression class for accessing indexes on Tuples (a.0).
 class NumAccessExprAST : public ExprAST {
   bool is_ptr;
@@ -483,14 +523,50 @@ public:
   Type *get_type();
   Value *gen_value();
 };
+/// LabelExprAST - Expression class for a label goto jumps to, like "next:"
+class LabelExprAST : public ExprAST {
+  std::string name;
+
+public:
+  LabelExprAST(std::string name);
+  Type *get_type();
+  Value *gen_value();
+};
+/// LabelAddrExprAST - Expression class for the address of a label, like
+/// "&&next"
+class LabelAddrExprAST : public ExprAST {
+  std::string label;
+
+public:
+  LabelAddrExprAST(std::string label);
+  Type *get_type();
+  Value *gen_value();
+};
+/// GotoExprAST - Expression class for jumping to a label ("goto next") or to
+/// the address of one ("goto *addr")
+class GotoExprAST : public ExprAST {
+  std::string label;
+  ExprAST *addr;
 
+public:
+  GotoExprAST(std::string label, ExprAST *addr);
+  Type *get_type();
+  Value *gen_value();
+};
+
+// `branchless if` always evaluates both sides and selects one, `branchy if`
+// always branches, otherwise cheap sides without side effects are selected
+enum class BranchHint { Auto, Branchless, Branchy };
 /// IfExprAST - Expression class for if/then/else.
 class IfExprAST : public ExprAST {
 public:
   ExprAST *cond, *then, *elze;
   bool null_else;
   Type *type;
+  BranchHint hint = BranchHint::Auto;
   void init();
+  // whether both sides are evaluated and one is selected, without branches
+  bool is_select();
   IfExprAST(ExprAST *cond, ExprAST *then,
             // elze because else cant be a variable name lol
             ExprAST *elze);
@@ -512,6 +588,7 @@ public:
 
 class ForExprAST : public ExprAST {
   ExprAST *init, *cond, *body, *post, *elze;
+  void infer_counter_type();
 
 public:
   ForExprAST(ExprAST *init, ExprAST *cond, ExprAST *body, ExprAST *post,
@@ -530,12 +607,30 @@ public:
 class AbsoluteTypeDefAST : public TypeDefAST {
   std::string name;
   TypeAST *type;
+  // what the struct derives, `struct Point derive(serialize) { ... }`
+  std::vector<std::string> derives;
 
 public:
-  AbsoluteTypeDefAST(std::string name, TypeAST *type);
+  AbsoluteTypeDefAST(std::string name, TypeAST *type,
+                     std::vector<std::string> derives = {});
   void gen_toplevel();
 };
 
+enum class WireOp { Size, SchemaHash, View, Serialize, Deserialize };
+/// WireExprAST - the body of a function `derive(serialize)` generates for a
+/// struct, see serialize.cpp.
+class WireExprAST : public ExprAST {
+  NamedStructType *type;
+  WireOp op;
+
+public:
+  WireExprAST(NamedStructType *type, WireOp op);
+  Type *get_type();
+  Value *gen_value();
+};
+// adds the serialization functions of the struct `type`, named `name`
+void derive_serialize(std::string name, NamedStructType *type);
+
 class GenericTypeDefAST : public TypeDefAST {
 public:
   std::string name;
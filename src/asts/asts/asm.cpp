@@ -30,9 +30,9 @@ Value *ASMExprAST::gen_value() {
     constraints_str += constraints[i];
   }
   Type *type = has_output ? type_ast->type() : new NullType();
-  LLVMTypeRef functy =
-      LLVMFunctionType(has_output ? type->llvm_type() : LLVMVoidType(), arg_ts,
-                       args.size(), false);
+  LLVMTypeRef functy = LLVMFunctionType(
+      has_output ? type->llvm_type() : LLVMVoidTypeInContext(curr_ctx), arg_ts,
+      args.size(), false);
   LLVMValueRef inline_asm =
       LLVMGetInlineAsm(functy, asm_str.data(), asm_str.size(),
                        constraints_str.data(), constraints_str.size(),
@@ -1,10 +1,24 @@
 #include "../asts.h"
 
+NumType *num_binop_type(int op, NumType *lhs_nt, NumType *rhs_nt) {
+  // shifts keep the type of the shifted number
+  if (op == T_LSHIFT || op == T_RSHIFT || lhs_nt->eq(rhs_nt))
+    return lhs_nt;
+  if (lhs_nt->is_floating != rhs_nt->is_floating)
+    return lhs_nt->is_floating ? lhs_nt : rhs_nt;
+  if (lhs_nt->bits != rhs_nt->bits)
+    return lhs_nt->bits > rhs_nt->bits ? lhs_nt : rhs_nt;
+  // same width but different signedness, like C
+  return lhs_nt->is_signed ? rhs_nt : lhs_nt;
+}
 LLVMValueRef gen_num_num_binop(int op, LLVMValueRef L, LLVMValueRef R,
                                NumType *lhs_nt, NumType *rhs_nt) {
-  if (lhs_nt->neq(rhs_nt))
-    R = gen_num_cast(R, rhs_nt, lhs_nt);
-  bool floating = lhs_nt->is_floating && rhs_nt->is_floating;
+  NumType *nt = num_binop_type(op, lhs_nt, rhs_nt);
+  if (lhs_nt->neq(nt))
+    L = gen_num_cast(L, lhs_nt, nt);
+  if (rhs_nt->neq(nt))
+    R = gen_num_cast(R, rhs_nt, nt);
+  bool floating = nt->is_floating;
   if (floating)
     switch (op) {
     case '+':
@@ -38,8 +52,8 @@ LLVMValueRef gen_num_num_binop(int op, LLVMValueRef L, LLVMValueRef R,
     default:
       error("invalid float_float binary operator '" + token_to_str(op) + "'");
     }
-  else if (!lhs_nt->is_floating && !rhs_nt->is_floating) {
-    bool is_signed = lhs_nt->is_signed && rhs_nt->is_signed;
+  else {
+    bool is_signed = nt->is_signed;
     switch (op) {
     case '+':
       return LLVMBuildAdd(curr_builder, L, R, UN);
@@ -82,8 +96,7 @@ LLVMValueRef gen_num_num_binop(int op, LLVMValueRef L, LLVMValueRef R,
     default:
       error("invalid int_int binary operator '" + token_to_str(op) + "'");
     }
-  } else
-    error("invalid float_int binary operator '" + token_to_str(op) + "'");
+  }
 }
 LLVMValueRef gen_ptr_num_binop(int op, LLVMValueRef ptr, LLVMValueRef num,
                                PointerType *ptr_t, NumType *num_t) {
@@ -153,7 +166,8 @@ Type *get_binop_type(int op, Type *lhs_t, Type *rhs_t) {
   if (binop_precedence[op] == comparison_prec)
     return BoolExprAST(true).get_type();
   else if (lhs_tt == Number && rhs_tt == Number)
-    return lhs_t; // int + int returns int
+    // int + long returns long
+    return num_binop_type(op, (NumType *)lhs_t, (NumType *)rhs_t);
   else if (lhs_tt == Pointer && rhs_tt == Number)
     // ptr + int returns offsetted ptr
     return /* ptr */ lhs_t;
@@ -194,13 +208,35 @@ Value *gen_binop(int op, LLVMValueRef L, LLVMValueRef R, Type *lhs_t,
 BinaryExprAST::BinaryExprAST(int op, ExprAST *LHS, ExprAST *RHS)
     : op(op), LHS(LHS), RHS(RHS) {}
 
+// an unsuffixed number takes the type of the number on the other side if it
+// fits, so `i < 10` with a uint_ptrsize `i` compares uint_ptrsizes
+static NumType *literal_type(ExprAST *side, ExprAST *other) {
+  auto literal = dynamic_cast<NumberExprAST *>(side);
+  if (!literal || !literal->untyped)
+    return nullptr;
+  if (auto other_literal = dynamic_cast<NumberExprAST *>(other))
+    if (other_literal->untyped)
+      return nullptr;
+  auto other_nt = dynamic_cast<NumType *>(other->get_type());
+  return other_nt && literal->fits(other_nt) ? other_nt : nullptr;
+}
+static Type *side_type(ExprAST *side, ExprAST *other) {
+  NumType *type = literal_type(side, other);
+  return type ? type : side->get_type();
+}
+static Value *gen_side(ExprAST *side, ExprAST *other) {
+  NumType *type = literal_type(side, other);
+  return type ? ((NumberExprAST *)side)->gen_value(type) : side->gen_value();
+}
+
 Type *BinaryExprAST::get_type() {
-  return get_binop_type(op, LHS->get_type(), RHS->get_type());
+  return get_binop_type(op, side_type(LHS, RHS), side_type(RHS, LHS));
 }
 
 Value *BinaryExprAST::gen_value() {
-  return gen_binop(op, LHS->gen_value()->gen_val(), RHS->gen_value()->gen_val(),
-                   LHS->get_type(), RHS->get_type());
+  return gen_binop(op, gen_side(LHS, RHS)->gen_val(),
+                   gen_side(RHS, LHS)->gen_val(), side_type(LHS, RHS),
+                   side_type(RHS, LHS));
 }
 // LLVM can constantify binary expressions if both sides are also constant.
 bool BinaryExprAST::is_constant() {
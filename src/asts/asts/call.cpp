@@ -1,4 +1,7 @@
 #include "../asts.h"
+#include "../../options.h"
+#include "../../specialize.h"
+#include <algorithm>
 
 FunctionType *ValueCallExprAST::get_func_type() {
   FunctionType *func_t = dynamic_cast<FunctionType *>(called->get_type());
@@ -44,17 +47,268 @@ Value *ValueCallExprAST::gen_value() {
   return new ConstValue(func_t->return_type, call);
 }
 
+// copy(dest, src, count) copies `count` elements between two *T, which may
+// overlap, and fill(dest, value, count) sets them to a T. Functions and
+// variables with these names hide them
+static bool is_memory_builtin(Identifier &name) {
+  return !name.has_spaces() && (name.name == "copy" || name.name == "fill") &&
+         !get_function(name) && !get_variable(name);
+}
+// checks the arguments and returns T
+static Type *memory_builtin_elem(Identifier &name,
+                                 std::vector<ExprAST *> &args) {
+  bool is_copy = name.name == "copy";
+  std::string usage = name.name + (is_copy ? "(dest: *T, src: *T, count)"
+                                           : "(dest: *T, value: T, count)");
+  if (args.size() != 3)
+    error(usage + " got " << args.size() << " arguments.");
+  auto dest = dynamic_cast<PointerType *>(args[0]->get_type());
+  auto count = dynamic_cast<NumType *>(args[2]->get_type());
+  if (!dest || !count || count->is_floating)
+    error(usage + " needs a pointer and an integer count.");
+  Type *elem = dest->get_points_to();
+  Type *second = args[1]->get_type();
+  if (is_copy ? second->neq(dest) : !second->castable_to(elem))
+    error(usage + " got " + second->stringify() + " for " +
+          (is_copy ? dest->stringify() : elem->stringify()) + ".");
+  return elem;
+}
+// the byte every byte of `value` is, if it's known, e.g. 0 for null
+static LLVMValueRef splat_byte(LLVMValueRef value) {
+  LLVMTypeRef i8 = LLVMInt8TypeInContext(curr_ctx);
+  LLVMTypeRef type = LLVMTypeOf(value);
+  if (type == i8)
+    return value;
+  if (LLVMIsNull(value))
+    return LLVMConstNull(i8);
+  if (!LLVMIsAConstantInt(value) || LLVMGetIntTypeWidth(type) > 64 ||
+      LLVMGetIntTypeWidth(type) % 8)
+    return nullptr;
+  unsigned long long bits = LLVMConstIntGetZExtValue(value);
+  for (unsigned i = 8; i < LLVMGetIntTypeWidth(type); i += 8)
+    if (((bits >> i) & 0xff) != (bits & 0xff))
+      return nullptr;
+  return LLVMConstInt(i8, bits & 0xff, false);
+}
+// stores `value` in `count` elements from `dest` one by one
+static void gen_fill_loop(LLVMValueRef dest, LLVMValueRef value,
+                          LLVMValueRef count) {
+  LLVMTypeRef i64 = LLVMTypeOf(count);
+  LLVMBasicBlockRef entry = LLVMGetInsertBlock(curr_builder);
+  LLVMValueRef func = LLVMGetBasicBlockParent(entry);
+  LLVMBasicBlockRef cond = LLVMAppendBasicBlockInContext(curr_ctx, func, UN);
+  LLVMBasicBlockRef body = LLVMAppendBasicBlockInContext(curr_ctx, func, UN);
+  LLVMBasicBlockRef after = LLVMAppendBasicBlockInContext(curr_ctx, func, UN);
+  LLVMBuildBr(curr_builder, cond);
+  LLVMPositionBuilderAtEnd(curr_builder, cond);
+  LLVMValueRef i = LLVMBuildPhi(curr_builder, i64, UN);
+  LLVMBuildCondBr(curr_builder,
+                  LLVMBuildICmp(curr_builder, LLVMIntULT, i, count, UN), body,
+                  after);
+  LLVMPositionBuilderAtEnd(curr_builder, body);
+  LLVMBuildStore(curr_builder, value,
+                 LLVMBuildGEP2(curr_builder, LLVMTypeOf(value), dest, &i, 1,
+                               UN));
+  LLVMValueRef next =
+      LLVMBuildAdd(curr_builder, i, LLVMConstInt(i64, 1, false), UN);
+  LLVMBuildBr(curr_builder, cond);
+  LLVMValueRef incoming[] = {LLVMConstNull(i64), next};
+  LLVMBasicBlockRef incoming_blocks[] = {entry, body};
+  LLVMAddIncoming(i, incoming, incoming_blocks, 2);
+  LLVMPositionBuilderAtEnd(curr_builder, after);
+}
+static Value *gen_memory_builtin(Identifier &name,
+                                 std::vector<ExprAST *> &args) {
+  Type *elem = memory_builtin_elem(name, args);
+  LLVMTypeRef elem_t = elem->llvm_type();
+  LLVMTypeRef i64 = LLVMInt64TypeInContext(curr_ctx);
+  LLVMValueRef dest = args[0]->gen_value()->gen_val();
+  Value *second = args[1]->gen_value();
+  LLVMValueRef count =
+      args[2]->gen_value()->cast_to(new NumType(64, false, false))->gen_val();
+  LLVMValueRef size = LLVMBuildMul(
+      curr_builder, count,
+      LLVMConstInt(i64, LLVMABISizeOfType(target_data, elem_t), false), UN);
+  unsigned align = LLVMABIAlignmentOfType(target_data, elem_t);
+  if (name.name == "copy")
+    gen_mem_copy(dest, second->gen_val(), size, align, true);
+  else {
+    LLVMValueRef value = second->cast_to(elem)->gen_val();
+    if (LLVMValueRef byte = splat_byte(value))
+      gen_mem_set(dest, byte, size, align);
+    else
+      gen_fill_loop(dest, value, count);
+  }
+  return null_value();
+}
+
+// specialize(f, arg = value, ...) is f with those arguments fixed to the
+// values, JIT compiled with them as constants when it's called in `fy run`
+// (see specialize.h) and f itself otherwise. Functions and variables with the
+// name hide it
+static bool is_specialize_builtin(Identifier &name) {
+  return !name.has_spaces() && name.name == "specialize" &&
+         !get_function(name) && !get_variable(name);
+}
+// checks the arguments and returns the function, `fixed` gets the values of
+// its arguments by index
+static FunctionAST *
+specialized_function(std::vector<ExprAST *> &args,
+                     std::map<unsigned, ExprAST *> *fixed = nullptr) {
+  std::string usage = "specialize(function, argument = value, ...)";
+  auto called = args.empty() ? nullptr
+                             : dynamic_cast<VariableExprAST *>(args[0]);
+  FunctionAST *func = called ? get_function(called->name) : nullptr;
+  if (!func)
+    error(usage + " needs the name of a function.");
+  if (func->ft.is_generic() || func->flags.is_inline || func->flags.is_vararg)
+    error(usage + " can't specialize " + func->name +
+          ", it's generic, inline or has varargs.");
+  FunctionType *type = func->get_type();
+  for (size_t i = 1; i < args.size(); i++) {
+    auto assign = dynamic_cast<AssignExprAST *>(args[i]);
+    auto arg = assign ? dynamic_cast<VariableExprAST *>(assign->LHS) : nullptr;
+    if (!arg || arg->name.has_spaces())
+      error(usage + " got an argument that isn't `name = value`.");
+    auto found = std::find_if(
+        func->args.begin(), func->args.end(),
+        [&](auto &func_arg) { return func_arg.first == arg->name.name; });
+    if (found == func->args.end())
+      error(func->name + " has no argument " + arg->name.name + ".");
+    unsigned index = found - func->args.begin();
+    if (index >= 64)
+      error(usage + " can only fix the first 64 arguments.");
+    Type *value_type = assign->RHS->get_type();
+    if (value_type->neq(type->arguments[index]) &&
+        !value_type->castable_to(type->arguments[index]))
+      error("Can't fix " + arg->name.name + " of " + func->name + " to a " +
+            value_type->stringify() + ".");
+    if (fixed && !fixed->emplace(index, assign->RHS).second)
+      error(arg->name.name + " of " + func->name + " is fixed twice.");
+  }
+  return func;
+}
+static Value *gen_specialize(std::vector<ExprAST *> &args) {
+  std::map<unsigned, ExprAST *> fixed;
+  FunctionAST *func = specialized_function(args, &fixed);
+  FunctionType *type = func->get_type();
+  LLVMValueRef generic = func->gen_ptr()->gen_val();
+  std::vector<LLVMValueRef> values;
+  for (auto &[index, value] : fixed)
+    values.push_back(
+        value->gen_value()->cast_to(type->arguments[index])->gen_val());
+  if (!options.run_specialize)
+    return new ConstValue(type->ptr(), generic);
+  // the hook gets the values through an array of pointers to them
+  LLVMTypeRef i8_ptr = LLVMPointerType(LLVMInt8TypeInContext(curr_ctx), 0);
+  LLVMTypeRef i64 = LLVMInt64TypeInContext(curr_ctx);
+  LLVMTypeRef array_t = LLVMArrayType(i8_ptr, values.size());
+  LLVMValueRef array = LLVMBuildAlloca(curr_builder, array_t, UN);
+  unsigned long long mask = 0;
+  size_t i = 0;
+  for (auto &[index, value] : fixed) {
+    LLVMValueRef slot =
+        LLVMBuildAlloca(curr_builder, LLVMTypeOf(values[i]), UN);
+    LLVMBuildStore(curr_builder, values[i], slot);
+    LLVMValueRef indices[] = {LLVMConstNull(i64), LLVMConstInt(i64, i, false)};
+    LLVMBuildStore(
+        curr_builder, LLVMBuildPointerCast(curr_builder, slot, i8_ptr, UN),
+        LLVMBuildInBoundsGEP2(curr_builder, array_t, array, indices, 2, UN));
+    mask |= 1ull << index;
+    i++;
+  }
+  LLVMTypeRef params[] = {i8_ptr, i64, LLVMPointerType(i8_ptr, 0)};
+  LLVMTypeRef hook_t = LLVMFunctionType(i8_ptr, params, 3, false);
+  LLVMValueRef hook = LLVMGetNamedFunction(curr_module, SPECIALIZE_HOOK);
+  if (!hook)
+    hook = LLVMAddFunction(curr_module, SPECIALIZE_HOOK, hook_t);
+  LLVMValueRef hook_args[] = {
+      LLVMBuildPointerCast(curr_builder, generic, i8_ptr, UN),
+      LLVMConstInt(i64, mask, false),
+      LLVMBuildPointerCast(curr_builder, array, LLVMPointerType(i8_ptr, 0),
+                           UN)};
+  LLVMValueRef specialized =
+      LLVMBuildCall2(curr_builder, hook_t, hook, hook_args, 3, UN);
+  return new ConstValue(
+      type->ptr(), LLVMBuildPointerCast(curr_builder, specialized,
+                                        LLVMTypeOf(generic), UN));
+}
+
+// layout_hash(value) is a hash of the memory layout of the value's type, its
+// size, alignment and the offset and kind of every number and pointer in it
+// (names aside), e.g. to check a file holds the type's elements. The value
+// isn't evaluated. Functions and variables with the name hide it
+static bool is_layout_hash_builtin(Identifier &name) {
+  return !name.has_spaces() && name.name == "layout_hash" &&
+         !get_function(name) && !get_variable(name);
+}
+static NumType layout_hash_type(64, false, false);
+static void hash_layout(LLVMTypeRef type, unsigned long long offset,
+                        unsigned long long &hash) {
+  auto mix = [&](unsigned long long word) {
+    hash = (hash ^ word) * 0x100000001b3;
+  };
+  LLVMTypeKind kind = LLVMGetTypeKind(type);
+  mix(offset << 8 | kind);
+  switch (kind) {
+  case LLVMIntegerTypeKind:
+    mix(LLVMGetIntTypeWidth(type));
+    break;
+  case LLVMStructTypeKind:
+    mix(LLVMCountStructElementTypes(type));
+    for (unsigned i = 0; i < LLVMCountStructElementTypes(type); i++)
+      hash_layout(LLVMStructGetTypeAtIndex(type, i),
+                  offset + LLVMOffsetOfElement(target_data, type, i), hash);
+    break;
+  case LLVMArrayTypeKind:
+  case LLVMVectorTypeKind:
+    // the elements are the same, the first one stands for all
+    mix(kind == LLVMArrayTypeKind ? LLVMGetArrayLength(type)
+                                  : LLVMGetVectorSize(type));
+    hash_layout(LLVMGetElementType(type), offset, hash);
+    break;
+  default:
+    break;
+  }
+}
+static Value *gen_layout_hash(std::vector<ExprAST *> &args) {
+  if (args.size() != 1)
+    error("layout_hash(value) got " << args.size() << " arguments.");
+  LLVMTypeRef type = args[0]->get_type()->llvm_type();
+  unsigned long long hash = 0xcbf29ce484222325;
+  hash_layout(type, 0, hash);
+  hash ^= LLVMABISizeOfType(target_data, type) * 0x100000001b3;
+  unsigned long long align = LLVMABIAlignmentOfType(target_data, type);
+  hash ^= align << 56;
+  return new ConstValue(&layout_hash_type,
+                        LLVMConstInt(layout_hash_type.llvm_type(), hash,
+                                     false));
+}
+
 NameCallExprAST::NameCallExprAST(Identifier name, std::vector<ExprAST *> args)
     : name(name), args(args) {}
 Type *NameCallExprAST::get_type() {
   if (auto function = get_function(name))
     return function->get_type(args)->return_type;
+  else if (is_memory_builtin(name)) {
+    memory_builtin_elem(name, args);
+    return &null_type;
+  } else if (is_specialize_builtin(name))
+    return specialized_function(args)->get_type()->ptr();
+  else if (is_layout_hash_builtin(name))
+    return &layout_hash_type;
   else
     return ValueCallExprAST(new VariableExprAST(name), args).get_type();
 }
 Value *NameCallExprAST::gen_value() {
   if (auto function = get_function(name))
     return function->gen_call(args);
+  else if (is_memory_builtin(name))
+    return gen_memory_builtin(name, args);
+  else if (is_specialize_builtin(name))
+    return gen_specialize(args);
+  else if (is_layout_hash_builtin(name))
+    return gen_layout_hash(args);
   else
     return ValueCallExprAST(new VariableExprAST(name), args).gen_value();
 }
@@ -20,6 +20,13 @@ Value *gen_shortcircuit(Type *type, ExprAST *lefte, ExprAST *righte,
   auto left = lefte->gen_value();
   // cast to bool
   auto left_bool = left->cast_to(new NumType(1, false, false))->gen_val();
+  // a constant left side decides which side is the result
+  if (LLVMIsAConstantInt(left_bool)) {
+    bool left_true = LLVMConstIntGetZExtValue(left_bool);
+    if (left_true == (sc_type == Or))
+      return new ConstValue(type, left->gen_val());
+    return new ConstValue(type, righte->gen_value()->gen_val());
+  }
   left_bb = LLVMGetInsertBlock(curr_builder);
   auto func = LLVMGetBasicBlockParent(left_bb);
   auto right_bb = LLVMAppendBasicBlockInContext(curr_ctx, func, UN);
@@ -29,7 +36,7 @@ Value *gen_shortcircuit(Type *type, ExprAST *lefte, ExprAST *righte,
     LLVMBuildCondBr(curr_builder, left_bool, merge_bb, right_bb);
   } else /* sc_type == And */ {
     // if left is false, skip right
-    LLVMBuildCondBr(curr_builder, left_bool, right_bb, left_bb);
+    LLVMBuildCondBr(curr_builder, left_bool, right_bb, merge_bb);
   }
   LLVMPositionBuilderAtEnd(curr_builder, right_bb);
   auto right = righte->gen_value();
@@ -70,11 +77,82 @@ Type *IfExprAST::get_type() {
   return type;
 }
 
+// the number of operations to evaluate `expr` even if its side isn't taken,
+// -1 if that changes what the program does. `trapping` allows loads through
+// pointers and divisions, which fault on null pointers and zero divisors.
+static int speculation_cost(ExprAST *expr, bool trapping) {
+  auto add = [](int a, int b) { return a < 0 || b < 0 ? -1 : a + b; };
+  if (dynamic_cast<NumberExprAST *>(expr) ||
+      dynamic_cast<BoolExprAST *>(expr) || dynamic_cast<NullExprAST *>(expr) ||
+      dynamic_cast<SizeofExprAST *>(expr))
+    return 0;
+  if (dynamic_cast<VariableExprAST *>(expr))
+    return 1;
+  if (auto cast = dynamic_cast<CastExprAST *>(expr))
+    return add(1, speculation_cost(cast->value, trapping));
+  if (auto unary = dynamic_cast<UnaryExprAST *>(expr)) {
+    if (unary->op == T_RETURN || (unary->op == '*' && !trapping))
+      return -1;
+    // the address of a variable doesn't load it
+    if (unary->op == '&' && dynamic_cast<VariableExprAST *>(unary->operand))
+      return 0;
+    return add(1, speculation_cost(unary->operand, trapping));
+  }
+  if (auto prop = dynamic_cast<PropAccessExprAST *>(expr)) {
+    // a field through a pointer is a load
+    bool loads = prop->source->get_type()->type_type() == TypeType::Pointer;
+    if (loads && !trapping)
+      return -1;
+    return add(1, speculation_cost(prop->source, trapping));
+  }
+  if (auto binary = dynamic_cast<BinaryExprAST *>(expr)) {
+    bool divides = binary->op == '/' || binary->op == '%';
+    if (divides && !trapping) {
+      auto nt = dynamic_cast<NumType *>(binary->get_type());
+      if (!nt || !nt->is_floating)
+        return -1;
+    }
+    return add(1, add(speculation_cost(binary->LHS, trapping),
+                      speculation_cost(binary->RHS, trapping)));
+  }
+  return -1;
+}
+// both sides of an if are evaluated if this many operations are cheaper than
+// a mispredicted branch
+constexpr int SELECT_MAX_COST = 6;
+bool IfExprAST::is_select() {
+  if (hint == BranchHint::Branchy || null_else)
+    return false;
+  bool branchless = hint == BranchHint::Branchless;
+  TypeType tt = type->type_type();
+  int then_cost = speculation_cost(then, branchless);
+  int else_cost = speculation_cost(elze, branchless);
+  bool selectable = (tt == TypeType::Number || tt == TypeType::Pointer) &&
+                    then_cost >= 0 && else_cost >= 0;
+  if (branchless && !selectable)
+    error("branchless if needs two sides without side effects that are "
+          "numbers or pointers");
+  return selectable &&
+         (branchless || then_cost + else_cost <= SELECT_MAX_COST);
+}
+
 Value *IfExprAST::gen_value() {
   init();
   // cast to bool
   LLVMValueRef cond_v =
       cond->gen_value()->cast_to(new NumType(1, false, false))->gen_val();
+  // the builder folds conditions on literals and constants, only the side
+  // they pick is generated
+  if (LLVMIsAConstantInt(cond_v)) {
+    ExprAST *picked = LLVMConstIntGetZExtValue(cond_v) ? then : elze;
+    return new ConstValue(type, picked->gen_value()->gen_val());
+  }
+  if (is_select()) {
+    LLVMValueRef then_v = then->gen_value()->gen_val();
+    LLVMValueRef else_v = elze->gen_value()->gen_val();
+    return new ConstValue(
+        type, LLVMBuildSelect(curr_builder, cond_v, then_v, else_v, UN));
+  }
   LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(curr_builder));
   LLVMBasicBlockRef then_bb = LLVMAppendBasicBlockInContext(curr_ctx, func, UN);
   LLVMBasicBlockRef else_bb = LLVMCreateBasicBlockInContext(curr_ctx, UN);
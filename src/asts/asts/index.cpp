@@ -1,4 +1,6 @@
 #include "../asts.h"
+#include "../../bounds.h"
+#include "../../options.h"
 
 IndexExprAST::IndexExprAST(ExprAST *value, ExprAST *index)
     : value(value), index(index) {}
@@ -14,6 +16,12 @@ Type *IndexExprAST::get_type() {
           base_type->stringify());
 }
 
+// whether the index is signed, for checking it
+static bool is_signed_index(ExprAST *index) {
+  NumType *num_type = dynamic_cast<NumType *>(index->get_type());
+  return num_type && num_type->is_signed;
+}
+
 Value *IndexExprAST::gen_value() {
   Type *type = get_type();
   Value *val = value->gen_value();
@@ -24,6 +32,10 @@ Value *IndexExprAST::gen_value() {
         type, LLVMBuildGEP2(curr_builder, p_type->get_points_to()->llvm_type(),
                             val->gen_val(), &index_v, 1, UN));
   } else if (ArrayType *arr_type = dynamic_cast<ArrayType *>(base_type)) {
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(curr_ctx);
+    if (options.bounds_check)
+      gen_bounds_check(index_v, is_signed_index(index),
+                       LLVMConstInt(i64, arr_type->count, false));
     if (val->has_ptr()) {
       LLVMValueRef index[2] = {LLVMConstNull(NumType(false).llvm_type()),
                                index_v};
@@ -42,6 +54,25 @@ Value *IndexExprAST::gen_value() {
         base_type->stringify());
 }
 
+BoundsCheckExprAST::BoundsCheckExprAST(ExprAST *index, ExprAST *length)
+    : index(index), length(length) {}
+Type *BoundsCheckExprAST::get_type() { return &null_type; }
+Value *BoundsCheckExprAST::gen_value() {
+  if (!options.bounds_check)
+    return null_value();
+  Type *index_type = index->get_type(), *length_type = length->get_type();
+  if (index_type->type_type() != TypeType::Number ||
+      length_type->type_type() != TypeType::Number ||
+      dynamic_cast<NumType *>(index_type)->is_floating ||
+      dynamic_cast<NumType *>(length_type)->is_floating)
+    error("__bounds_check__ needs an integer index and length, got "
+          << index_type->stringify() << " and " << length_type->stringify()
+          << ".");
+  gen_bounds_check(index->gen_value()->gen_val(), is_signed_index(index),
+                   length->gen_value()->gen_val());
+  return null_value();
+}
+
 NumAccessExprAST::NumAccessExprAST(unsigned int index, ExprAST *source)
     : index(index), source(source) {}
 
@@ -103,4 +134,4 @@ Value *PropAccessExprAST::gen_value() {
   return new BasicLoadValue(type, LLVMBuildStructGEP2(curr_builder,
                                                       source_type->llvm_type(),
                                                       struct_ptr, index, UN));
-}
\ No newline at end of file
+}
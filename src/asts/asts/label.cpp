@@ -0,0 +1,110 @@
+#include "../asts.h"
+#include <algorithm>
+
+thread_local std::vector<LabelState> label_stack;
+
+static LLVMBasicBlockRef label_block(std::string name) {
+  if (label_stack.empty())
+    error("label " + name + " outside of a function.");
+  LLVMBasicBlockRef &block = label_stack.back().blocks[name];
+  if (!block)
+    block = LLVMCreateBasicBlockInContext(curr_ctx, name.c_str());
+  return block;
+}
+void finish_labels() {
+  LabelState labels = std::move(label_stack.back());
+  label_stack.pop_back();
+  for (auto &[name, block] : labels.blocks)
+    if (!LLVMGetBasicBlockParent(block))
+      error("label " + name + " isn't defined.");
+  for (LLVMValueRef branch : labels.indirect_branches)
+    for (LLVMBasicBlockRef block : labels.address_taken)
+      LLVMAddDestination(branch, block);
+}
+static std::unordered_set<Value *> variables_in_scope() {
+  std::unordered_set<Value *> variables;
+  for (Scope *scope = curr_scope; scope; scope = scope->parent_scope)
+    for (auto &[name, value] : scope->named_variables)
+      variables.insert(value);
+  return variables;
+}
+// errors if the label has a variable in scope one of the gotos didn't have
+static void check_skipped_declarations(
+    std::string label, std::vector<std::unordered_set<Value *>> &gotos) {
+  for (auto &variables : gotos)
+    for (Scope *scope = curr_scope; scope; scope = scope->parent_scope)
+      for (auto &[name, value] : scope->named_variables)
+        if (!variables.count(value))
+          error("goto " + label + " jumps over the declaration of " + name +
+                ", which is in scope at the label.");
+}
+// create a new block for unused code after a goto
+static void continue_in_new_block() {
+  LLVMPositionBuilderAtEnd(
+      curr_builder,
+      LLVMAppendBasicBlockInContext(
+          curr_ctx, LLVMGetBasicBlockParent(LLVMGetInsertBlock(curr_builder)),
+          UN));
+}
+
+LabelExprAST::LabelExprAST(std::string name) : name(name) {}
+Type *LabelExprAST::get_type() { return &null_type; }
+Value *LabelExprAST::gen_value() {
+  LLVMBasicBlockRef block = label_block(name);
+  if (LLVMGetBasicBlockParent(block))
+    error("label " + name + " is defined twice.");
+  LabelState &labels = label_stack.back();
+  check_skipped_declarations(name, labels.pending[name]);
+  labels.pending.erase(name);
+  if (std::find(labels.address_taken.begin(), labels.address_taken.end(),
+                block) != labels.address_taken.end())
+    check_skipped_declarations(name, labels.pending_indirect);
+  LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(curr_builder));
+  LLVMBuildBr(curr_builder, block);
+  LLVMAppendExistingBasicBlock(func, block);
+  LLVMPositionBuilderAtEnd(curr_builder, block);
+  return null_value();
+}
+
+LabelAddrExprAST::LabelAddrExprAST(std::string label) : label(label) {}
+// *uint8 like a blockaddress in LLVM, `void *` in C
+Type *LabelAddrExprAST::get_type() {
+  return (new NumType(8, false, false))->ptr();
+}
+Value *LabelAddrExprAST::gen_value() {
+  LLVMBasicBlockRef block = label_block(label);
+  auto &address_taken = label_stack.back().address_taken;
+  if (std::find(address_taken.begin(), address_taken.end(), block) ==
+      address_taken.end())
+    address_taken.push_back(block);
+  LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(curr_builder));
+  return new ConstValue(get_type(), LLVMBlockAddress(func, block));
+}
+
+GotoExprAST::GotoExprAST(std::string label, ExprAST *addr)
+    : label(label), addr(addr) {}
+Type *GotoExprAST::get_type() { return &null_type; }
+Value *GotoExprAST::gen_value() {
+  if (!addr) {
+    LLVMBasicBlockRef block = label_block(label);
+    if (!LLVMGetBasicBlockParent(block))
+      label_stack.back().pending[label].push_back(variables_in_scope());
+    LLVMBuildBr(curr_builder, block);
+    continue_in_new_block();
+    return null_value();
+  }
+  if (addr->get_type()->type_type() != TypeType::Pointer)
+    error("goto * needs a label address, got " +
+          addr->get_type()->stringify() + ".");
+  if (label_stack.empty())
+    error("goto outside of a function.");
+  LLVMValueRef ptr = LLVMBuildPointerCast(
+      curr_builder, addr->gen_value()->gen_val(),
+      LLVMPointerType(LLVMInt8TypeInContext(curr_ctx), 0), UN);
+  LabelState &labels = label_stack.back();
+  labels.pending_indirect.push_back(variables_in_scope());
+  labels.indirect_branches.push_back(
+      LLVMBuildIndirectBr(curr_builder, ptr, labels.address_taken.size()));
+  continue_in_new_block();
+  return null_value();
+}
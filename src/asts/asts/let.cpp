@@ -7,7 +7,9 @@ LetExprAST::LetExprAST(std::string id, TypeAST *type, ExprAST *value,
 Type *LetExprAST::get_type() {
   Type *type;
   if (untyped) {
-    if (value)
+    if (inferred_type)
+      type = inferred_type;
+    else if (value)
       type = value->get_type();
     else
       error("Untyped valueless variable " + id);
@@ -26,14 +28,15 @@ LLVMValueRef LetExprAST::gen_toplevel() {
     if (value->is_constant()) {
       LLVMValueRef val = value->gen_value()->cast_to(type)->gen_val();
       LLVMSetInitializer(ptr, val);
-      if (constant)
+      if (constant) {
         var_value = new ConstValueWithPtr(type, ptr, val);
+        LLVMSetGlobalConstant(ptr, true);
+      }
     } else
+      // stored at runtime, so the global can't be constant
       add_store_before_main(ptr, new CastExprAST(value, type_ast(type)));
   }
   curr_scope->set_variable(id, var_value);
-  if (constant)
-    LLVMSetGlobalConstant(ptr, true);
   return ptr;
 }
 Value *LetExprAST::gen_value() {
@@ -50,10 +53,11 @@ Value *LetExprAST::gen_value() {
   LLVMValueRef ptr =
       LLVMBuildAlloca(curr_builder, type->llvm_type(), id.c_str());
   LLVMSetValueName2(ptr, id.c_str(), id.size());
-  if (value) {
-    LLVMValueRef llvm_val = value->gen_value()->cast_to(type)->gen_val();
-    LLVMBuildStore(curr_builder, llvm_val, ptr);
-  }
+  if (value)
+    gen_store(value->gen_value()->cast_to(type), ptr);
+  else if (type->get_destructor())
+    // its destructor runs at the end of the scope, so it starts zeroed
+    LLVMBuildStore(curr_builder, LLVMConstNull(type->llvm_type()), ptr);
   BasicLoadValue *val = new BasicLoadValue(type, ptr);
   curr_scope->set_variable(id, val);
   return val;
@@ -1,6 +1,7 @@
 #include "../asts.h"
+#include "../../options.h"
 
-std::vector<LoopState> loop_stack;
+thread_local std::vector<LoopState> loop_stack;
 
 ContinueExprAST::ContinueExprAST() {}
 Type *ContinueExprAST::get_type() { return &null_type; }
@@ -12,8 +13,9 @@ Value *ContinueExprAST::gen_value() {
   // create a new block for unused code after continue
   LLVMPositionBuilderAtEnd(
       curr_builder,
-      LLVMAppendBasicBlock(
-          LLVMGetBasicBlockParent(LLVMGetInsertBlock(curr_builder)), UN));
+      LLVMAppendBasicBlockInContext(
+          curr_ctx, LLVMGetBasicBlockParent(LLVMGetInsertBlock(curr_builder)),
+          UN));
   return new ConstValue(&null_type, LLVMConstNull(null_type.llvm_type()));
 }
 
@@ -27,35 +29,79 @@ Value *BreakExprAST::gen_value() {
   // create a new block for unused code after break
   LLVMPositionBuilderAtEnd(
       curr_builder,
-      LLVMAppendBasicBlock(
-          LLVMGetBasicBlockParent(LLVMGetInsertBlock(curr_builder)), UN));
+      LLVMAppendBasicBlockInContext(
+          curr_ctx, LLVMGetBasicBlockParent(LLVMGetInsertBlock(curr_builder)),
+          UN));
   return new ConstValue(&null_type, LLVMConstNull(null_type.llvm_type()));
 }
 
+// with --lean, a loop without else checks its condition in one block:
+//   br cond; cond: condbr body, merge; body: ... br post; post: ... br cond
+// continue jumps to `post` (the condition for while loops)
+static Value *gen_lean_loop(ExprAST *cond, ExprAST *body, ExprAST *post) {
+  LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(curr_builder));
+  LLVMBasicBlockRef cond_bb = LLVMAppendBasicBlockInContext(curr_ctx, func, UN);
+  LLVMBasicBlockRef body_bb = LLVMCreateBasicBlockInContext(curr_ctx, UN);
+  LLVMBasicBlockRef post_bb =
+      post ? LLVMCreateBasicBlockInContext(curr_ctx, UN) : cond_bb;
+  LLVMBasicBlockRef merge_bb = LLVMCreateBasicBlockInContext(curr_ctx, UN);
+  LLVMBuildBr(curr_builder, cond_bb);
+  LLVMPositionBuilderAtEnd(curr_builder, cond_bb);
+  LLVMValueRef cond_v =
+      cond->gen_value()->cast_to(new NumType(1, false, false))->gen_val();
+  LLVMBuildCondBr(curr_builder, cond_v, body_bb, merge_bb);
+  loop_stack.push_back(LoopState{
+      .break_block = merge_bb,
+      .continue_block = post_bb,
+  });
+  LLVMAppendExistingBasicBlock(func, body_bb);
+  LLVMPositionBuilderAtEnd(curr_builder, body_bb);
+  body->gen_value();
+  if (post) {
+    LLVMBuildBr(curr_builder, post_bb);
+    LLVMAppendExistingBasicBlock(func, post_bb);
+    LLVMPositionBuilderAtEnd(curr_builder, post_bb);
+    post->gen_value();
+  }
+  LLVMBuildBr(curr_builder, cond_bb);
+  loop_stack.pop_back();
+  LLVMAppendExistingBasicBlock(func, merge_bb);
+  LLVMPositionBuilderAtEnd(curr_builder, merge_bb);
+  return null_value();
+}
+
 WhileExprAST::WhileExprAST(ExprAST *cond, ExprAST *body, ExprAST *elze)
     : cond(cond), body(body), elze(elze) {}
 Type *WhileExprAST::get_type() { return &null_type; }
 Value *WhileExprAST::gen_value() {
+  if (options.lean && !elze)
+    return gen_lean_loop(cond, body, nullptr);
   // cast to bool
   LLVMValueRef cond_v1 =
       cond->gen_value()->cast_to(new NumType(1, false, false))->gen_val();
   LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(curr_builder));
   LLVMBasicBlockRef body_bb = LLVMAppendBasicBlockInContext(curr_ctx, func, UN);
   LLVMBasicBlockRef else_bb = LLVMCreateBasicBlockInContext(curr_ctx, UN);
+  LLVMBasicBlockRef check_bb = LLVMCreateBasicBlockInContext(curr_ctx, UN);
   LLVMBasicBlockRef merge_bb = LLVMCreateBasicBlockInContext(curr_ctx, UN);
+  // continue checks the condition again
   loop_stack.push_back(LoopState{
       .break_block = merge_bb,
-      .continue_block = body_bb,
+      .continue_block = check_bb,
   });
   // while
   LLVMBuildCondBr(curr_builder, cond_v1, body_bb, else_bb);
   // body
   LLVMPositionBuilderAtEnd(curr_builder, body_bb);
   body->gen_value();
+  LLVMBuildBr(curr_builder, check_bb);
+  LLVMAppendExistingBasicBlock(func, check_bb);
+  LLVMPositionBuilderAtEnd(curr_builder, check_bb);
   // cast to bool
   LLVMValueRef cond_v2 =
       cond->gen_value()->cast_to(new NumType(1, false, false))->gen_val();
   LLVMBuildCondBr(curr_builder, cond_v2, body_bb, merge_bb);
+  loop_stack.pop_back();
   // else
   LLVMAppendExistingBasicBlock(func, else_bb);
   LLVMPositionBuilderAtEnd(curr_builder, else_bb);
@@ -73,8 +119,45 @@ ForExprAST::ForExprAST(ExprAST *init, ExprAST *cond, ExprAST *body,
     : init(init), cond(cond), body(body), post(post), elze(elze) {}
 
 Type *ForExprAST::get_type() { return &null_type; }
+// `for (let i = 0; i < n; ...)` with a wider integer `n` declares `i` as
+// the signed integer of `n`'s width, so the counter isn't converted in
+// every comparison. It stays signed like the literal, `i - 1 < 0` works
+void ForExprAST::infer_counter_type() {
+  auto let = dynamic_cast<LetExprAST *>(init);
+  auto literal = let ? dynamic_cast<NumberExprAST *>(let->value) : nullptr;
+  auto comparison = dynamic_cast<BinaryExprAST *>(cond);
+  if (!literal || !let->untyped || !literal->untyped || !comparison ||
+      binop_precedence[comparison->op] != comparison_prec)
+    return;
+  let->inferred_type = nullptr;
+  auto is_counter = [&](ExprAST *side) {
+    auto var = dynamic_cast<VariableExprAST *>(side);
+    return var && var->name.to_str() == let->id;
+  };
+  ExprAST *bound = is_counter(comparison->LHS)   ? comparison->RHS
+                   : is_counter(comparison->RHS) ? comparison->LHS
+                                                 : nullptr;
+  if (!bound)
+    return;
+  // the bound can refer to the counter
+  Scope *prev_scope = curr_scope;
+  Scope counter_scope(curr_scope);
+  curr_scope = &counter_scope;
+  init->get_type();
+  auto bound_nt = dynamic_cast<NumType *>(bound->get_type());
+  curr_scope = prev_scope;
+  if (!bound_nt || bound_nt->is_floating ||
+      bound_nt->bits <= literal->type.bits)
+    return;
+  auto counter_nt = new NumType(bound_nt->bits, false, true);
+  if (literal->fits(counter_nt))
+    let->inferred_type = counter_nt;
+}
 Value *ForExprAST::gen_value() {
+  infer_counter_type();
   init->gen_value(); // let i = 0
+  if (options.lean && !elze)
+    return gen_lean_loop(cond, body, post);
   // cast to bool
   LLVMValueRef cond_v1 =
       cond->gen_value()->cast_to(new NumType(1, false, false))->gen_val();
@@ -100,6 +183,7 @@ Value *ForExprAST::gen_value() {
   LLVMValueRef cond_v2 =
       cond->gen_value()->cast_to(new NumType(1, false, false))->gen_val();
   LLVMBuildCondBr(curr_builder, cond_v2, body_bb, merge_bb);
+  loop_stack.pop_back();
   // else
   LLVMAppendExistingBasicBlock(func, else_bb);
   LLVMPositionBuilderAtEnd(curr_builder, else_bb);
@@ -110,4 +194,4 @@ Value *ForExprAST::gen_value() {
   LLVMAppendExistingBasicBlock(func, merge_bb);
   LLVMPositionBuilderAtEnd(curr_builder, merge_bb);
   return null_value();
-}
\ No newline at end of file
+}
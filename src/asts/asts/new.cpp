@@ -13,7 +13,24 @@ Value *NewExprAST::gen_value() {
   if (!st)
     error("Cannot create instance of non-struct type " +
           s_type->type()->stringify());
-  LLVMValueRef agg = LLVMConstNull(st->llvm_type());
+  LLVMTypeRef llvm_type = st->llvm_type();
+  if (is_new &&
+      LLVMStoreSizeOfType(target_data, llvm_type) >= AGGREGATE_MEMCPY_SIZE) {
+    // zeroed, then every field stored on its own
+    LLVMValueRef ptr = build_malloc(st)->gen_val();
+    gen_mem_set(ptr, LLVMConstNull(LLVMInt8TypeInContext(curr_ctx)),
+                LLVMSizeOf(llvm_type),
+                LLVMABIAlignmentOfType(target_data, llvm_type));
+    for (size_t i = 0; i < fields.size(); i++) {
+      auto &[key, value] = fields[i];
+      size_t index = key == "" ? i : st->get_index(key);
+      gen_store(value->gen_value()->cast_to(st->get_elem_type(index)),
+                LLVMBuildStructGEP2(curr_builder, llvm_type, ptr, index,
+                                    key.c_str()));
+    }
+    return new ConstValue(s_type->type()->ptr(), ptr);
+  }
+  LLVMValueRef agg = LLVMConstNull(llvm_type);
   for (size_t i = 0; i < fields.size(); i++) {
     auto &[key, value] = fields[i];
     size_t index = key == "" ? i : st->get_index(key);
@@ -37,11 +37,20 @@ NumberExprAST::NumberExprAST(unsigned long long val, NumType type)
   value.integer = val;
 }
 Type *NumberExprAST::get_type() { return &type; }
-Value *NumberExprAST::gen_value() {
-  if (type.is_floating)
-    return new ConstValue(&type,
-                          LLVMConstReal(type.llvm_type(), value.floating));
+bool NumberExprAST::fits(NumType *to) {
+  if (to->is_floating || type.is_floating)
+    return to->is_floating;
+  unsigned int value_bits = to->bits - to->is_signed;
+  return value_bits >= 64 || value.integer >> value_bits == 0;
+}
+Value *NumberExprAST::gen_value() { return gen_value(&type); }
+Value *NumberExprAST::gen_value(NumType *as) {
+  if (as->is_floating)
+    return new ConstValue(
+        as, LLVMConstReal(as->llvm_type(), type.is_floating
+                                               ? value.floating
+                                               : (double)value.integer));
   else
-    return new IntValue(type, value.integer);
+    return new IntValue(*as, value.integer);
 }
 bool NumberExprAST::is_constant() { return true; }
\ No newline at end of file
@@ -77,10 +77,13 @@ Generic *get_generic(Identifier id, Scope *scope) {
   _resolve(generics, generic);
 }
 
-Scope global_scope(nullptr);
-Scope *curr_scope = &global_scope;
+thread_local Scope global_scope(nullptr);
+thread_local Scope *curr_scope = &global_scope;
 Scope *push_scope() { return curr_scope = new Scope(curr_scope); }
 Scope *push_space(std::string name) {
+  // a space opened again adds to it, e.g. to the one of derive(serialize)
+  if (curr_scope->named_scopes.count(name))
+    return curr_scope = curr_scope->named_scopes[name];
   auto space = new Scope(curr_scope, name);
   curr_scope->set_scope(name, space);
   return curr_scope = space;
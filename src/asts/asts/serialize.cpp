@@ -0,0 +1,275 @@
+#include "../asts.h"
+
+// `struct Point derive(serialize) { ... }` adds
+//   fun(*Point) serialize(buf: *uint8): uint_ptrsize
+//   fun(*Point) deserialize(buf: *uint8): uint_ptrsize
+//   Point::wire_size(): uint_ptrsize
+//   Point::schema_hash(): uint64
+//   Point::view(buf: *uint8): *Point
+// The wire layout is the fields in order, without padding, with numbers in
+// little endian at their store size and structs, tuples and arrays inline.
+// (De)serialize return the bytes written or read. On little endian targets
+// it's the memory layout of the (packed) struct, so they're a memcpy and view
+// reads and writes a buffer in place, e.g. a mapped file. The schema hash is
+// of the field names and types, to check a buffer holds the struct.
+
+static void check_serializable(Type *type, std::string field) {
+  switch (type->type_type()) {
+  case TypeType::Number:
+    return;
+  case TypeType::Array:
+    return check_serializable(((ArrayType *)type)->elem, field);
+  case TypeType::Struct:
+    for (auto &[name, elem] : ((StructType *)type)->fields)
+      check_serializable(elem, field + "." + name);
+    return;
+  case TypeType::Tuple: {
+    auto &types = ((TupleType *)type)->types;
+    for (size_t i = 0; i < types.size(); i++)
+      check_serializable(types[i], field + "." + std::to_string(i));
+    return;
+  }
+  default:
+    error("Can't serialize " + field + ", a " + type->stringify() +
+          " (only numbers, structs, tuples and arrays).");
+  }
+}
+static void write_schema(Type *type, std::stringstream &schema) {
+  switch (type->type_type()) {
+  case TypeType::Array:
+    schema << "[";
+    write_schema(((ArrayType *)type)->elem, schema);
+    schema << "; " << ((ArrayType *)type)->count << "]";
+    break;
+  case TypeType::Struct:
+    // nested structs are named by their fields, not their names
+    schema << "{";
+    for (auto &[name, elem] : ((StructType *)type)->fields) {
+      schema << name << ": ";
+      write_schema(elem, schema);
+      schema << ", ";
+    }
+    schema << "}";
+    break;
+  case TypeType::Tuple:
+    schema << "(";
+    for (auto &elem : ((TupleType *)type)->types) {
+      write_schema(elem, schema);
+      schema << ", ";
+    }
+    schema << ")";
+    break;
+  default:
+    schema << type->stringify();
+  }
+}
+static unsigned long long schema_hash(Type *type) {
+  std::stringstream schema;
+  write_schema(type, schema);
+  unsigned long long hash = 0xcbf29ce484222325;
+  for (unsigned char c : schema.str())
+    hash = (hash ^ c) * 0x100000001b3;
+  return hash;
+}
+
+static unsigned long long wire_size(LLVMTypeRef type) {
+  switch (LLVMGetTypeKind(type)) {
+  case LLVMStructTypeKind: {
+    unsigned long long size = 0;
+    for (unsigned i = 0; i < LLVMCountStructElementTypes(type); i++)
+      size += wire_size(LLVMStructGetTypeAtIndex(type, i));
+    return size;
+  }
+  case LLVMArrayTypeKind:
+    return LLVMGetArrayLength(type) * wire_size(LLVMGetElementType(type));
+  default:
+    return LLVMStoreSizeOfType(target_data, type);
+  }
+}
+// whether the wire layout of the type is its memory layout
+static bool is_contiguous(LLVMTypeRef type) {
+  return LLVMByteOrder(target_data) == LLVMLittleEndian &&
+         wire_size(type) == LLVMABISizeOfType(target_data, type);
+}
+
+static LLVMValueRef bswap(LLVMValueRef value) {
+  LLVMTypeRef type = LLVMTypeOf(value);
+  std::string name =
+      "llvm.bswap.i" + std::to_string(LLVMGetIntTypeWidth(type));
+  LLVMValueRef func = LLVMGetNamedFunction(curr_module, name.c_str());
+  if (!func)
+    func = LLVMAddFunction(curr_module, name.c_str(),
+                           LLVMFunctionType(type, &type, 1, false));
+  return LLVMBuildCall2(curr_builder, LLVMGetElementType(LLVMTypeOf(func)),
+                        func, &value, 1, UN);
+}
+// copies a number between `ptr` and the wire at `buf`
+static void gen_number_copy(LLVMTypeRef type, LLVMValueRef ptr,
+                            LLVMValueRef buf, bool to_wire) {
+  unsigned long long size = LLVMStoreSizeOfType(target_data, type);
+  LLVMTypeRef wire_t = LLVMIntTypeInContext(curr_ctx, size * 8);
+  LLVMTypeRef bits_t =
+      LLVMGetTypeKind(type) == LLVMIntegerTypeKind
+          ? type
+          : LLVMIntTypeInContext(curr_ctx,
+                                 LLVMSizeOfTypeInBits(target_data, type));
+  bool swap = LLVMByteOrder(target_data) != LLVMLittleEndian && size > 1;
+  LLVMValueRef wire =
+      LLVMBuildPointerCast(curr_builder, buf, LLVMPointerType(wire_t, 0), UN);
+  LLVMValueRef value;
+  if (to_wire) {
+    value = LLVMBuildLoad2(curr_builder, type, ptr, UN);
+    LLVMSetAlignment(value, 1);
+    value = LLVMBuildBitCast(curr_builder, value, bits_t, UN);
+    value = LLVMBuildZExtOrBitCast(curr_builder, value, wire_t, UN);
+    if (swap)
+      value = bswap(value);
+    LLVMSetAlignment(LLVMBuildStore(curr_builder, value, wire), 1);
+  } else {
+    value = LLVMBuildLoad2(curr_builder, wire_t, wire, UN);
+    LLVMSetAlignment(value, 1);
+    if (swap)
+      value = bswap(value);
+    value = LLVMBuildTruncOrBitCast(curr_builder, value, bits_t, UN);
+    value = LLVMBuildBitCast(curr_builder, value, type, UN);
+    LLVMSetAlignment(LLVMBuildStore(curr_builder, value, ptr), 1);
+  }
+}
+// copies the value of `type` at `ptr` to the wire at `buf`, or back
+static void gen_wire_copy(LLVMTypeRef type, LLVMValueRef ptr, LLVMValueRef buf,
+                          bool to_wire) {
+  LLVMTypeRef i8 = LLVMInt8TypeInContext(curr_ctx);
+  LLVMTypeRef i64 = LLVMInt64TypeInContext(curr_ctx);
+  if (is_contiguous(type)) {
+    LLVMValueRef size = LLVMConstInt(i64, wire_size(type), false);
+    if (to_wire)
+      gen_mem_copy(buf, ptr, size, 1, false);
+    else
+      gen_mem_copy(ptr, buf, size, 1, false);
+    return;
+  }
+  switch (LLVMGetTypeKind(type)) {
+  case LLVMStructTypeKind: {
+    unsigned long long offset = 0;
+    for (unsigned i = 0; i < LLVMCountStructElementTypes(type); i++) {
+      LLVMTypeRef elem = LLVMStructGetTypeAtIndex(type, i);
+      LLVMValueRef index = LLVMConstInt(i64, offset, false);
+      gen_wire_copy(elem, LLVMBuildStructGEP2(curr_builder, type, ptr, i, UN),
+                    LLVMBuildGEP2(curr_builder, i8, buf, &index, 1, UN),
+                    to_wire);
+      offset += wire_size(elem);
+    }
+    break;
+  }
+  case LLVMArrayTypeKind: {
+    // a loop over the elements, arrays can be long
+    LLVMTypeRef elem = LLVMGetElementType(type);
+    LLVMValueRef count = LLVMConstInt(i64, LLVMGetArrayLength(type), false);
+    LLVMBasicBlockRef entry = LLVMGetInsertBlock(curr_builder);
+    LLVMValueRef func = LLVMGetBasicBlockParent(entry);
+    LLVMBasicBlockRef cond = LLVMAppendBasicBlockInContext(curr_ctx, func, UN);
+    LLVMBasicBlockRef body = LLVMAppendBasicBlockInContext(curr_ctx, func, UN);
+    LLVMBasicBlockRef after =
+        LLVMAppendBasicBlockInContext(curr_ctx, func, UN);
+    LLVMBuildBr(curr_builder, cond);
+    LLVMPositionBuilderAtEnd(curr_builder, cond);
+    LLVMValueRef i = LLVMBuildPhi(curr_builder, i64, UN);
+    LLVMBuildCondBr(curr_builder,
+                    LLVMBuildICmp(curr_builder, LLVMIntULT, i, count, UN),
+                    body, after);
+    LLVMPositionBuilderAtEnd(curr_builder, body);
+    LLVMValueRef indices[] = {LLVMConstNull(i64), i};
+    LLVMValueRef offset = LLVMBuildMul(
+        curr_builder, i, LLVMConstInt(i64, wire_size(elem), false), UN);
+    gen_wire_copy(elem,
+                  LLVMBuildInBoundsGEP2(curr_builder, type, ptr, indices, 2,
+                                        UN),
+                  LLVMBuildGEP2(curr_builder, i8, buf, &offset, 1, UN),
+                  to_wire);
+    LLVMValueRef next =
+        LLVMBuildAdd(curr_builder, i, LLVMConstInt(i64, 1, false), UN);
+    // the element copy may have added blocks
+    LLVMBasicBlockRef body_end = LLVMGetInsertBlock(curr_builder);
+    LLVMBuildBr(curr_builder, cond);
+    LLVMValueRef incoming[] = {LLVMConstNull(i64), next};
+    LLVMBasicBlockRef incoming_blocks[] = {entry, body_end};
+    LLVMAddIncoming(i, incoming, incoming_blocks, 2);
+    LLVMPositionBuilderAtEnd(curr_builder, after);
+    break;
+  }
+  default:
+    gen_number_copy(type, ptr, buf, to_wire);
+  }
+}
+
+// the argument of the generated function
+static VariableExprAST argument(std::string name) {
+  return VariableExprAST(name);
+}
+
+WireExprAST::WireExprAST(NamedStructType *type, WireOp op)
+    : type(type), op(op) {}
+Type *WireExprAST::get_type() {
+  switch (op) {
+  case WireOp::SchemaHash:
+    return new NumType(64, false, false);
+  case WireOp::View:
+    return type->ptr();
+  default:
+    return new NumType(false); // uint_ptrsize
+  }
+}
+Value *WireExprAST::gen_value() {
+  LLVMTypeRef struct_t = type->llvm_type();
+  Type *result_t = get_type();
+  switch (op) {
+  case WireOp::SchemaHash:
+    return new ConstValue(result_t, LLVMConstInt(result_t->llvm_type(),
+                                                 schema_hash(type), false));
+  case WireOp::View: {
+    if (!is_contiguous(struct_t))
+      error(type->name + "::view needs the wire layout of " + type->name +
+            " to be its memory layout, it isn't on this target.");
+    LLVMValueRef buf = argument("buf").gen_value()->gen_val();
+    return new ConstValue(result_t,
+                          LLVMBuildPointerCast(curr_builder, buf,
+                                               result_t->llvm_type(), UN));
+  }
+  case WireOp::Serialize:
+  case WireOp::Deserialize:
+    gen_wire_copy(struct_t, argument("this").gen_value()->gen_val(),
+                  argument("buf").gen_value()->gen_val(),
+                  op == WireOp::Serialize);
+    [[fallthrough]];
+  case WireOp::Size:
+    break;
+  }
+  return new ConstValue(result_t, LLVMConstInt(result_t->llvm_type(),
+                                               wire_size(struct_t), false));
+}
+
+void derive_serialize(std::string name, NamedStructType *type) {
+  check_serializable(type, name);
+  TypeAST *buf_t = type_ast((new NumType(8, false, false))->ptr());
+  TypeAST *size_t_ast = type_ast(new NumType(false));
+  FuncFlags flags;
+  flags.is_inline = true;
+  (new MethodAST(type_ast(type->ptr()), "serialize", {{"buf", buf_t}}, flags,
+                 size_t_ast, new WireExprAST(type, WireOp::Serialize)))
+      ->add();
+  (new MethodAST(type_ast(type->ptr()), "deserialize", {{"buf", buf_t}}, flags,
+                 size_t_ast, new WireExprAST(type, WireOp::Deserialize)))
+      ->add();
+  push_space(name);
+  (new FunctionAST("wire_size", {}, flags, size_t_ast,
+                   new WireExprAST(type, WireOp::Size)))
+      ->add();
+  (new FunctionAST("schema_hash", {}, flags,
+                   type_ast(new NumType(64, false, false)),
+                   new WireExprAST(type, WireOp::SchemaHash)))
+      ->add();
+  (new FunctionAST("view", {{"buf", buf_t}}, flags, type_ast(type->ptr()),
+                   new WireExprAST(type, WireOp::View)))
+      ->add();
+  pop_space();
+}
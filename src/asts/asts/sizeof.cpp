@@ -1,7 +1,7 @@
 #include "../asts.h"
 
-NumType sizeof_type;
-bool sizeof_type_init = false;
+thread_local NumType sizeof_type;
+thread_local bool sizeof_type_init = false;
 
 SizeofExprAST::SizeofExprAST(TypeAST *type) : type(type) {
   if (!sizeof_type_init) {
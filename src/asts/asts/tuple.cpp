@@ -18,8 +18,9 @@ Value *TupleExprAST::gen_value() {
     LLVMValueRef *vals = new LLVMValueRef[values.size()];
     for (size_t i = 0; i < values.size(); i++)
       vals[i] = values[i]->gen_value()->gen_val();
-    return new ConstValue(get_type(),
-                          LLVMConstStruct(vals, values.size(), true));
+    return new ConstValue(
+        get_type(),
+        LLVMConstStructInContext(curr_ctx, vals, values.size(), true));
   }
   Type *type = get_type();
   if (is_new) {
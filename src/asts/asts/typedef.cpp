@@ -2,10 +2,15 @@
 
 TypeDefAST::~TypeDefAST() {}
 
-AbsoluteTypeDefAST::AbsoluteTypeDefAST(std::string name, TypeAST *type)
-    : name(name), type(type) {}
+AbsoluteTypeDefAST::AbsoluteTypeDefAST(std::string name, TypeAST *type,
+                                       std::vector<std::string> derives)
+    : name(name), type(type), derives(derives) {}
 void AbsoluteTypeDefAST::gen_toplevel() {
-  curr_scope->set_type(name, type->type());
+  Type *defined = type->type();
+  curr_scope->set_type(name, defined);
+  // the parser only accepts serialize
+  if (!derives.empty())
+    derive_serialize(name, (NamedStructType *)defined);
 }
 
 GenericTypeDefAST::GenericTypeDefAST(std::string name,
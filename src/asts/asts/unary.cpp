@@ -47,11 +47,12 @@ Value *UnaryExprAST::gen_value() {
   case '&':
     return new ConstValue(type, val->gen_ptr());
   case T_RETURN:
-    add_return(val->gen_val());
+    add_return(val);
     LLVMPositionBuilderAtEnd(
         curr_builder,
-        LLVMAppendBasicBlock(
-            LLVMGetBasicBlockParent(LLVMGetInsertBlock(curr_builder)), UN));
+        LLVMAppendBasicBlockInContext(
+            curr_ctx, LLVMGetBasicBlockParent(LLVMGetInsertBlock(curr_builder)),
+            UN));
     return val;
   default:
     error("invalid prefix unary operator '" + token_to_str(op) + "'");
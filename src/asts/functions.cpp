@@ -1,7 +1,14 @@
 #include "functions.h"
+#include "../fir.h"
+#include "../icf.h"
+#include "../memo.h"
+#include "../options.h"
+#include "../share.h"
 #include "asts.h"
+#include <algorithm>
+#include <optional>
 
-ReturnState curr_return_state;
+thread_local ReturnState curr_return_state;
 void add_return(LLVMValueRef ret_val, LLVMBasicBlockRef curr_block) {
   LLVMBuildBr(curr_builder, curr_return_state.return_block);
   LLVMAddIncoming(curr_return_state.return_phi, &ret_val, &curr_block, 1);
@@ -13,16 +20,17 @@ void add_return(Value *ret_val, LLVMBasicBlockRef curr_block) {
 
 class MethodAST;
 class FunctionAST;
-std::unordered_map<std::string, std::vector<MethodAST *>>
+thread_local std::unordered_map<std::string, std::vector<MethodAST *>>
     curr_extension_methods;
-std::vector<FunctionAST *> always_compile_functions;
+thread_local std::vector<FunctionAST *> always_compile_functions;
+thread_local size_t function_count = 0;
 
-FuncFlags flags;
 FunctionAST::FunctionAST(std::string name,
                          std::vector<std::pair<std::string, TypeAST *>> args,
                          FuncFlags flags, TypeAST *return_type, ExprAST *body)
     : name(name), args(args), flags(flags), body(body),
-      ft(return_type, seconds(args), flags), base_scope(curr_scope) {
+      ft(return_type, seconds(args), flags), base_scope(curr_scope),
+      id(function_count++) {
   if (flags.always_compile)
     always_compile_functions.push_back(this);
 }
@@ -52,16 +60,31 @@ FuncValue *FunctionAST::declare(FunctionType *type) {
   LLVMValueRef func =
       LLVMAddFunction(curr_module, name.c_str(), type->llvm_type());
   LLVMSetFunctionCallConv(func, flags.call_conv);
+  if (flags.is_hot)
+    add_function_attr(func, "hot");
+  if (flags.is_cold)
+    add_function_attr(func, "cold");
+  // generated once and spliced into the callers by LLVM's inliner
+  if (flags.is_inline)
+    add_function_attr(func, "alwaysinline");
+  if (ft.is_generic())
+    mark_generic_instance(func, id);
+  if (body)
+    allow_folding(func);
   return already_declared[type] = new FuncValue(type, func);
 }
 static FunctionType *get_func_type(FunctionAST *func) {
   for (auto &[name, type] : func->args)
     curr_scope->declare_variable(name, type->type());
+  if (func->concrete_type)
+    return func->concrete_type;
   FunctionType *type = func->ft.func_type();
   if (!type->return_type && func->body)
     type->return_type = func->body->get_type();
   if (!type->return_type)
     error("can't infer return type of function " + func->name);
+  if (!func->ft.is_generic())
+    func->concrete_type = type;
   return type;
 }
 FunctionType *FunctionAST::get_type() {
@@ -93,6 +116,67 @@ FunctionType *FunctionAST::get_type(std::vector<ExprAST *> args) {
   curr_scope = prev_scope;
   return type;
 }
+// drops `block`'s incoming values from the phis of its successors
+static void remove_incoming(LLVMBasicBlockRef block) {
+  LLVMValueRef term = LLVMGetBasicBlockTerminator(block);
+  if (!term)
+    return;
+  LLVMBuilderRef builder = LLVMCreateBuilderInContext(curr_ctx);
+  for (unsigned i = 0, c = LLVMGetNumSuccessors(term); i < c; i++)
+    for (LLVMValueRef phi = LLVMGetFirstInstruction(LLVMGetSuccessor(term, i));
+         phi && LLVMGetInstructionOpcode(phi) == LLVMPHI;) {
+      LLVMValueRef next = LLVMGetNextInstruction(phi);
+      // the C API can't remove incoming values, the phi is rebuilt
+      LLVMPositionBuilderBefore(builder, phi);
+      LLVMValueRef kept = LLVMBuildPhi(builder, LLVMTypeOf(phi), "");
+      for (unsigned j = 0, n = LLVMCountIncoming(phi); j < n; j++) {
+        LLVMBasicBlockRef from = LLVMGetIncomingBlock(phi, j);
+        LLVMValueRef value = LLVMGetIncomingValue(phi, j);
+        if (from != block)
+          LLVMAddIncoming(kept, &value, &from, 1);
+      }
+      LLVMReplaceAllUsesWith(phi, kept);
+      LLVMInstructionEraseFromParent(phi);
+      phi = next;
+    }
+  LLVMDisposeBuilder(builder);
+}
+// with --lean, deletes the blocks nothing jumps to, that return, break and
+// continue leave behind
+static void remove_dead_blocks(LLVMValueRef func) {
+  if (!options.lean)
+    return;
+  LLVMBasicBlockRef entry = LLVMGetEntryBasicBlock(func);
+  for (bool removed = true; removed;) {
+    removed = false;
+    for (LLVMBasicBlockRef block = LLVMGetNextBasicBlock(entry), next; block;
+         block = next) {
+      next = LLVMGetNextBasicBlock(block);
+      if (LLVMGetFirstUse(LLVMBasicBlockAsValue(block)))
+        continue;
+      remove_incoming(block);
+      for (LLVMValueRef inst = LLVMGetFirstInstruction(block); inst;
+           inst = LLVMGetNextInstruction(inst))
+        if (LLVMGetTypeKind(LLVMTypeOf(inst)) != LLVMVoidTypeKind)
+          LLVMReplaceAllUsesWith(inst, LLVMGetUndef(LLVMTypeOf(inst)));
+      LLVMDeleteBasicBlock(block);
+      removed = true;
+    }
+  }
+  block_epoch++;
+}
+// whether a value of `type` holds a pointer to data, function pointers
+// don't count
+static bool has_data_pointer(Type *type) {
+  if (auto ptr = dynamic_cast<PointerType *>(type))
+    return !dynamic_cast<FunctionType *>(ptr->points_to);
+  if (auto arr = dynamic_cast<ArrayType *>(type))
+    return has_data_pointer(arr->elem);
+  if (auto tup = dynamic_cast<TupleType *>(type))
+    return std::any_of(tup->types.begin(), tup->types.end(), has_data_pointer);
+  return false;
+}
+
 // Returns PHI of return value, moves to return block
 LLVMValueRef FunctionAST::gen_body(LLVMValueRef *args, FunctionType *type) {
   for (size_t i = 0; i < this->args.size(); i++) {
@@ -103,15 +187,38 @@ LLVMValueRef FunctionAST::gen_body(LLVMValueRef *args, FunctionType *type) {
   }
   ReturnState prev_return_state = curr_return_state;
   LLVMBasicBlockRef body_bb = LLVMGetInsertBlock(curr_builder);
-  LLVMBasicBlockRef ret_bb = LLVMAppendBasicBlock(
-      LLVMGetBasicBlockParent(body_bb), ("return_" + name).c_str());
+  LLVMBasicBlockRef ret_bb = LLVMAppendBasicBlockInContext(
+      curr_ctx, LLVMGetBasicBlockParent(body_bb), ("return_" + name).c_str());
   LLVMPositionBuilderAtEnd(curr_builder, ret_bb);
   LLVMValueRef ret_phi =
       LLVMBuildPhi(curr_builder, type->return_type->llvm_type(), "retval");
   LLVMPositionBuilderAtEnd(curr_builder, body_bb);
   curr_return_state = {type->return_type, ret_bb, ret_phi};
+  std::optional<MemoCall> memo;
+  if (flags.memoize) {
+    if (flags.inline_frame || flags.is_vararg)
+      error("memoize doesn't work with inline(frame) or vararg functions.");
+    for (size_t i = 0; i < this->args.size(); i++)
+      if (has_data_pointer(type->arguments[i]))
+        error("memoize can't cache " << name << " by its argument "
+                                     << this->args[i].first << ", a "
+                                     << type->arguments[i]->stringify()
+                                     << " is compared by address, not by "
+                                        "what it points to.");
+    memo = gen_memo_lookup(LLVMGetBasicBlockParent(body_bb),
+                           std::vector(args, args + this->args.size()),
+                           type->return_type->llvm_type(), flags.memoize,
+                           flags.memoize_per_thread, ret_bb, ret_phi);
+    // returns store the result in the cache first
+    curr_return_state.return_block = memo->store_block;
+    curr_return_state.return_phi = memo->result_phi;
+  }
+  label_stack.emplace_back();
   Value *body_val = body->gen_value();
   add_return(body_val);
+  finish_labels();
+  if (memo)
+    gen_memo_store(*memo, ret_bb, ret_phi);
   LLVMMoveBasicBlockAfter(ret_bb, LLVMGetInsertBlock(curr_builder));
   LLVMPositionBuilderAtEnd(curr_builder, ret_bb);
   curr_return_state = prev_return_state;
@@ -146,17 +253,8 @@ ConstValue *FunctionAST::gen_call(std::vector<Value *> arg_vals) {
   LLVMValueRef *llvm_args = new LLVMValueRef[arg_vals.size()];
   for (size_t i = 0; i < arg_vals.size(); ++i)
     llvm_args[i] = arg_vals[i]->gen_val();
-  FunctionType *type = ft.func_type();
-  for (auto &[name, type] : this->args)
-    curr_scope->declare_variable(name, type->type());
-
-  if (!type->return_type) {
-    if (body)
-      type->return_type = body->get_type();
-    else
-      error("can't infer return type of function " + name);
-  }
-  if (flags.is_inline) {
+  FunctionType *type = get_func_type(this);
+  if (flags.inline_frame) {
     debug_log("inlining function " << name);
     LLVMValueRef ret = gen_body(llvm_args, type);
     curr_scope = prev_scope;
@@ -167,17 +265,20 @@ ConstValue *FunctionAST::gen_call(std::vector<Value *> arg_vals) {
       LLVMBuildCall2(curr_builder, type->llvm_type(), declaration->func,
                      llvm_args, arg_vals.size(), ("call_" + name).c_str());
   LLVMSetInstructionCallConv(call, flags.call_conv);
-  if (body && !LLVMGetFirstBasicBlock(declaration->func)) {
+  if (generates_body() && !LLVMGetFirstBasicBlock(declaration->func)) {
     debug_log("generating body for function " << name);
-    LLVMSetLinkage(declaration->func, LLVMInternalLinkage);
+    add_fir_function(type, LLVMGetValueName(declaration->func));
+    LLVMSetLinkage(declaration->func, body_linkage(LLVMInternalLinkage));
     size_t prev_unnamed = unnamed_acc;
     unnamed_acc = 0;
-    LLVMBasicBlockRef block = LLVMAppendBasicBlock(declaration->func, "");
+    LLVMBasicBlockRef block =
+        LLVMAppendBasicBlockInContext(curr_ctx, declaration->func, "");
     LLVMPositionBuilderAtEnd(curr_builder, block);
     // reuse llvm_args
     LLVMGetParams(declaration->func, llvm_args);
     LLVMValueRef ret = gen_body(llvm_args, type);
     LLVMBuildRet(curr_builder, ret);
+    remove_dead_blocks(declaration->func);
     unnamed_acc = prev_unnamed;
     if (auto next = LLVMGetNextInstruction(call))
       LLVMPositionBuilderBefore(curr_builder, next);
@@ -191,30 +292,26 @@ ConstValue *FunctionAST::gen_call(std::vector<Value *> arg_vals) {
 FuncValue *FunctionAST::gen_ptr() {
   Scope *prev_scope = curr_scope;
   curr_scope = new Scope(base_scope);
-  for (auto &[name, type] : this->args)
-    curr_scope->declare_variable(name, type->type());
-
-  FunctionType *type = ft.func_type();
-  if (!type->return_type) {
-    if (body)
-      type->return_type = body->get_type();
-    else
-      error("can't infer return type of function " + name);
-  }
+  FunctionType *type = get_func_type(this);
   FuncValue *declaration = declare(type);
-  if (body && !LLVMGetFirstBasicBlock(declaration->func)) {
+  mark_address_taken(declaration->func);
+  if (generates_body() && !LLVMGetFirstBasicBlock(declaration->func)) {
+    LLVMSetLinkage(declaration->func, body_linkage(LLVMExternalLinkage));
+    add_fir_function(type, LLVMGetValueName(declaration->func));
     LLVMValueRef position_back_to =
         LLVMGetInsertBlock(curr_builder)
             ? LLVMBuildAlloca(curr_builder, NullType().llvm_type(), UN)
             : nullptr;
     size_t prev_unnamed = unnamed_acc;
     unnamed_acc = 0;
-    LLVMBasicBlockRef block = LLVMAppendBasicBlock(declaration->func, "");
+    LLVMBasicBlockRef block =
+        LLVMAppendBasicBlockInContext(curr_ctx, declaration->func, "");
     LLVMPositionBuilderAtEnd(curr_builder, block);
     LLVMValueRef *llvm_args = new LLVMValueRef[this->args.size()];
     LLVMGetParams(declaration->func, llvm_args);
     LLVMValueRef ret = gen_body(llvm_args, type);
     LLVMBuildRet(curr_builder, ret);
+    remove_dead_blocks(declaration->func);
     unnamed_acc = prev_unnamed;
     if (position_back_to) {
       if (auto next = LLVMGetNextInstruction(position_back_to))
@@ -229,6 +326,27 @@ FuncValue *FunctionAST::gen_ptr() {
   return declaration;
 }
 
+bool FunctionAST::generates_body() {
+  return body && (origin != FileOrigin::OtherUnit || flags.is_inline ||
+                  ft.is_generic());
+}
+LLVMLinkage FunctionAST::body_linkage(LLVMLinkage single) {
+  // every module that calls it has its own copy to inline
+  if (flags.is_inline)
+    return LLVMInternalLinkage;
+  switch (origin) {
+  case FileOrigin::Single:
+    return single;
+  case FileOrigin::Unit:
+    if (!ft.is_generic())
+      return LLVMExternalLinkage;
+    [[fallthrough]];
+  default:
+    // instantiated by every unit that uses it, the linker keeps one
+    return LLVMLinkOnceODRLinkage;
+  }
+}
+
 void FunctionAST::add() { curr_scope->set_function(name, this); }
 
 auto add_this_type(std::vector<std::pair<std::string, TypeAST *>> args,
@@ -1,4 +1,5 @@
 #pragma once
+#include "../reader.h"
 #include "../values.h"
 #include "types.h"
 
@@ -7,7 +8,7 @@ struct ReturnState {
   LLVMBasicBlockRef return_block;
   LLVMValueRef return_phi;
 };
-extern ReturnState curr_return_state;
+extern thread_local ReturnState curr_return_state;
 void add_return(LLVMValueRef ret_val, LLVMBasicBlockRef curr_block =
                                           LLVMGetInsertBlock(curr_builder));
 void add_return(Value *ret_val, LLVMBasicBlockRef curr_block =
@@ -15,9 +16,9 @@ void add_return(Value *ret_val, LLVMBasicBlockRef curr_block =
 
 class MethodAST;
 class FunctionAST;
-extern std::unordered_map<std::string, std::vector<MethodAST *>>
+extern thread_local std::unordered_map<std::string, std::vector<MethodAST *>>
     curr_extension_methods;
-extern std::vector<FunctionAST *> always_compile_functions;
+extern thread_local std::vector<FunctionAST *> always_compile_functions;
 
 class ExprAST;
 class Scope;
@@ -29,7 +30,12 @@ public:
   ExprAST *body;
   FunctionTypeAST ft;
   FuncFlags flags;
+  FileOrigin origin = FileOrigin::Single;
   std::unordered_map<FunctionType *, FuncValue *> already_declared;
+  // the type of a non-generic function, it's the same in every call
+  FunctionType *concrete_type = nullptr;
+  // numbers functions in parse order, the same on every codegen worker
+  size_t id;
   FunctionAST(std::string name,
               std::vector<std::pair<std::string, TypeAST *>> args,
               FuncFlags flags = {}, TypeAST *return_type = nullptr,
@@ -43,6 +49,12 @@ public:
   ConstValue *gen_call(std::vector<ExprAST *> args);
   ConstValue *gen_call(std::vector<Value *> arg_vals);
   FuncValue *gen_ptr();
+  // whether this module defines the body, other units define their own
+  // functions, but inline and generic ones are defined everywhere they're
+  // called
+  bool generates_body();
+  // linkage of a generated body, `single` when the program is one module
+  LLVMLinkage body_linkage(LLVMLinkage single);
   virtual void add();
 };
 
@@ -15,17 +15,23 @@ std::string TypeAST::stringify() { return type()->stringify(); }
 PointerType *TypeAST::ptr() { return type()->ptr(); }
 
 Generic::Generic(std::vector<std::string> params, TypeAST *ast)
-    : params(params), ast(ast) {}
+    : params(params), ast(ast), scope(curr_scope) {}
 Type *Generic::generate(std::vector<Type *> args) {
   if (args.size() != params.size())
     error("wrong number of arguments to generic type");
+  if (auto instance = instances.find(args); instance != instances.end())
+    return instance->second;
+  // the parameters are bound in a scope of their own, not the caller's
+  Scope *prev_scope = curr_scope;
+  curr_scope = new Scope(scope);
   for (size_t i = 0; i < params.size(); i++)
     curr_scope->set_type(params[i], args[i]);
   Type *type = ast->type();
-  return type;
+  curr_scope = prev_scope;
+  return instances[args] = type;
 }
 
-static std::unordered_set<std::string> curr_generic_args;
+static thread_local std::unordered_set<std::string> curr_generic_args;
 bool Generic::match(Type *type, uint *g) {
   for (auto param : params)
     curr_generic_args.insert(param);
@@ -44,22 +50,25 @@ UnaryTypeAST::UnaryTypeAST(int opc, TypeAST *operand)
     : opc(opc), operand(operand) {}
 Type *UnaryTypeAST::type() {
   Type *operand = this->operand->type();
+  if (Type *type = cache.get({operand}))
+    return type;
   switch (opc) {
   case '*':
-    return operand->ptr();
+    return cache.set({operand}, operand->ptr());
   case '&':
     if (PointerType *ptr = dynamic_cast<PointerType *>(operand))
-      return ptr->get_points_to();
+      return cache.set({operand}, ptr->get_points_to());
     else
       error("use of & type operator without pointer on right-hand side");
   case T_UNSIGNED:
     if (NumType *num = dynamic_cast<NumType *>(operand))
       if (!num->is_floating)
-        return new NumType(num->bits, false, false);
+        return cache.set({operand}, new NumType(num->bits, false, false));
     error("use of 'unsigned' type operator with non-int on right-hand side");
   case T_SIGNED:
     if (NumType *num = dynamic_cast<NumType *>(operand))
-      return new NumType(num->bits, num->is_floating, true);
+      return cache.set({operand},
+                       new NumType(num->bits, num->is_floating, true));
     else
       error("use of 'signed' type operator with non-number on right-hand side");
   default:
@@ -151,7 +160,12 @@ bool FunctionTypeAST::is_generic() {
 
 ArrayTypeAST::ArrayTypeAST(TypeAST *elem, unsigned int count)
     : elem(elem), count(count) {}
-Type *ArrayTypeAST::type() { return new ArrayType(elem->type(), count); }
+Type *ArrayTypeAST::type() {
+  Type *elem = this->elem->type();
+  if (Type *type = cache.get({elem}))
+    return type;
+  return cache.set({elem}, new ArrayType(elem, count));
+}
 bool ArrayTypeAST::eq(TypeAST *other) {
   if (ArrayTypeAST *a = dynamic_cast<ArrayTypeAST *>(other))
     return elem->eq(a->elem) && count == a->count;
@@ -199,11 +213,20 @@ std::string GenericArrayTypeAST::stringify() {
 StructTypeAST::StructTypeAST(
     std::vector<std::pair<std::string, TypeAST *>> members)
     : members(members) {}
+std::vector<Type *> StructTypeAST::member_types() {
+  std::vector<Type *> types;
+  for (auto &m : members)
+    types.push_back(m.second->type());
+  return types;
+}
 Type *StructTypeAST::type() {
+  std::vector<Type *> member_types = this->member_types();
+  if (Type *type = cache.get(member_types))
+    return type;
   std::vector<std::pair<std::string, Type *>> types;
-  for (auto &m : members)
-    types.push_back(std::make_pair(m.first, m.second->type()));
-  return new StructType(types);
+  for (size_t i = 0; i < members.size(); i++)
+    types.push_back(std::make_pair(members[i].first, member_types[i]));
+  return cache.set(member_types, new StructType(types));
 }
 bool StructTypeAST::eq(TypeAST *other) {
   StructTypeAST *s = dynamic_cast<StructTypeAST *>(other);
@@ -240,10 +263,13 @@ NamedStructTypeAST::NamedStructTypeAST(
     std::string name, std::vector<std::pair<std::string, TypeAST *>> members)
     : name(name), StructTypeAST(members) {}
 Type *NamedStructTypeAST::type() {
+  std::vector<Type *> member_types = this->member_types();
+  if (Type *type = cache.get(member_types))
+    return type;
   std::vector<std::pair<std::string, Type *>> types;
-  for (auto &m : members)
-    types.push_back(std::make_pair(m.first, m.second->type()));
-  return new NamedStructType(name, types);
+  for (size_t i = 0; i < members.size(); i++)
+    types.push_back(std::make_pair(members[i].first, member_types[i]));
+  return cache.set(member_types, new NamedStructType(name, types));
 }
 
 TupleTypeAST::TupleTypeAST(std::vector<TypeAST *> types) : types(types) {}
@@ -251,7 +277,9 @@ Type *TupleTypeAST::type() {
   std::vector<Type *> fields(types.size());
   for (size_t i = 0; i < types.size(); i++)
     fields[i] = types[i]->type();
-  return new TupleType(fields);
+  if (Type *type = cache.get(fields))
+    return type;
+  return cache.set(fields, new TupleType(fields));
 }
 bool TupleTypeAST::eq(TypeAST *other) {
   TupleTypeAST *t = dynamic_cast<TupleTypeAST *>(other);
@@ -327,7 +355,12 @@ bool GenericAccessAST::match(Type *type, uint *g) {
   else
     error("undefined generic type: " + name);
 }
-bool GenericAccessAST::is_generic() { return false; }
+bool GenericAccessAST::is_generic() {
+  for (auto param : params)
+    if (param->is_generic())
+      return true;
+  return false;
+}
 std::string GenericAccessAST::stringify() {
   std::stringstream ss;
   ss << name << "<";
@@ -1,6 +1,21 @@
 #pragma once
 #include "../types.h"
 #include "../utils.h"
+#include <unordered_map>
+
+/// TypeCache - the type a TypeAST last resolved to and the types of the parts
+/// it was built from. It's reused while the parts resolve to the same types.
+struct TypeCache {
+  std::vector<Type *> parts;
+  Type *type = nullptr;
+  Type *get(const std::vector<Type *> &parts) {
+    return type && parts == this->parts ? type : nullptr;
+  }
+  Type *set(std::vector<Type *> parts, Type *type) {
+    this->parts = parts;
+    return this->type = type;
+  }
+};
 
 class TypeAST {
 public:
@@ -18,9 +33,14 @@ public:
   PointerType *ptr();
 };
 
+struct Scope;
 struct Generic {
   std::vector<std::string> params;
   TypeAST *ast;
+  // the scope it's defined in, instances resolve names from there
+  Scope *scope;
+  // instances by the types of their arguments
+  std::unordered_map<std::vector<Type *>, Type *> instances;
   Generic(std::vector<std::string> params, TypeAST *ast);
   Type *generate(std::vector<Type *> args);
   bool match(Type *type, uint *g);
@@ -38,6 +58,8 @@ public:
 inline TypeAST *type_ast(Type *t) { return new AbsoluteTypeAST(t); }
 
 class UnaryTypeAST : public TypeAST {
+  TypeCache cache;
+
 public:
   int opc;
   TypeAST *operand;
@@ -65,6 +87,8 @@ public:
 };
 
 class ArrayTypeAST : public TypeAST {
+  TypeCache cache;
+
 public:
   TypeAST *elem;
   unsigned int count;
@@ -88,6 +112,10 @@ public:
 };
 
 class StructTypeAST : public TypeAST {
+protected:
+  TypeCache cache;
+  std::vector<Type *> member_types();
+
 public:
   std::vector<std::pair<std::string, TypeAST *>> members;
   StructTypeAST(std::vector<std::pair<std::string, TypeAST *>> members);
@@ -105,6 +133,8 @@ public:
 };
 
 class TupleTypeAST : public TypeAST {
+  TypeCache cache;
+
 public:
   std::vector<TypeAST *> types;
   TupleTypeAST(std::vector<TypeAST *> types);
@@ -0,0 +1,24 @@
+#include "bitcode.h"
+#include "llvm/Analysis/ModuleSummaryAnalysis.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+// after LLVM, which has functions named error
+#include "utils.h"
+
+void write_thinlto_bitcode(LLVMModuleRef module, std::string path) {
+  llvm::Module *mod = llvm::unwrap(module);
+  // clang marks its ThinLTO units the same way, lld refuses to mix them with
+  // units that were split for CFI otherwise
+  mod->addModuleFlag(llvm::Module::Error, "EnableSplitLTOUnit", 0u);
+  llvm::ProfileSummaryInfo profile_summary(*mod);
+  llvm::ModuleSummaryIndex index =
+      llvm::buildModuleSummaryIndex(*mod, nullptr, &profile_summary);
+  std::error_code err;
+  llvm::raw_fd_ostream out(path, err, llvm::sys::fs::OF_None);
+  if (err)
+    error("Can't open '" << path << "': " << err.message());
+  llvm::WriteBitcodeToFile(*mod, out, false, &index);
+}
@@ -0,0 +1,5 @@
+#pragma once
+#include "consts.h"
+// writes `module` as bitcode with a ThinLTO module summary, for linking with
+// other (e.g. clang -flto=thin) bitcode through lld --thinlto
+void write_thinlto_bitcode(LLVMModuleRef module, std::string path);
@@ -0,0 +1,465 @@
+#include "bounds.h"
+#include "options.h"
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+#define BOUNDS_MD "fy.bounds"
+#define FAIL_FUNC "fy.bounds_fail"
+
+std::atomic<size_t> bounds_checks = 0, removed_bounds_checks = 0;
+std::mutex remaining_bounds_checks_mutex;
+std::vector<std::pair<std::string, size_t>> remaining_bounds_checks;
+
+static unsigned bounds_md_kind() {
+  return LLVMGetMDKindIDInContext(curr_ctx, BOUNDS_MD, strlen(BOUNDS_MD));
+}
+static LLVMValueRef get_declaration(const char *name, LLVMTypeRef type) {
+  LLVMValueRef func = LLVMGetNamedFunction(curr_module, name);
+  if (!func)
+    func = LLVMAddFunction(curr_module, name, type);
+  // the program may have declared it with other argument types
+  return LLVMConstBitCast(func, LLVMPointerType(type, 0));
+}
+// fy.bounds_fail(index, length, is_signed) prints them and traps, the index
+// is sign extended if it's signed
+static LLVMValueRef get_fail_function() {
+  if (LLVMValueRef func = LLVMGetNamedFunction(curr_module, FAIL_FUNC))
+    return func;
+  LLVMTypeRef i1 = LLVMInt1TypeInContext(curr_ctx);
+  LLVMTypeRef i32 = LLVMInt32TypeInContext(curr_ctx);
+  LLVMTypeRef i64 = LLVMInt64TypeInContext(curr_ctx);
+  LLVMTypeRef i8_ptr = LLVMPointerType(LLVMInt8TypeInContext(curr_ctx), 0);
+  LLVMTypeRef void_type = LLVMVoidTypeInContext(curr_ctx);
+  LLVMTypeRef params[] = {i64, i64, i1};
+  LLVMValueRef func = LLVMAddFunction(
+      curr_module, FAIL_FUNC, LLVMFunctionType(void_type, params, 3, false));
+  LLVMSetLinkage(func, LLVMPrivateLinkage);
+  add_function_attr(func, "noreturn");
+  add_function_attr(func, "cold");
+  add_function_attr(func, "noinline");
+  LLVMBuilderRef builder = LLVMCreateBuilderInContext(curr_ctx);
+  LLVMPositionBuilderAtEnd(builder,
+                           LLVMAppendBasicBlockInContext(curr_ctx, func, ""));
+  LLVMTypeRef printf_type = LLVMFunctionType(i32, &i8_ptr, 1, true);
+  LLVMValueRef format = LLVMBuildSelect(
+      builder, LLVMGetParam(func, 2),
+      LLVMBuildGlobalStringPtr(
+          builder, "Index %lld is out of bounds of length %llu\n", ""),
+      LLVMBuildGlobalStringPtr(
+          builder, "Index %llu is out of bounds of length %llu\n", ""),
+      "");
+  LLVMValueRef args[] = {format, LLVMGetParam(func, 0),
+                         LLVMGetParam(func, 1)};
+  LLVMBuildCall2(builder, printf_type, get_declaration("printf", printf_type),
+                 args, 3, "");
+  // the trap doesn't flush stdout
+  LLVMTypeRef fflush_type = LLVMFunctionType(i32, &i8_ptr, 1, false);
+  LLVMValueRef all_streams = LLVMConstNull(i8_ptr);
+  LLVMBuildCall2(builder, fflush_type, get_declaration("fflush", fflush_type),
+                 &all_streams, 1, "");
+  LLVMTypeRef trap_type = LLVMFunctionType(void_type, nullptr, 0, false);
+  LLVMBuildCall2(builder, trap_type, get_declaration("llvm.trap", trap_type),
+                 nullptr, 0, "");
+  LLVMBuildUnreachable(builder);
+  LLVMDisposeBuilder(builder);
+  return func;
+}
+static LLVMValueRef to_i64(LLVMValueRef value, bool is_signed) {
+  LLVMTypeRef i64 = LLVMInt64TypeInContext(curr_ctx);
+  return LLVMGetIntTypeWidth(LLVMTypeOf(value)) > 64
+             ? LLVMBuildTrunc(curr_builder, value, i64, UN)
+         : is_signed ? LLVMBuildSExt(curr_builder, value, i64, UN)
+                     : LLVMBuildZExt(curr_builder, value, i64, UN);
+}
+
+void gen_bounds_check(LLVMValueRef index, bool is_signed, LLVMValueRef length) {
+  LLVMTypeRef index_type = LLVMTypeOf(index);
+  unsigned index_width = LLVMGetIntTypeWidth(index_type);
+  unsigned length_width = LLVMGetIntTypeWidth(LLVMTypeOf(length));
+  // a constant length that fits is compared in the index's type, like the
+  // loop conditions on the index
+  bool fits = index_width >= 64 ||
+              (LLVMIsAConstantInt(length) &&
+               LLVMConstIntGetZExtValue(length) >> index_width == 0);
+  if (length_width > index_width && fits)
+    length = LLVMBuildTrunc(curr_builder, length, index_type, UN);
+  else if (length_width > index_width)
+    index = is_signed ? LLVMBuildSExt(curr_builder, index,
+                                      LLVMTypeOf(length), UN)
+                      : LLVMBuildZExt(curr_builder, index,
+                                      LLVMTypeOf(length), UN);
+  else if (length_width < index_width)
+    length = LLVMBuildZExt(curr_builder, length, index_type, UN);
+  if (LLVMIsAConstantInt(index) && LLVMIsAConstantInt(length)) {
+    unsigned long long index_v = LLVMConstIntGetZExtValue(index);
+    if (index_v < LLVMConstIntGetZExtValue(length))
+      return;
+    error("index " << (is_signed ? std::to_string(
+                                       LLVMConstIntGetSExtValue(index))
+                                 : std::to_string(index_v))
+                   << " is out of bounds of length "
+                   << LLVMConstIntGetZExtValue(length));
+  }
+  LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(curr_builder));
+  LLVMBasicBlockRef in_bounds =
+      LLVMAppendBasicBlockInContext(curr_ctx, func, "in_bounds");
+  LLVMBasicBlockRef out_of_bounds =
+      LLVMAppendBasicBlockInContext(curr_ctx, func, "out_of_bounds");
+  LLVMValueRef br = LLVMBuildCondBr(
+      curr_builder,
+      LLVMBuildICmp(curr_builder, LLVMIntULT, index, length, UN), in_bounds,
+      out_of_bounds);
+  LLVMSetMetadata(br, bounds_md_kind(),
+                  LLVMMDNodeInContext(curr_ctx, nullptr, 0));
+  LLVMPositionBuilderAtEnd(curr_builder, out_of_bounds);
+  LLVMValueRef fail = get_fail_function();
+  LLVMValueRef args[] = {
+      to_i64(index, is_signed), to_i64(length, false),
+      LLVMConstInt(LLVMInt1TypeInContext(curr_ctx), is_signed, false)};
+  LLVMBuildCall2(curr_builder, LLVMGetElementType(LLVMTypeOf(fail)), fail,
+                 args, 3, "");
+  LLVMBuildUnreachable(curr_builder);
+  LLVMPositionBuilderAtEnd(curr_builder, in_bounds);
+}
+
+/// Dominators - the immediate dominators of the reachable blocks of a
+/// function (Cooper, Harvey and Kennedy's algorithm).
+struct Dominators {
+  std::unordered_map<LLVMBasicBlockRef, LLVMBasicBlockRef> idom;
+  std::unordered_map<LLVMBasicBlockRef, std::vector<LLVMBasicBlockRef>> preds;
+
+  Dominators(LLVMValueRef func) {
+    // reverse postorder
+    std::vector<LLVMBasicBlockRef> postorder;
+    std::unordered_set<LLVMBasicBlockRef> visited;
+    std::vector<std::pair<LLVMBasicBlockRef, unsigned>> stack;
+    LLVMBasicBlockRef entry = LLVMGetEntryBasicBlock(func);
+    stack.push_back({entry, 0});
+    visited.insert(entry);
+    while (!stack.empty()) {
+      auto &[block, next] = stack.back();
+      LLVMValueRef term = LLVMGetBasicBlockTerminator(block);
+      if (term && next < LLVMGetNumSuccessors(term)) {
+        LLVMBasicBlockRef succ = LLVMGetSuccessor(term, next++);
+        preds[succ].push_back(block);
+        if (visited.insert(succ).second)
+          stack.push_back({succ, 0});
+      } else {
+        postorder.push_back(block);
+        stack.pop_back();
+      }
+    }
+    std::unordered_map<LLVMBasicBlockRef, size_t> order;
+    for (size_t i = 0; i < postorder.size(); i++)
+      order[postorder[i]] = i;
+    auto intersect = [&](LLVMBasicBlockRef a, LLVMBasicBlockRef b) {
+      while (a != b) {
+        while (order[a] < order[b])
+          a = idom[a];
+        while (order[b] < order[a])
+          b = idom[b];
+      }
+      return a;
+    };
+    idom[entry] = entry;
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (auto it = postorder.rbegin(); it != postorder.rend(); it++) {
+        if (*it == entry)
+          continue;
+        LLVMBasicBlockRef new_idom = nullptr;
+        for (LLVMBasicBlockRef pred : preds[*it])
+          if (idom.count(pred))
+            new_idom = new_idom ? intersect(pred, new_idom) : pred;
+        if (idom[*it] != new_idom) {
+          idom[*it] = new_idom;
+          changed = true;
+        }
+      }
+    }
+  }
+  // whether `a` dominates `b`, a reachable block
+  bool dominates(LLVMBasicBlockRef a, LLVMBasicBlockRef b) {
+    for (;; b = idom[b]) {
+      if (a == b)
+        return true;
+      if (idom[b] == b)
+        return false;
+    }
+  }
+};
+
+/// Fact - a condition known to hold in a block: `lhs pred rhs`.
+struct Fact {
+  LLVMIntPredicate pred;
+  LLVMValueRef lhs, rhs;
+};
+static LLVMIntPredicate inverse(LLVMIntPredicate pred) {
+  switch (pred) {
+  case LLVMIntEQ:
+    return LLVMIntNE;
+  case LLVMIntNE:
+    return LLVMIntEQ;
+  case LLVMIntUGT:
+    return LLVMIntULE;
+  case LLVMIntUGE:
+    return LLVMIntULT;
+  case LLVMIntULT:
+    return LLVMIntUGE;
+  case LLVMIntULE:
+    return LLVMIntUGT;
+  case LLVMIntSGT:
+    return LLVMIntSLE;
+  case LLVMIntSGE:
+    return LLVMIntSLT;
+  case LLVMIntSLT:
+    return LLVMIntSGE;
+  case LLVMIntSLE:
+    return LLVMIntSGT;
+  }
+  return pred;
+}
+// adds the comparison `pred` branches on to get to `succ` to `facts`
+static void add_edge_fact(LLVMBasicBlockRef pred, LLVMBasicBlockRef succ,
+                          std::vector<Fact> &facts) {
+  LLVMValueRef term = LLVMGetBasicBlockTerminator(pred);
+  if (!term || !LLVMIsABranchInst(term) || !LLVMIsConditional(term) ||
+      LLVMGetSuccessor(term, 0) == LLVMGetSuccessor(term, 1))
+    return;
+  LLVMValueRef cond = LLVMGetCondition(term);
+  if (!LLVMIsAICmpInst(cond))
+    return;
+  LLVMIntPredicate cmp = LLVMGetICmpPredicate(cond);
+  if (LLVMGetSuccessor(term, 1) == succ)
+    cmp = inverse(cmp);
+  facts.push_back({cmp, LLVMGetOperand(cond, 0), LLVMGetOperand(cond, 1)});
+}
+// the conditions of the branches every path to `block` takes: an edge to a
+// dominator that is its only predecessor
+static std::vector<Fact> block_facts(Dominators &doms,
+                                     LLVMBasicBlockRef block) {
+  std::vector<Fact> facts;
+  for (LLVMBasicBlockRef curr = block; doms.idom.count(curr);) {
+    auto &preds = doms.preds[curr];
+    if (preds.size() == 1)
+      add_edge_fact(preds[0], curr, facts);
+    LLVMBasicBlockRef idom = doms.idom[curr];
+    if (idom == curr)
+      break;
+    curr = idom;
+  }
+  return facts;
+}
+
+// whether `value` is below `bound` by `fact`, as signed or unsigned numbers
+static bool below_by(Fact fact, LLVMValueRef value, LLVMValueRef bound,
+                     bool is_signed) {
+  LLVMIntPredicate lt = is_signed ? LLVMIntSLT : LLVMIntULT;
+  LLVMIntPredicate gt = is_signed ? LLVMIntSGT : LLVMIntUGT;
+  LLVMValueRef lhs = fact.lhs, rhs = fact.rhs;
+  if (fact.pred == gt)
+    std::swap(lhs, rhs);
+  else if (fact.pred != lt)
+    return false;
+  if (lhs != value)
+    return false;
+  if (rhs == bound)
+    return true;
+  // below a smaller constant
+  if (!LLVMIsAConstantInt(rhs) || !LLVMIsAConstantInt(bound) ||
+      LLVMGetIntTypeWidth(LLVMTypeOf(rhs)) > 64)
+    return false;
+  if (is_signed)
+    return LLVMConstIntGetSExtValue(rhs) <= 0 ||
+           (unsigned long long)LLVMConstIntGetSExtValue(rhs) <=
+               LLVMConstIntGetZExtValue(bound);
+  return LLVMConstIntGetZExtValue(rhs) <= LLVMConstIntGetZExtValue(bound);
+}
+// whether `value` is below a bound by one of `facts` that lets it grow by
+// `step` without wrapping as a signed number: below any signed bound by one,
+// else below a small enough constant
+static bool increments_without_wrap(std::vector<Fact> &facts,
+                                    LLVMValueRef value, long long step) {
+  if (step == 0)
+    return true;
+  for (Fact &fact : facts) {
+    LLVMValueRef lhs = fact.lhs, rhs = fact.rhs;
+    LLVMIntPredicate pred = fact.pred;
+    if (pred == LLVMIntSGT || pred == LLVMIntUGT) {
+      std::swap(lhs, rhs);
+      pred = pred == LLVMIntSGT ? LLVMIntSLT : LLVMIntULT;
+    }
+    if ((pred != LLVMIntSLT && pred != LLVMIntULT) || lhs != value)
+      continue;
+    if (pred == LLVMIntSLT && step == 1)
+      return true;
+    unsigned width = LLVMGetIntTypeWidth(LLVMTypeOf(rhs));
+    if (!LLVMIsAConstantInt(rhs) || width > 64)
+      continue;
+    long long max = width == 64 ? INT64_MAX : (1ll << (width - 1)) - 1;
+    if (pred == LLVMIntULT && LLVMConstIntGetZExtValue(rhs) > (uint64_t)max)
+      continue;
+    long long bound = pred == LLVMIntSLT ? LLVMConstIntGetSExtValue(rhs)
+                                         : LLVMConstIntGetZExtValue(rhs);
+    if (bound - 1 <= max - step)
+      return true;
+  }
+  return false;
+}
+
+/// BoundsAnalysis - proves integers of a function non-negative, e.g. loop
+/// counters starting at zero that count up while below a signed bound.
+struct BoundsAnalysis {
+  Dominators doms;
+  std::unordered_map<LLVMBasicBlockRef, std::vector<Fact>> facts;
+  // phis assumed non-negative while checking their incoming values
+  std::unordered_set<LLVMValueRef> assumed;
+
+  BoundsAnalysis(LLVMValueRef func) : doms(func) {}
+  std::vector<Fact> &facts_in(LLVMBasicBlockRef block) {
+    if (!facts.count(block))
+      facts[block] = block_facts(doms, block);
+    return facts[block];
+  }
+  bool non_negative(LLVMValueRef value) {
+    if (LLVMIsAConstantInt(value))
+      return LLVMGetIntTypeWidth(LLVMTypeOf(value)) <= 64 &&
+             LLVMConstIntGetSExtValue(value) >= 0;
+    if (!LLVMIsAInstruction(value))
+      return false;
+    switch (LLVMGetInstructionOpcode(value)) {
+    case LLVMZExt:
+      return true;
+    case LLVMPHI: {
+      // by induction over the iterations of a loop
+      if (!assumed.insert(value).second)
+        return true;
+      bool result = true;
+      for (unsigned i = 0; result && i < LLVMCountIncoming(value); i++)
+        result = non_negative(LLVMGetIncomingValue(value, i));
+      assumed.erase(value);
+      return result;
+    }
+    case LLVMAdd: {
+      LLVMValueRef lhs = LLVMGetOperand(value, 0);
+      LLVMValueRef rhs = LLVMGetOperand(value, 1);
+      if (LLVMIsAConstantInt(lhs))
+        std::swap(lhs, rhs);
+      if (!LLVMIsAConstantInt(rhs) || !non_negative(rhs) || !non_negative(lhs))
+        return false;
+      return increments_without_wrap(facts_in(LLVMGetInstructionParent(value)),
+                                     lhs, LLVMConstIntGetSExtValue(rhs));
+    }
+    case LLVMAnd:
+      return non_negative(LLVMGetOperand(value, 0)) ||
+             non_negative(LLVMGetOperand(value, 1));
+    case LLVMLShr:
+    case LLVMUDiv: {
+      // shifted or divided by at least two
+      LLVMValueRef rhs = LLVMGetOperand(value, 1);
+      unsigned long long min = LLVMGetInstructionOpcode(value) == LLVMLShr;
+      return LLVMIsAConstantInt(rhs) && LLVMConstIntGetZExtValue(rhs) > min;
+    }
+    case LLVMURem: {
+      LLVMValueRef rhs = LLVMGetOperand(value, 1);
+      return LLVMIsAConstantInt(rhs) && non_negative(rhs) &&
+             LLVMConstIntGetZExtValue(rhs) > 0;
+    }
+    case LLVMSelect:
+      return non_negative(LLVMGetOperand(value, 1)) &&
+             non_negative(LLVMGetOperand(value, 2));
+    default:
+      return false;
+    }
+  }
+  // whether `facts` prove `index` is below `length` as unsigned numbers
+  bool proves_by(std::vector<Fact> &facts, LLVMValueRef index,
+                 LLVMValueRef length) {
+    if (LLVMIsAConstantInt(index) && LLVMIsAConstantInt(length) &&
+        LLVMGetIntTypeWidth(LLVMTypeOf(index)) <= 64)
+      return LLVMConstIntGetZExtValue(index) < LLVMConstIntGetZExtValue(length);
+    for (Fact &fact : facts)
+      if (below_by(fact, index, length, false) ||
+          (below_by(fact, index, length, true) && non_negative(index)))
+        return true;
+    return false;
+  }
+  bool proves(LLVMBasicBlockRef block, LLVMValueRef index,
+              LLVMValueRef length) {
+    if (proves_by(facts_in(block), index, length))
+      return true;
+    // a loop counter is below a length that is the same in every iteration
+    // if every incoming value is, on its edge
+    if (!LLVMIsAPHINode(index))
+      return false;
+    LLVMBasicBlockRef header = LLVMGetInstructionParent(index);
+    if (LLVMIsAInstruction(length) &&
+        (LLVMGetInstructionParent(length) == header ||
+         !doms.dominates(LLVMGetInstructionParent(length), header)))
+      return false;
+    for (unsigned i = 0; i < LLVMCountIncoming(index); i++) {
+      LLVMBasicBlockRef pred = LLVMGetIncomingBlock(index, i);
+      if (!doms.idom.count(pred))
+        continue; // unreachable
+      std::vector<Fact> edge_facts = facts_in(pred);
+      add_edge_fact(pred, header, edge_facts);
+      if (!proves_by(edge_facts, LLVMGetIncomingValue(index, i), length))
+        return false;
+    }
+    return true;
+  }
+};
+
+// removes the check `br`, nothing else branches to its failing block
+static void remove_check(LLVMValueRef br) {
+  LLVMBasicBlockRef in_bounds = LLVMGetSuccessor(br, 0);
+  LLVMBasicBlockRef out_of_bounds = LLVMGetSuccessor(br, 1);
+  LLVMValueRef cond = LLVMGetCondition(br);
+  LLVMPositionBuilderBefore(curr_builder, br);
+  LLVMBuildBr(curr_builder, in_bounds);
+  LLVMInstructionEraseFromParent(br);
+  if (LLVMIsAInstruction(cond) && !LLVMGetFirstUse(cond))
+    LLVMInstructionEraseFromParent(cond);
+  if (!LLVMGetFirstUse(LLVMBasicBlockAsValue(out_of_bounds)))
+    LLVMDeleteBasicBlock(out_of_bounds);
+}
+
+void eliminate_bounds_checks(LLVMModuleRef module) {
+  unsigned kind = bounds_md_kind();
+  for (LLVMValueRef func = LLVMGetFirstFunction(module); func;
+       func = LLVMGetNextFunction(func)) {
+    std::vector<LLVMValueRef> checks;
+    for (LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(func); block;
+         block = LLVMGetNextBasicBlock(block)) {
+      LLVMValueRef term = LLVMGetBasicBlockTerminator(block);
+      if (term && LLVMGetMetadata(term, kind))
+        checks.push_back(term);
+    }
+    if (checks.empty())
+      continue;
+    BoundsAnalysis analysis(func);
+    std::vector<LLVMValueRef> removed;
+    for (LLVMValueRef check : checks) {
+      LLVMBasicBlockRef block = LLVMGetInstructionParent(check);
+      LLVMValueRef cond = LLVMGetCondition(check);
+      // folded to a constant, or unreachable
+      bool constant = LLVMIsAConstantInt(cond);
+      if ((constant && LLVMConstIntGetZExtValue(cond)) ||
+          !analysis.doms.idom.count(block) ||
+          (!constant && analysis.proves(block, LLVMGetOperand(cond, 0),
+                                        LLVMGetOperand(cond, 1))))
+        removed.push_back(check);
+    }
+    // the analysis needs all conditions, so nothing is removed before
+    for (LLVMValueRef check : removed)
+      remove_check(check);
+    bounds_checks += checks.size();
+    removed_bounds_checks += removed.size();
+    if (options.stats && removed.size() < checks.size()) {
+      std::lock_guard lock(remaining_bounds_checks_mutex);
+      remaining_bounds_checks.push_back(
+          {LLVMGetValueName(func), checks.size() - removed.size()});
+    }
+  }
+}
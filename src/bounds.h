@@ -0,0 +1,23 @@
+#pragma once
+#include "utils.h"
+#include <atomic>
+#include <mutex>
+// Bounds checks (--bounds-check). Indexing a T[N] and
+// `__bounds_check__(index, length)`, e.g. in Array<T>.get, trap if the index
+// isn't below the length. Before optimizing, inline functions are inlined,
+// locals are promoted to registers and the checks implied by a dominating
+// check or loop condition on the same index and length are removed, and so
+// are checks of constant indices.
+
+// checks in the module and how many were removed
+extern std::atomic<size_t> bounds_checks, removed_bounds_checks;
+// functions with checks left, and how many, for --stats
+extern std::mutex remaining_bounds_checks_mutex;
+extern std::vector<std::pair<std::string, size_t>> remaining_bounds_checks;
+
+// traps unless `index` is below `length`, both integers. A signed index
+// is sign extended if `length` is wider
+void gen_bounds_check(LLVMValueRef index, bool is_signed, LLVMValueRef length);
+// removes the checks the surrounding conditions prove, `module` has to be in
+// SSA form (mem2reg)
+void eliminate_bounds_checks(LLVMModuleRef module);
@@ -0,0 +1,179 @@
+#include "cache.h"
+#include "options.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+// after LLVM, which has functions named error
+#include "utils.h"
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+std::atomic<size_t> cache_hits = 0, cache_misses = 0;
+
+static std::string sha1_hex(std::string data) {
+  return llvm::toHex(llvm::SHA1::hash(llvm::arrayRefFromStringRef(data)),
+                     true);
+}
+
+// string literals and other private constants are copied into every object
+// that uses them instead of being shared
+static bool is_copied_constant(const llvm::GlobalValue *value) {
+  auto var = llvm::dyn_cast<llvm::GlobalVariable>(value);
+  return var && var->hasPrivateLinkage() && var->isConstant() &&
+         var->hasGlobalUnnamedAddr();
+}
+
+// functions and globals in different objects can't refer to internal symbols,
+// so they get a name unique to the module and hidden linkage instead
+static void export_internal_symbols(llvm::Module &mod) {
+  std::string suffix = "." + sha1_hex(mod.getModuleIdentifier()).substr(0, 8);
+  for (llvm::GlobalValue &value : mod.global_values()) {
+    if (!value.hasLocalLinkage() || value.isDeclaration() ||
+        is_copied_constant(&value))
+      continue;
+    value.setName(value.getName() + suffix);
+    value.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    value.setVisibility(llvm::GlobalValue::HiddenVisibility);
+  }
+}
+
+// copies `func` (or all global variables if it's nullptr) into a module of
+// its own, everything else it references is only declared
+static std::unique_ptr<llvm::Module> extract(const llvm::Module &mod,
+                                             const llvm::Function *func) {
+  llvm::ValueToValueMapTy map;
+  auto piece =
+      llvm::CloneModule(mod, map, [&](const llvm::GlobalValue *value) {
+        if (func)
+          return value == func || is_copied_constant(value);
+        return llvm::isa<llvm::GlobalVariable>(value);
+      });
+  if (func) {
+    piece->setModuleInlineAsm("");
+    if (auto ctors = piece->getNamedGlobal("llvm.global_ctors"))
+      ctors->eraseFromParent();
+  }
+  // drop what the piece doesn't use, so unrelated changes don't change its IR
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (auto &value : llvm::make_early_inc_range(piece->global_values()))
+      if (value.use_empty() && (value.isDeclaration() ||
+                                (func && is_copied_constant(&value)))) {
+        value.eraseFromParent();
+        changed = true;
+      }
+  }
+  // private symbols don't reach the object, number them in order of use
+  for (auto &var : piece->globals())
+    if (var.hasPrivateLinkage())
+      var.setName("");
+  piece->setModuleIdentifier("");
+  piece->setSourceFileName("");
+  return piece;
+}
+
+// hash of everything that decides the machine code of a piece
+static std::string cache_key(llvm::Module &piece,
+                             LLVMTargetMachineRef target_machine) {
+  std::string key;
+  llvm::raw_string_ostream stream(key);
+  piece.print(stream, nullptr);
+  char *triple = LLVMGetTargetMachineTriple(target_machine);
+  char *cpu = LLVMGetTargetMachineCPU(target_machine);
+  char *features = LLVMGetTargetMachineFeatureString(target_machine);
+  stream << triple << '\n' << cpu << '\n' << features << '\n'
+         << "O" << options.opt_level << '\n'
+         << "LLVM " << LLVM_VERSION_STRING << '\n';
+  LLVMDisposeMessage(triple);
+  LLVMDisposeMessage(cpu);
+  LLVMDisposeMessage(features);
+  return sha1_hex(stream.str());
+}
+
+// returns the cached object for `piece`, compiling it on a miss
+static std::string cached_object(std::unique_ptr<llvm::Module> piece,
+                                 LLVMTargetMachineRef target_machine) {
+  std::string path =
+      options.cache_dir + "/" + cache_key(*piece, target_machine) + ".o";
+  std::error_code err_code;
+  if (std::filesystem::exists(path)) {
+    cache_hits++;
+    // most recently used, for the LRU eviction
+    std::filesystem::last_write_time(
+        path, std::filesystem::file_time_type::clock::now(), err_code);
+    return path;
+  }
+  cache_misses++;
+  char *err = nullptr;
+  LLVMMemoryBufferRef buffer;
+  if (LLVMTargetMachineEmitToMemoryBuffer(target_machine,
+                                          llvm::wrap(piece.get()),
+                                          LLVMObjectFile, &err, &buffer))
+    error(err);
+  // write and rename, so concurrent builds never see a partial object
+  std::stringstream temp_path;
+  temp_path << path << ".tmp" << std::this_thread::get_id();
+  std::ofstream(temp_path.str(), std::ios::binary)
+      .write(LLVMGetBufferStart(buffer), LLVMGetBufferSize(buffer));
+  LLVMDisposeMemoryBuffer(buffer);
+  std::filesystem::rename(temp_path.str(), path, err_code);
+  if (err_code)
+    error("Can't write '" << path << "': " << err_code.message());
+  return path;
+}
+
+// removes the least recently used objects until the cache fits --cache-size
+static void evict() {
+  static std::mutex evicting;
+  std::lock_guard<std::mutex> guard(evicting);
+  uintmax_t limit = (uintmax_t)options.cache_size << 20;
+  uintmax_t total = 0;
+  std::vector<std::filesystem::directory_entry> objects;
+  std::error_code err_code;
+  for (auto &entry :
+       std::filesystem::directory_iterator(options.cache_dir, err_code))
+    if (entry.path().extension() == ".o") {
+      objects.push_back(entry);
+      total += entry.file_size(err_code);
+    }
+  if (total <= limit)
+    return;
+  std::sort(objects.begin(), objects.end(), [](auto &a, auto &b) {
+    return a.last_write_time() < b.last_write_time();
+  });
+  for (auto &object : objects) {
+    if (total <= limit)
+      break;
+    uintmax_t size = object.file_size(err_code);
+    if (std::filesystem::remove(object.path(), err_code))
+      total -= size;
+  }
+}
+
+void emit_object_cached(LLVMModuleRef module,
+                        LLVMTargetMachineRef target_machine, std::string out) {
+  llvm::Module &mod = *llvm::unwrap(module);
+  std::filesystem::create_directories(options.cache_dir);
+  export_internal_symbols(mod);
+  std::vector<std::string> objects;
+  for (auto &func : mod.functions())
+    if (!func.isDeclaration() && !func.hasAvailableExternallyLinkage())
+      objects.push_back(cached_object(extract(mod, &func), target_machine));
+  objects.push_back(cached_object(extract(mod, nullptr), target_machine));
+  // the objects are passed in a response file, there can be thousands
+  std::string list_path = out + ".objects";
+  std::ofstream list(list_path);
+  for (auto &object : objects)
+    list << object << '\n';
+  list.close();
+  bool linked = run_command({"ld", "-r", "-o", out, "@" + list_path});
+  std::filesystem::remove(list_path);
+  if (!linked)
+    error("Linking the cached objects into " << out << " failed");
+  evict();
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "consts.h"
+#include <atomic>
+// per-function object cache (--cache-dir). Every function is compiled into
+// its own object, keyed by a hash of its optimized IR (with the signatures of
+// everything it references) and the target, and the objects are combined with
+// `ld -r`. Functions whose IR didn't change are reused from the cache.
+
+extern std::atomic<size_t> cache_hits, cache_misses;
+// emits `module` as an object file at `out` through the cache, then trims the
+// cache to --cache-size by removing the least recently used objects
+void emit_object_cached(LLVMModuleRef module,
+                        LLVMTargetMachineRef target_machine, std::string out);
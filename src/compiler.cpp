@@ -0,0 +1,522 @@
+#include "compiler.h"
+#include "bitcode.h"
+#include "bounds.h"
+#include "cache.h"
+#include "fir.h"
+#include "hugepage.h"
+#include "icf.h"
+#include "layout.h"
+#include "memo.h"
+#include "options.h"
+#include "parser.h"
+#include "share.h"
+#include "ucr.h"
+#include <cstring>
+#include <mutex>
+#include <thread>
+extern "C" {
+#include "llvm-c-14/llvm-c/BitReader.h"
+#include "llvm-c-14/llvm-c/BitWriter.h"
+#include "llvm-c-14/llvm-c/Linker.h"
+#include "llvm-c-14/llvm-c/Transforms/PassBuilder.h"
+}
+
+void handle_global_include() {
+  std::string file_name = parse_include();
+  debug_log("Parsed an include (" << file_name << ")");
+  size_t os_loc = file_name.find("{os}");
+  if (os_loc != std::string::npos) {
+    file_name = file_name.replace(os_loc, 4, os_name);
+    debug_log("Replaced {os} with '" << os_name << "'");
+  }
+  CharReader *curr_file = queue.back();
+  add_file_to_queue(curr_file->file_path, file_name);
+  eat(T_STRING);
+}
+
+void handle_toplevel();
+
+// global variables exported by the unit, kept by UCR even if it doesn't use
+// them itself
+thread_local std::vector<LLVMValueRef> exported_globals;
+void set_global_linkage(LLVMValueRef global, FileOrigin origin) {
+  switch (origin) {
+  case FileOrigin::Single:
+    break;
+  case FileOrigin::Unit:
+    exported_globals.push_back(global);
+    break;
+  case FileOrigin::OtherUnit:
+    // defined and initialized by its own unit, a runtime initializer leaves
+    // a declaration, the placeholder initializer isn't the value
+    if (std::erase_if(inits,
+                      [&](auto &init) { return init.first == global; })) {
+      LLVMSetInitializer(global, nullptr);
+      LLVMSetGlobalConstant(global, false);
+    } else
+      LLVMSetLinkage(global, LLVMAvailableExternallyLinkage);
+    break;
+  case FileOrigin::Library:
+    // every unit has its initializer, the first one to run it does
+    LLVMSetLinkage(global, LLVMLinkOnceODRLinkage);
+    for (auto &init : inits)
+      if (init.first == global)
+        shared_inits.insert(global);
+    break;
+  }
+}
+
+void handle_space() {
+  eat(T_SPACE);
+  auto id = identifier_string;
+  eat(T_IDENTIFIER);
+  eat('{');
+  push_space(id);
+  while (curr_token != '}')
+    handle_toplevel();
+  pop_space();
+  eat('}');
+}
+
+void handle_toplevel() {
+  switch (curr_token) {
+  case ';': // ignore top-level semicolons.
+    get_next_token();
+    break;
+  case T_SPACE:
+    handle_space();
+    break;
+  case T_FUNCTION:
+  case T_INLINE: {
+    // before parsing, the lookahead may already be in the including file
+    FileOrigin origin = curr_file_origin();
+    auto ast = parse_definition();
+    debug_log("Parsed a function definition (name: " << ast->name << ")");
+    ast->origin = origin;
+    // a unit exports all of its non-generic functions
+    if (origin == FileOrigin::Unit && !ast->ft.is_generic() &&
+        !ast->flags.is_inline && !ast->flags.always_compile)
+      always_compile_functions.push_back(ast);
+    ast->add();
+    break;
+  }
+  case T_DECLARE: {
+    auto ast = parse_declare();
+    debug_log("Parsed a declare\n");
+    auto val = ast->gen_toplevel();
+    if (DEBUG && val)
+      LLVMDumpValue(val);
+    break;
+  }
+  case T_CONST:
+  case T_LET: {
+    FileOrigin origin = curr_file_origin();
+    auto ast = parse_let_expr();
+    debug_log("Parsed a global variable\n");
+    auto val = ast->gen_toplevel();
+    set_global_linkage(val, origin);
+    if (DEBUG)
+      LLVMDumpValue(val);
+    break;
+  }
+  case T_STRUCT: {
+    auto ast = parse_struct();
+    debug_log("Parsed a struct definition\n");
+    ast->gen_toplevel();
+    break;
+  }
+  case T_INCLUDE:
+    handle_global_include();
+    break;
+  case T_TYPE: {
+    auto ast = parse_type_definition();
+    debug_log("Parsed a type definition\n");
+    ast->gen_toplevel();
+    break;
+  }
+  case T_ASM: {
+    auto ast = parse_global_asm();
+    debug_log("Parsed global assembly");
+    ast->gen_toplevel();
+    break;
+  }
+  default:
+    error("Unexpected token '" + token_to_str(curr_token) + "' at top-level");
+  }
+}
+
+void main_loop() {
+  // the previous file left the lexer at EOF
+  last_char = ' ';
+  get_next_token();
+  while (1) {
+    if (curr_token == T_EOF)
+      break;
+    handle_toplevel();
+  }
+}
+
+std::string get_os(std::string triple) {
+  // triple: "x86_64-unknown-linux-gnu"
+  // slice away first two parts, triple: "linux-gnu"
+  size_t start = triple.find('-', triple.find('-') + 1) + 1;
+  // slice away last part, triple: "linux"
+  return triple.substr(start, triple.find('-', start) - start);
+}
+
+// starts `compile` on a new thread like compile_on_new_thread, an error is
+// stored in `exception`
+static std::thread start_compile_thread(std::function<void()> compile,
+                                        std::exception_ptr &exception) {
+  return std::thread([compile, &exception, caller_options = options,
+                      caller_debug = DEBUG,
+                      caller_include_paths = include_paths] {
+    options = caller_options;
+    DEBUG = caller_debug;
+    include_paths = caller_include_paths;
+    try {
+      compile();
+    } catch (...) {
+      exception = std::current_exception();
+    }
+  });
+}
+void compile_on_new_thread(std::function<void()> compile) {
+  std::exception_ptr exception;
+  start_compile_thread(compile, exception).join();
+  if (exception)
+    std::rethrow_exception(exception);
+}
+
+LLVMTargetMachineRef create_host_target_machine() {
+  static std::once_flag initialized;
+  std::call_once(initialized, [] {
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+    LLVMInitializeNativeAsmParser();
+  });
+  // host machine triple
+  char *target_triple = LLVMGetDefaultTargetTriple();
+  LLVMTargetRef target;
+  char *error_message;
+  if (LLVMGetTargetFromTriple(target_triple, &target, &error_message) != 0)
+    error(error_message);
+  os_name = get_os(target_triple);
+  char *host_cpu_name = LLVMGetHostCPUName();
+  char *host_cpu_features = LLVMGetHostCPUFeatures();
+  // lean -O0 builds use fast instruction selection and register allocation
+  LLVMCodeGenOptLevel codegen_level = options.lean && options.opt_level == 0
+                                          ? LLVMCodeGenLevelNone
+                                          : LLVMCodeGenLevelAggressive;
+  LLVMTargetMachineRef target_machine = LLVMCreateTargetMachine(
+      target, target_triple, host_cpu_name, host_cpu_features, codegen_level,
+      LLVMRelocStatic, LLVMCodeModelSmall);
+  LLVMDisposeMessage(target_triple);
+  LLVMDisposeMessage(host_cpu_name);
+  LLVMDisposeMessage(host_cpu_features);
+  return target_machine;
+}
+
+void create_module(std::string name, LLVMContextRef ctx,
+                   LLVMTargetMachineRef target_machine) {
+  curr_ctx = ctx;
+  target_data = LLVMCreateTargetDataLayout(target_machine);
+  curr_module = LLVMModuleCreateWithNameInContext(name.c_str(), curr_ctx);
+  // set target to the target machine's
+  char *target_triple = LLVMGetTargetMachineTriple(target_machine);
+  LLVMSetTarget(curr_module, target_triple);
+  LLVMDisposeMessage(target_triple);
+  LLVMSetModuleDataLayout(curr_module, target_data);
+  curr_builder = LLVMCreateBuilderInContext(curr_ctx);
+}
+
+// what was parsed into curr_module, codegen workers parse it again
+thread_local std::vector<std::function<void()>> parsed_sources;
+void compile_file(std::string path) {
+  parsed_sources.push_back([=] { compile_file(path); });
+  add_file_to_queue(".", path);
+  main_loop();
+}
+void compile_source(std::string name, std::string source) {
+  parsed_sources.push_back([=] { compile_source(name, source); });
+  add_source_to_queue(name, source);
+  main_loop();
+}
+
+// adds `func` to `list`, llvm.global_ctors or llvm.global_dtors
+void add_global_ctor(LLVMValueRef func,
+                     const char *list = "llvm.global_ctors") {
+  LLVMTypeRef i32 = LLVMInt32TypeInContext(curr_ctx);
+  LLVMTypeRef i8_ptr = LLVMPointerType(LLVMInt8TypeInContext(curr_ctx), 0);
+  LLVMTypeRef fields[] = {i32, LLVMTypeOf(func), i8_ptr};
+  LLVMTypeRef ctor_type = LLVMStructTypeInContext(curr_ctx, fields, 3, false);
+  LLVMValueRef ctor_fields[] = {LLVMConstInt(i32, 65535, false), func,
+                                LLVMConstNull(i8_ptr)};
+  LLVMValueRef ctor =
+      LLVMConstStructInContext(curr_ctx, ctor_fields, 3, false);
+  LLVMValueRef ctors =
+      LLVMAddGlobal(curr_module, LLVMArrayType(ctor_type, 1), list);
+  LLVMSetLinkage(ctors, LLVMAppendingLinkage);
+  LLVMSetInitializer(ctors, LLVMConstArray(ctor_type, &ctor, 1));
+}
+
+// main (if the module defines it) and the always_compile functions, in the
+// same order in every thread that parsed the same sources
+static std::vector<FunctionAST *> get_entry_functions() {
+  std::vector<FunctionAST *> entries;
+  auto main_func = curr_scope->get_function("main");
+  if (main_func && main_func->origin != FileOrigin::OtherUnit)
+    entries.push_back(main_func);
+  // a unit exports its main as well
+  for (auto func : always_compile_functions)
+    if (func != main_func)
+      entries.push_back(func);
+  return entries;
+}
+static LLVMValueRef gen_entry_function(FunctionAST *func) {
+  LLVMValueRef llvm_func = func->gen_ptr()->gen_val();
+  // a call may have generated the body first, as an internal function
+  if (LLVMGetLinkage(llvm_func) == LLVMInternalLinkage)
+    LLVMSetLinkage(llvm_func, LLVMExternalLinkage);
+  return llvm_func;
+}
+
+/// CodegenPiece - bitcode of the entry functions a codegen worker generated.
+struct CodegenPiece {
+  LLVMMemoryBufferRef bitcode = nullptr;
+  std::vector<std::string> entry_names;
+  // linkage of the definitions made linkonce_odr for linking
+  std::unordered_map<std::string, LLVMLinkage> linkages;
+};
+
+// makes the definitions other than `owned` linkonce_odr, so the copies other
+// workers generated too are merged when the pieces are linked
+static void share_definitions(std::vector<LLVMValueRef> &owned,
+                              CodegenPiece &piece) {
+  for (LLVMValueRef func = LLVMGetFirstFunction(curr_module); func;
+       func = LLVMGetNextFunction(func)) {
+    if (LLVMIsDeclaration(func) ||
+        std::find(owned.begin(), owned.end(), func) != owned.end())
+      continue;
+    piece.linkages[LLVMGetValueName(func)] = LLVMGetLinkage(func);
+    LLVMSetLinkage(func, LLVMLinkOnceODRLinkage);
+  }
+}
+
+// parses the sources again in a new context and generates every `jobs`-th
+// entry function, starting at `worker`
+static void gen_piece(std::string module_name,
+                      std::vector<std::function<void()>> sources,
+                      unsigned worker, unsigned jobs, CodegenPiece &piece) {
+  LLVMTargetMachineRef target_machine = create_host_target_machine();
+  LLVMContextRef ctx = LLVMContextCreate();
+  create_module(module_name, ctx, target_machine);
+  for (auto &compile : sources)
+    compile();
+  std::vector<FunctionAST *> entries = get_entry_functions();
+  std::vector<LLVMValueRef> owned;
+  for (size_t i = worker; i < entries.size(); i += jobs) {
+    owned.push_back(gen_entry_function(entries[i]));
+    piece.entry_names.push_back(LLVMGetValueName(owned.back()));
+  }
+  share_definitions(owned, piece);
+  // the global variables are defined by the first worker
+  for (LLVMValueRef global = LLVMGetFirstGlobal(curr_module); global;
+       global = LLVMGetNextGlobal(global))
+    if (!LLVMIsDeclaration(global) &&
+        LLVMGetLinkage(global) != LLVMPrivateLinkage)
+      LLVMSetLinkage(global, LLVMAvailableExternallyLinkage);
+  LLVMSetModuleInlineAsm2(curr_module, "", 0);
+  piece.bitcode = LLVMWriteBitcodeToMemoryBuffer(curr_module);
+  LLVMDisposeBuilder(curr_builder);
+  LLVMDisposeModule(curr_module);
+  LLVMContextDispose(ctx);
+  LLVMDisposeTargetData(target_data);
+  LLVMDisposeTargetMachine(target_machine);
+}
+
+// links the pieces into curr_module, restores the linkage of the shared
+// definitions and adds the entry functions the pieces defined
+static void link_pieces(std::vector<CodegenPiece> &pieces,
+                        std::vector<LLVMValueRef> &entry_functions) {
+  std::unordered_map<std::string, LLVMLinkage> linkages;
+  for (auto &piece : pieces) {
+    // a body generated by a call is internal, one generated by taking its
+    // address external
+    for (auto &[name, linkage] : piece.linkages)
+      if (!linkages.count(name) || linkage == LLVMExternalLinkage)
+        linkages[name] = linkage;
+    if (!piece.bitcode)
+      continue;
+    LLVMModuleRef module;
+    bool failed = LLVMParseBitcodeInContext2(curr_ctx, piece.bitcode, &module);
+    LLVMDisposeMemoryBuffer(piece.bitcode);
+    if (failed || LLVMLinkModules2(curr_module, module))
+      error("Linking the generated code failed");
+  }
+  for (auto &[name, linkage] : linkages) {
+    LLVMValueRef func = LLVMGetNamedFunction(curr_module, name.c_str());
+    // entry functions are defined as they are by their owner
+    if (func && LLVMGetLinkage(func) == LLVMLinkOnceODRLinkage)
+      LLVMSetLinkage(func, linkage);
+  }
+  for (auto &piece : pieces)
+    for (auto &name : piece.entry_names)
+      entry_functions.push_back(LLVMGetNamedFunction(curr_module, name.c_str()));
+}
+
+// initializes the global variables at the start of main, or in __fy_init__
+static void gen_global_inits(LLVMValueRef main_function) {
+  if (main_function) {
+    add_stores_before_main(main_function);
+    if (options.hugepage_text)
+      gen_hugepage_text(main_function);
+  } else if (inits.size() > 0) {
+    // without main a library or a libfy session calls this, units of a
+    // program run it as a global constructor
+    LLVMValueRef init_func = LLVMAddFunction(
+        curr_module, "__fy_init__",
+        LLVMFunctionType(LLVMVoidTypeInContext(curr_ctx), nullptr, 0, false));
+    LLVMPositionBuilderAtEnd(
+        curr_builder, LLVMAppendBasicBlockInContext(curr_ctx, init_func, ""));
+    LLVMBuildRetVoid(curr_builder);
+    add_stores_before_main(init_func);
+    if (!options.units.empty()) {
+      LLVMSetLinkage(init_func, LLVMInternalLinkage);
+      add_global_ctor(init_func);
+    }
+  }
+}
+
+LLVMValueRef finish_module() {
+  // the functions in the FIR dump are added as they're generated, in this
+  // thread
+  unsigned jobs =
+      options.emit == "fir" ? 1 : std::max(options.codegen_jobs, 1u);
+  std::vector<FunctionAST *> entries = get_entry_functions();
+  // the other workers start with the entry functions after the first
+  std::vector<CodegenPiece> pieces(jobs);
+  std::vector<std::exception_ptr> exceptions(jobs);
+  std::vector<std::thread> workers;
+  size_t name_length;
+  std::string module_name =
+      LLVMGetModuleIdentifier(curr_module, &name_length);
+  for (unsigned worker = 1; worker < jobs && worker < entries.size(); worker++)
+    workers.push_back(start_compile_thread(
+        [&, worker, sources = parsed_sources] {
+          gen_piece(module_name, sources, worker, jobs, pieces[worker]);
+        },
+        exceptions[worker]));
+  auto main_func = curr_scope->get_function("main");
+  LLVMValueRef main_function = nullptr;
+  std::vector<LLVMValueRef> entry_functions;
+  try {
+    for (size_t i = 0; i < entries.size(); i += jobs) {
+      entry_functions.push_back(gen_entry_function(entries[i]));
+      if (entries[i] == main_func)
+        main_function = entry_functions.back();
+    }
+    if (workers.size() > 0) {
+      // global variables only used in their own initializers are kept
+      gen_global_inits(main_function);
+      if (auto init_func = LLVMGetNamedFunction(curr_module, "__fy_init__"))
+        entry_functions.push_back(init_func);
+      if (auto ctors = LLVMGetNamedGlobal(curr_module, "llvm.global_ctors"))
+        entry_functions.push_back(ctors);
+      share_definitions(entry_functions, pieces[0]);
+    }
+  } catch (...) {
+    for (auto &worker : workers)
+      worker.join();
+    throw;
+  }
+  if (workers.size() > 0) {
+    for (auto &worker : workers)
+      worker.join();
+    for (auto &exception : exceptions)
+      if (exception)
+        std::rethrow_exception(exception);
+    link_pieces(pieces, entry_functions);
+  }
+  for (auto global : exported_globals)
+    entry_functions.push_back(global);
+  if (!getenv("NO_UCR") && entry_functions.size() > 0)
+    remove_unused_globals(curr_module, entry_functions);
+  if (workers.empty())
+    gen_global_inits(main_function);
+  if (options.bounds_check) {
+    // inline functions first, so the checks in e.g. Array.get are in the
+    // loops of their callers
+    run_passes(curr_module,
+               "always-inline,function(mem2reg,early-cse<memssa>)", nullptr);
+    eliminate_bounds_checks(curr_module);
+  }
+  if (auto memo_stats = gen_memo_stats(curr_module))
+    add_global_ctor(memo_stats, "llvm.global_dtors");
+  share_generic_instances(curr_module);
+  layout_functions(curr_module);
+  return main_function;
+}
+
+void run_passes(LLVMModuleRef module, std::string passes,
+                LLVMTargetMachineRef target_machine) {
+  LLVMPassBuilderOptionsRef pass_options = LLVMCreatePassBuilderOptions();
+  LLVMErrorRef err =
+      LLVMRunPasses(module, passes.c_str(), target_machine, pass_options);
+  LLVMDisposePassBuilderOptions(pass_options);
+  if (err) {
+    char *message = LLVMGetErrorMessage(err);
+    std::string message_str = message;
+    LLVMDisposeErrorMessage(message);
+    error("Optimization failed: " << message_str);
+  }
+}
+
+void optimize_module(LLVMModuleRef module, LLVMTargetMachineRef target_machine,
+                     unsigned opt_level) {
+  if (opt_level > 3)
+    error("Unknown optimization level: " << opt_level);
+  if (opt_level > 0)
+    run_passes(module, "default<O" + std::to_string(opt_level) + ">",
+               target_machine);
+  else
+    // inline functions are only inlined by this pass
+    run_passes(module, "always-inline", target_machine);
+  if (!options.icf.empty())
+    merge_functions(module, target_machine);
+}
+
+void emit_module(LLVMModuleRef module, LLVMTargetMachineRef target_machine,
+                 std::string out) {
+  size_t ext_pos = out.rfind('.');
+  size_t slash_pos = out.rfind('/');
+  std::string ext = ext_pos == std::string::npos ||
+                            (slash_pos != std::string::npos &&
+                             slash_pos > ext_pos)
+                        ? "ll" // default to LLVM IR
+                        : out.substr(ext_pos + 1);
+  if (options.emit == "fir") {
+    write_fir(module, out);
+    return;
+  }
+  char *err = nullptr;
+  // export LLVM IR into other file
+  if (ext == "bc" && options.thinlto)
+    write_thinlto_bitcode(module, out);
+  else if (ext == "bc")
+    LLVMWriteBitcodeToFile(module, out.c_str());
+  else if (ext == "asm")
+    LLVMTargetMachineEmitToFile(target_machine, module, strdup(out.c_str()),
+                                LLVMAssemblyFile, &err);
+  else if (ext == "o" && !options.cache_dir.empty())
+    emit_object_cached(module, target_machine, out);
+  else if (ext == "o")
+    LLVMTargetMachineEmitToFile(target_machine, module, strdup(out.c_str()),
+                                LLVMObjectFile, &err);
+  else if (ext == "ll")
+    LLVMPrintModuleToFile(module, out.c_str(), &err);
+  else
+    error("Unknown file extension: " + ext);
+  if (err)
+    error(err);
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "utils.h"
+#include <functional>
+// The compilation pipeline shared by the fy driver and libfy. All of its state
+// lives in the calling thread, so separate threads can compile separately.
+
+// runs `compile` on a new thread, which starts with fresh compiler state.
+// options, DEBUG and include_paths are copied from the calling thread and
+// errors are rethrown in it
+void compile_on_new_thread(std::function<void()> compile);
+// creates a target machine for the host and sets os_name
+LLVMTargetMachineRef create_host_target_machine();
+// creates curr_module (and curr_builder) in `ctx` for the target machine
+void create_module(std::string name, LLVMContextRef ctx,
+                   LLVMTargetMachineRef target_machine);
+// parses and generates a file or in-memory source and everything it includes
+void compile_file(std::string path);
+void compile_source(std::string name, std::string source);
+// removes unused globals and initializes the global variables, either at the
+// start of main or in __fy_init__ if there isn't one. Returns main or nullptr
+LLVMValueRef finish_module();
+// runs an LLVM pass pipeline, e.g. "default<O2>"
+void run_passes(LLVMModuleRef module, std::string passes,
+                LLVMTargetMachineRef target_machine);
+// runs LLVM's default<O1-3> pipeline, O0 only inlines inline functions. Then
+// folds identical functions if --icf is given
+void optimize_module(LLVMModuleRef module, LLVMTargetMachineRef target_machine,
+                     unsigned opt_level);
+// writes FIR if --emit=fir, else LLVM IR (.ll), bitcode (.bc, with a ThinLTO
+// summary if --thinlto), assembly (.asm) or an object file (.o)
+void emit_module(LLVMModuleRef module, LLVMTargetMachineRef target_machine,
+                 std::string out);
@@ -1,11 +1,10 @@
 #include "consts.h"
-bool DEBUG = false;
-std::string std_dir;
-std::string os_name;
-LLVMContextRef curr_ctx;
-LLVMBuilderRef curr_builder;
-LLVMModuleRef curr_module;
-LLVMTargetDataRef target_data;
+thread_local bool DEBUG = false;
+thread_local std::string os_name;
+thread_local LLVMContextRef curr_ctx;
+thread_local LLVMBuilderRef curr_builder;
+thread_local LLVMModuleRef curr_module;
+thread_local LLVMTargetDataRef target_data;
 
 std::unordered_map<int, int> binop_precedence = {
 #define assign_prec 1
@@ -85,6 +84,8 @@ std::unordered_map<Token, std::string> token_strs = {
     {T_BREAK, "break"},
     {T_SPACE, "space"},
     {T_DOUBLE_COLON, "::"},
+    {T_GOTO, "goto"},
+    {T_BOUNDS_CHECK, "__bounds_check__"},
 };
 
 std::unordered_map<std::string, Token> keywords = {
@@ -121,6 +122,8 @@ std::unordered_map<std::string, Token> keywords = {
     {"continue", T_CONTINUE},
     {"break", T_BREAK},
     {"space", T_SPACE},
+    {"goto", T_GOTO},
+    {"__bounds_check__", T_BOUNDS_CHECK},
 };
 
 std::unordered_set<int> unaries = {'!', '~', '*', '&', '+', '-', T_RETURN};
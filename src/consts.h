@@ -8,9 +8,8 @@ extern "C" {
 #include "llvm-c-14/llvm-c/ExecutionEngine.h"
 #include "llvm-c-14/llvm-c/TargetMachine.h"
 }
-extern bool DEBUG;
-extern std::string std_dir;
-extern std::string os_name;
+extern thread_local bool DEBUG;
+extern thread_local std::string os_name;
 using uint = unsigned int;
 enum Token : const int {
   T_EOF = -0xffff, // end of file
@@ -68,12 +67,15 @@ enum Token : const int {
   T_BREAK,         // break
   T_SPACE,         // space
   T_DOUBLE_COLON,  // ::
+  T_GOTO,          // goto
+  T_BOUNDS_CHECK,  // __bounds_check__
 };
 
-extern LLVMContextRef curr_ctx;
-extern LLVMBuilderRef curr_builder;
-extern LLVMModuleRef curr_module;
-extern LLVMTargetDataRef target_data;
+// codegen state is per thread, so independent compilations can run in parallel
+extern thread_local LLVMContextRef curr_ctx;
+extern thread_local LLVMBuilderRef curr_builder;
+extern thread_local LLVMModuleRef curr_module;
+extern thread_local LLVMTargetDataRef target_data;
 extern std::unordered_map<int, int> binop_precedence;
 #define assign_prec 1
 #define logical_prec 5
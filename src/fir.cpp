@@ -0,0 +1,581 @@
+#include "fir.h"
+#include "options.h"
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <unordered_set>
+
+thread_local std::vector<FirFunction> fir_functions;
+thread_local std::unordered_set<std::string> fir_names;
+void add_fir_function(FunctionType *type, std::string name) {
+  if (options.emit == "fir" && fir_names.insert(name).second)
+    fir_functions.push_back(FirFunction{name, type, {}, {}});
+}
+
+static std::string quote(const char *str, size_t length) {
+  std::stringstream quoted;
+  quoted << '"';
+  for (size_t i = 0; i < length; i++)
+    if (str[i] == '"' || str[i] == '\\')
+      quoted << '\\' << str[i];
+    else if (str[i] >= ' ' && str[i] < 127)
+      quoted << str[i];
+    else
+      quoted << "\\x" << std::hex << (unsigned)(unsigned char)str[i]
+             << std::dec;
+  quoted << '"';
+  return quoted.str();
+}
+// `value` as it's written in LLVM IR, for constants FIR has no op for
+static std::string llvm_string(LLVMValueRef value) {
+  char *printed = LLVMPrintValueToString(value);
+  std::string str = printed;
+  LLVMDisposeMessage(printed);
+  return str;
+}
+static std::string llvm_string(LLVMTypeRef type) {
+  char *printed = LLVMPrintTypeToString(type);
+  std::string str = printed;
+  LLVMDisposeMessage(printed);
+  return str;
+}
+
+static const std::map<LLVMOpcode, const char *> op_names = {
+    {LLVMRet, "ret"},
+    {LLVMBr, "br"},
+    {LLVMSwitch, "switch"},
+    {LLVMIndirectBr, "indirectbr"},
+    {LLVMUnreachable, "unreachable"},
+    {LLVMFNeg, "fneg"},
+    {LLVMAdd, "add"},
+    {LLVMFAdd, "fadd"},
+    {LLVMSub, "sub"},
+    {LLVMFSub, "fsub"},
+    {LLVMMul, "mul"},
+    {LLVMFMul, "fmul"},
+    {LLVMUDiv, "udiv"},
+    {LLVMSDiv, "sdiv"},
+    {LLVMFDiv, "fdiv"},
+    {LLVMURem, "urem"},
+    {LLVMSRem, "srem"},
+    {LLVMFRem, "frem"},
+    {LLVMShl, "shl"},
+    {LLVMLShr, "lshr"},
+    {LLVMAShr, "ashr"},
+    {LLVMAnd, "and"},
+    {LLVMOr, "or"},
+    {LLVMXor, "xor"},
+    {LLVMTrunc, "trunc"},
+    {LLVMZExt, "zext"},
+    {LLVMSExt, "sext"},
+    {LLVMFPToUI, "fptoui"},
+    {LLVMFPToSI, "fptosi"},
+    {LLVMUIToFP, "uitofp"},
+    {LLVMSIToFP, "sitofp"},
+    {LLVMFPTrunc, "fptrunc"},
+    {LLVMFPExt, "fpext"},
+    {LLVMPtrToInt, "ptrtoint"},
+    {LLVMIntToPtr, "inttoptr"},
+    {LLVMBitCast, "bitcast"},
+    {LLVMAddrSpaceCast, "addrspacecast"},
+    {LLVMICmp, "icmp"},
+    {LLVMFCmp, "fcmp"},
+    {LLVMSelect, "select"},
+    {LLVMVAArg, "va_arg"},
+    {LLVMExtractElement, "extractelement"},
+    {LLVMInsertElement, "insertelement"},
+    {LLVMShuffleVector, "shufflevector"},
+    {LLVMFreeze, "freeze"},
+    {LLVMFence, "fence"},
+    {LLVMAtomicCmpXchg, "cmpxchg"},
+    {LLVMAtomicRMW, "atomicrmw"},
+};
+static std::string op_name(LLVMOpcode opcode) {
+  auto name = op_names.find(opcode);
+  return name == op_names.end() ? "op" + std::to_string(opcode)
+                                : name->second;
+}
+static bool is_cast(LLVMOpcode opcode) {
+  return opcode >= LLVMTrunc && opcode <= LLVMAddrSpaceCast;
+}
+static std::string predicate_name(LLVMValueRef cmp) {
+  static const char *int_names[] = {"eq",  "ne",  "ugt", "uge", "ult",
+                                    "ule", "sgt", "sge", "slt", "sle"};
+  static const char *float_names[] = {
+      "false", "oeq", "ogt", "oge", "olt", "ole", "one", "ord",
+      "uno",   "ueq", "ugt", "uge", "ult", "ule", "une", "true"};
+  if (LLVMGetInstructionOpcode(cmp) == LLVMICmp)
+    return int_names[LLVMGetICmpPredicate(cmp) - LLVMIntEQ];
+  return float_names[LLVMGetFCmpPredicate(cmp)];
+}
+// ops that are kept even if their result is unused, ops without a result
+// always are
+static const std::unordered_set<std::string> side_effects = {
+    "call", "icall", "asm", "va_arg", "cmpxchg", "atomicrmw"};
+
+/// FirLifter - lifts an LLVM function to FIR. Allocas become slots, and
+/// constants, globals and slot addresses are instructions where they're
+/// used.
+class FirLifter {
+  FirFunction &func;
+  int block = 0;
+  int next_id = 0;
+  std::map<LLVMValueRef, int> values;
+  std::map<LLVMBasicBlockRef, int> blocks;
+  std::map<LLVMValueRef, std::string> slots;
+  // phi operands that are lifted at the end of their incoming block
+  struct PendingIncoming {
+    int phi_block, phi_index, arg, incoming_block;
+    LLVMValueRef value;
+  };
+  std::vector<PendingIncoming> pending;
+
+  int emit(std::string op, LLVMTypeRef type, std::vector<int> args = {},
+           std::string detail = "", std::vector<int> targets = {}) {
+    if (type && LLVMGetTypeKind(type) == LLVMVoidTypeKind)
+      type = nullptr;
+    int id = type ? next_id++ : fir_null;
+    func.blocks[block].insts.push_back(FirInst{
+        id, op, type, args, targets, detail, !type || side_effects.count(op)});
+    return id;
+  }
+  // the id of `inst`'s result, taken before it's lifted if it's used first
+  int value_id(LLVMValueRef inst) {
+    auto value = values.find(inst);
+    return value != values.end() ? value->second
+                                 : values[inst] = next_id++;
+  }
+  int emit_result(LLVMValueRef inst, std::string op, std::vector<int> args,
+                  std::string detail = "") {
+    LLVMTypeRef type = LLVMTypeOf(inst);
+    if (LLVMGetTypeKind(type) == LLVMVoidTypeKind)
+      return emit(op, nullptr, args, detail);
+    int id = value_id(inst);
+    func.blocks[block].insts.push_back(
+        FirInst{id, op, type, args, {}, detail, side_effects.count(op) > 0});
+    return id;
+  }
+
+  int lift_constant(LLVMValueRef value) {
+    LLVMTypeRef type = LLVMTypeOf(value);
+    if (LLVMIsAConstantInt(value)) {
+      unsigned bits = LLVMGetIntTypeWidth(type);
+      if (bits == 1)
+        return emit("const", type, {},
+                    LLVMConstIntGetZExtValue(value) ? "true" : "false");
+      if (bits <= 64)
+        return emit("const", type, {},
+                    std::to_string(LLVMConstIntGetSExtValue(value)));
+    }
+    if (LLVMIsAConstantFP(value)) {
+      LLVMBool loses_info;
+      std::stringstream str;
+      str << LLVMConstRealGetDouble(value, &loses_info);
+      return emit("const", type, {}, str.str());
+    }
+    if (LLVMIsUndef(value))
+      return emit("const", type, {}, "undef");
+    if (LLVMIsAConstantPointerNull(value) ||
+        LLVMIsAConstantAggregateZero(value))
+      return emit("const", type, {}, "null");
+    std::string name = "@" + std::string(LLVMGetValueName(value));
+    if (LLVMIsAFunction(value))
+      return emit("funcref", type, {}, name);
+    if (LLVMIsAGlobalVariable(value)) {
+      LLVMValueRef init = LLVMGetInitializer(value);
+      size_t length;
+      if (LLVMIsGlobalConstant(value) && init &&
+          LLVMIsAConstantDataArray(init) && LLVMIsConstantString(init)) {
+        const char *str = LLVMGetAsString(init, &length);
+        return emit("string", type, {}, quote(str, length));
+      }
+      return emit("addr", type, {}, name);
+    }
+    if (LLVMIsABlockAddress(value))
+      return emit("blockaddr", type, {}, "",
+                  {blocks[LLVMValueAsBasicBlock(LLVMGetOperand(value, 1))]});
+    if (LLVMIsAConstantExpr(value)) {
+      LLVMOpcode opcode = LLVMGetConstOpcode(value);
+      if (is_cast(opcode))
+        return emit("cast", type, {operand(LLVMGetOperand(value, 0))},
+                    op_name(opcode));
+      if (opcode == LLVMGetElementPtr)
+        return lift_gep(value);
+    }
+    return emit("const", type, {}, llvm_string(value));
+  }
+  int operand(LLVMValueRef value) {
+    if (auto slot = slots.find(value); slot != slots.end())
+      return emit("addr", LLVMTypeOf(value), {}, slot->second);
+    if (LLVMIsAInstruction(value) || LLVMIsAArgument(value))
+      return value_id(value);
+    return lift_constant(value);
+  }
+  std::vector<int> operands(LLVMValueRef inst, unsigned count) {
+    std::vector<int> args;
+    for (unsigned i = 0; i < count; i++)
+      args.push_back(operand(LLVMGetOperand(inst, i)));
+    return args;
+  }
+
+  // a GEP as a field or index for each of its indices, the first one is
+  // skipped if it's 0
+  int lift_gep(LLVMValueRef gep) {
+    unsigned count = LLVMGetNumOperands(gep);
+    int address = operand(LLVMGetOperand(gep, 0));
+    LLVMTypeRef type = LLVMGetElementType(LLVMTypeOf(LLVMGetOperand(gep, 0)));
+    LLVMValueRef first = LLVMGetOperand(gep, 1);
+    auto address_of = [&](LLVMTypeRef elem, unsigned i) {
+      return i + 1 == count ? LLVMTypeOf(gep) : LLVMPointerType(elem, 0);
+    };
+    if (count == 2 || !LLVMIsAConstantInt(first) ||
+        LLVMConstIntGetZExtValue(first))
+      address = emit("index", address_of(type, 1), {address, operand(first)});
+    for (unsigned i = 2; i < count; i++) {
+      LLVMValueRef index = LLVMGetOperand(gep, i);
+      if (LLVMGetTypeKind(type) == LLVMStructTypeKind) {
+        unsigned field = LLVMConstIntGetZExtValue(index);
+        type = LLVMStructGetTypeAtIndex(type, field);
+        address = emit("field", address_of(type, i), {address},
+                       std::to_string(field));
+      } else {
+        type = LLVMGetElementType(type);
+        address = emit("index", address_of(type, i), {address, operand(index)});
+      }
+    }
+    if (LLVMIsAInstruction(gep)) {
+      // the id of the last element, which may have been taken by a phi
+      FirInst &last = func.blocks[block].insts.back();
+      if (last.id == address && values.count(gep)) {
+        next_id--;
+        last.id = address = values[gep];
+      }
+      values[gep] = address;
+    }
+    return address;
+  }
+
+  void lift_call(LLVMValueRef inst) {
+    LLVMValueRef callee = LLVMGetCalledValue(inst);
+    while (LLVMIsAConstantExpr(callee) &&
+           LLVMGetConstOpcode(callee) == LLVMBitCast)
+      callee = LLVMGetOperand(callee, 0);
+    std::vector<int> args = operands(inst, LLVMGetNumArgOperands(inst));
+    if (LLVMIsAFunction(callee))
+      emit_result(inst, "call", args,
+                  "@" + std::string(LLVMGetValueName(callee)));
+    else if (LLVMIsAInlineAsm(callee))
+      emit_result(inst, "asm", args, llvm_string(callee));
+    else {
+      args.insert(args.begin(), operand(callee));
+      emit_result(inst, "icall", args);
+    }
+  }
+
+  void lift_inst(LLVMValueRef inst) {
+    LLVMOpcode opcode = LLVMGetInstructionOpcode(inst);
+    switch (opcode) {
+    case LLVMAlloca:
+      return;
+    case LLVMLoad: {
+      LLVMValueRef ptr = LLVMGetOperand(inst, 0);
+      if (slots.count(ptr))
+        emit_result(inst, "load", {}, slots[ptr]);
+      else
+        emit_result(inst, "load", {operand(ptr)});
+      return;
+    }
+    case LLVMStore: {
+      LLVMValueRef ptr = LLVMGetOperand(inst, 1);
+      int value = operand(LLVMGetOperand(inst, 0));
+      if (slots.count(ptr))
+        emit("store", nullptr, {value}, slots[ptr]);
+      else
+        emit("store", nullptr, {operand(ptr), value});
+      return;
+    }
+    case LLVMGetElementPtr:
+      lift_gep(inst);
+      return;
+    case LLVMCall:
+      lift_call(inst);
+      return;
+    case LLVMBr:
+      if (LLVMIsConditional(inst))
+        emit("condbr", nullptr, {operand(LLVMGetCondition(inst))}, "",
+             {blocks[LLVMGetSuccessor(inst, 0)],
+              blocks[LLVMGetSuccessor(inst, 1)]});
+      else
+        emit("br", nullptr, {}, "", {blocks[LLVMGetSuccessor(inst, 0)]});
+      return;
+    case LLVMPHI: {
+      std::vector<int> incoming_blocks;
+      for (unsigned i = 0; i < LLVMCountIncoming(inst); i++) {
+        LLVMValueRef value = LLVMGetIncomingValue(inst, i);
+        int incoming = blocks[LLVMGetIncomingBlock(inst, i)];
+        incoming_blocks.push_back(incoming);
+        if (!LLVMIsAInstruction(value) && !LLVMIsAArgument(value))
+          pending.push_back(
+              {block, (int)func.blocks[block].insts.size(), (int)i, incoming,
+               value});
+      }
+      std::vector<int> args;
+      for (unsigned i = 0; i < LLVMCountIncoming(inst); i++) {
+        LLVMValueRef value = LLVMGetIncomingValue(inst, i);
+        args.push_back(LLVMIsAInstruction(value) || LLVMIsAArgument(value)
+                           ? value_id(value)
+                           : fir_null);
+      }
+      emit_result(inst, "phi", args);
+      func.blocks[block].insts.back().blocks = incoming_blocks;
+      return;
+    }
+    case LLVMICmp:
+    case LLVMFCmp:
+      emit_result(inst, op_name(opcode), operands(inst, 2),
+                  predicate_name(inst));
+      return;
+    case LLVMExtractValue:
+    case LLVMInsertValue: {
+      std::string indices;
+      for (unsigned i = 0; i < LLVMGetNumIndices(inst); i++)
+        indices += (i ? "," : "") + std::to_string(LLVMGetIndices(inst)[i]);
+      emit_result(inst, opcode == LLVMExtractValue ? "extract" : "insert",
+                  operands(inst, LLVMGetNumOperands(inst)), indices);
+      return;
+    }
+    default:
+      break;
+    }
+    if (is_cast(opcode)) {
+      emit_result(inst, "cast", operands(inst, 1), op_name(opcode));
+      return;
+    }
+    // the rest, e.g. arithmetic, switch and atomics, with their operands
+    std::vector<int> args, targets;
+    for (int i = 0; i < LLVMGetNumOperands(inst); i++) {
+      LLVMValueRef value = LLVMGetOperand(inst, i);
+      if (LLVMValueIsBasicBlock(value))
+        targets.push_back(blocks[LLVMValueAsBasicBlock(value)]);
+      else
+        args.push_back(operand(value));
+    }
+    emit_result(inst, op_name(opcode), args);
+    func.blocks[block].insts.back().blocks = targets;
+  }
+
+public:
+  FirLifter(FirFunction &func) : func(func) {}
+
+  void lift(LLVMValueRef llvm_func) {
+    for (LLVMBasicBlockRef bb = LLVMGetFirstBasicBlock(llvm_func); bb;
+         bb = LLVMGetNextBasicBlock(bb)) {
+      blocks[bb] = func.blocks.size();
+      func.blocks.push_back(FirBlock{(int)func.blocks.size(), {}});
+      for (LLVMValueRef inst = LLVMGetFirstInstruction(bb); inst;
+           inst = LLVMGetNextInstruction(inst))
+        if (LLVMIsAAllocaInst(inst)) {
+          std::string name = LLVMGetValueName(inst);
+          if (name.empty())
+            name = "." + std::to_string(func.slots.size());
+          slots[inst] = "$" + name;
+          func.slots.push_back(
+              FirSlot{"$" + name, LLVMGetAllocatedType(inst)});
+        }
+    }
+    for (LLVMValueRef param = LLVMGetFirstParam(llvm_func); param;
+         param = LLVMGetNextParam(param))
+      values[param] =
+          emit("param", LLVMTypeOf(param), {}, LLVMGetValueName(param));
+    for (LLVMBasicBlockRef bb = LLVMGetFirstBasicBlock(llvm_func); bb;
+         bb = LLVMGetNextBasicBlock(bb)) {
+      block = blocks[bb];
+      for (LLVMValueRef inst = LLVMGetFirstInstruction(bb); inst;
+           inst = LLVMGetNextInstruction(inst))
+        lift_inst(inst);
+    }
+    // before the terminator of the incoming block
+    for (auto &incoming : pending) {
+      block = incoming.incoming_block;
+      auto &insts = func.blocks[block].insts;
+      size_t terminator = insts.size() - 1;
+      int value = operand(incoming.value);
+      std::rotate(insts.begin() + terminator, insts.begin() + terminator + 1,
+                  insts.end());
+      FirInst &phi = func.blocks[incoming.phi_block].insts[incoming.phi_index];
+      phi.args[incoming.arg] = value;
+    }
+  }
+};
+
+// turns branches on constant conditions into unconditional ones, returns
+// whether it changed any
+static bool fold_constant_branches(FirFunction &func) {
+  bool changed = false;
+  std::map<int, FirInst *> insts;
+  for (auto &block : func.blocks)
+    for (auto &inst : block.insts)
+      if (inst.type)
+        insts[inst.id] = &inst;
+  for (auto &block : func.blocks)
+    for (auto &inst : block.insts) {
+      if (inst.op != "condbr")
+        continue;
+      FirInst *cond = insts[inst.args[0]];
+      // phis with a single incoming value are left by dropped blocks
+      while (cond &&
+             (cond->op == "cast" ||
+              (cond->op == "phi" && cond->args.size() == 1)))
+        cond = insts[cond->args[0]];
+      if (!cond || cond->op != "const" ||
+          (cond->detail != "true" && cond->detail != "false"))
+        continue;
+      int target = inst.blocks[cond->detail == "false"];
+      inst = FirInst{fir_null, "br", nullptr, {}, {target}, "", true};
+      changed = true;
+    }
+  return changed;
+}
+
+// drops the blocks that can't be reached from the entry or a label address
+// (by goto *), and their incoming values in phis
+static void remove_unreachable_blocks(FirFunction &func) {
+  // block ids stay the same when blocks are removed
+  std::map<int, FirBlock *> blocks;
+  for (auto &block : func.blocks)
+    blocks[block.id] = &block;
+  std::unordered_set<int> reachable;
+  std::vector<int> work = {func.blocks[0].id};
+  while (!work.empty()) {
+    int block = work.back();
+    work.pop_back();
+    if (!reachable.insert(block).second)
+      continue;
+    for (auto &inst : blocks[block]->insts)
+      if (inst.op != "phi")
+        work.insert(work.end(), inst.blocks.begin(), inst.blocks.end());
+  }
+  std::erase_if(func.blocks,
+                [&](FirBlock &block) { return !reachable.count(block.id); });
+  for (auto &block : func.blocks)
+    for (auto &inst : block.insts)
+      if (inst.op == "phi")
+        for (size_t i = inst.blocks.size(); i-- > 0;)
+          if (!reachable.count(inst.blocks[i])) {
+            inst.blocks.erase(inst.blocks.begin() + i);
+            inst.args.erase(inst.args.begin() + i);
+          }
+}
+
+// removes the instructions without side effects whose results are unused
+static void remove_dead_values(FirFunction &func) {
+  for (bool changed = true; changed;) {
+    changed = false;
+    std::unordered_set<int> used;
+    for (auto &block : func.blocks)
+      for (auto &inst : block.insts)
+        used.insert(inst.args.begin(), inst.args.end());
+    for (auto &block : func.blocks)
+      changed |= std::erase_if(block.insts, [&](FirInst &inst) {
+        return !inst.has_side_effects && !used.count(inst.id);
+      });
+  }
+}
+
+// escape analysis: a slot escapes if an address derived from it is used by
+// anything but a load, the address operand of a store, or an element access
+static void mark_escaping_slots(FirFunction &func) {
+  std::map<int, FirInst *> insts;
+  std::map<int, std::vector<FirInst *>> users;
+  for (auto &block : func.blocks)
+    for (auto &inst : block.insts) {
+      insts[inst.id] = &inst;
+      for (int arg : inst.args)
+        users[arg].push_back(&inst);
+    }
+  std::function<bool(int)> escapes = [&](int address) {
+    for (FirInst *user : users[address]) {
+      bool is_address_operand = user->args[0] == address;
+      if (user->op == "load" ||
+          (user->op == "store" && is_address_operand &&
+           user->args.size() == 2 && user->args[1] != address))
+        continue;
+      if ((user->op == "field" || user->op == "index") && is_address_operand &&
+          !escapes(user->id))
+        continue;
+      return true;
+    }
+    return false;
+  };
+  for (auto &[id, inst] : insts)
+    if (inst->op == "addr" && inst->detail.starts_with("$") &&
+        escapes(inst->id))
+      for (auto &slot : func.slots)
+        if (slot.name == inst->detail)
+          slot.escapes = true;
+}
+
+static std::string value_name(int value) {
+  return value == fir_null ? "null" : "%" + std::to_string(value);
+}
+static void write_inst(std::ostream &out, FirInst &inst) {
+  out << "  ";
+  if (inst.type)
+    out << value_name(inst.id) << " = ";
+  out << inst.op;
+  std::string separator = " ";
+  if (!inst.detail.empty()) {
+    out << separator << inst.detail;
+    separator = ", ";
+  }
+  if (inst.op == "phi")
+    for (size_t i = 0; i < inst.args.size(); i++, separator = ", ")
+      out << separator << "[" << value_name(inst.args[i]) << ", bb"
+          << inst.blocks[i] << "]";
+  else {
+    for (int arg : inst.args) {
+      out << separator << value_name(arg);
+      separator = ", ";
+    }
+    for (int block : inst.blocks) {
+      out << separator << "bb" << block;
+      separator = ", ";
+    }
+  }
+  if (inst.type)
+    out << " : " << llvm_string(inst.type);
+  out << '\n';
+}
+void write_fir(LLVMModuleRef module, std::string path) {
+  std::ofstream out(path);
+  if (!out)
+    error("Can't write '" << path << "'");
+  for (FirFunction &func : fir_functions) {
+    // e.g. merged into another function by --icf
+    LLVMValueRef llvm_func = LLVMGetNamedFunction(module, func.name.c_str());
+    if (!llvm_func || !LLVMGetFirstBasicBlock(llvm_func))
+      continue;
+    FirLifter(func).lift(llvm_func);
+    do
+      remove_unreachable_blocks(func);
+    while (fold_constant_branches(func));
+    remove_dead_values(func);
+    mark_escaping_slots(func);
+
+    out << "fun " << func.name << "(";
+    for (size_t i = 0; i < func.type->arguments.size(); i++)
+      out << (i ? ", " : "") << func.type->arguments[i]->stringify();
+    out << ") : " << func.type->return_type->stringify() << " {\n";
+    for (auto &slot : func.slots)
+      out << "  slot " << slot.name << " : " << llvm_string(slot.type)
+          << (slot.escapes ? "" : " noescape") << '\n';
+    for (auto &block : func.blocks) {
+      out << "bb" << block.id << ":\n";
+      for (auto &inst : block.insts)
+        write_inst(out, inst);
+    }
+    out << "}\n\n";
+  }
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "types.h"
+// FIR - a dump of fy's generated functions for inspecting them. `--emit=fir`
+// lifts every function instance from the LLVM IR that would be emitted, after
+// fy's own passes, and writes it instead of LLVM output. Values are in SSA
+// form (%N is the result of instruction N), local variables are slots
+// ($name) that are loaded and stored, and control flow is explicit basic
+// blocks (bbN). Its passes (constant branches, unreachable blocks, dead
+// values, escaping slots) only change the dump.
+
+/// FirInst - a FIR instruction, `type` is nullptr if it has no result.
+struct FirInst {
+  int id;
+  std::string op;
+  LLVMTypeRef type;
+  std::vector<int> args;
+  // branch targets, or the incoming blocks of a phi
+  std::vector<int> blocks;
+  // constant, callee, slot, field or predicate
+  std::string detail;
+  // stores, calls and branches, kept even if nothing uses their result
+  bool has_side_effects;
+};
+struct FirBlock {
+  int id;
+  std::vector<FirInst> insts;
+};
+/// FirSlot - a local variable. It escapes if its address is used other than
+/// to load, store or reach one of its elements.
+struct FirSlot {
+  std::string name;
+  LLVMTypeRef type;
+  bool escapes = false;
+};
+struct FirFunction {
+  std::string name;
+  FunctionType *type;
+  std::vector<FirSlot> slots;
+  std::vector<FirBlock> blocks;
+};
+
+// the operand for no value, e.g. the result of a void return
+constexpr int fir_null = -1;
+
+// with --emit=fir, the function instance `name` with the fy type `type` is
+// in the dump
+void add_fir_function(FunctionType *type, std::string name);
+// lifts the functions added so far from `module` to FIR, runs the FIR passes
+// and writes them to `path`
+void write_fir(LLVMModuleRef module, std::string path);
@@ -0,0 +1,237 @@
+#include "hugepage.h"
+#include <elf.h>
+#include <functional>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+
+#define HUGE_PAGE_SIZE 0x200000
+#define PAGE_SIZE 0x1000
+// Linux 5.14, older headers don't have it
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+const std::vector<std::string> hugepage_link_flags = {
+    "-Wl,-z,max-page-size=0x200000", "-Wl,-z,separate-code"};
+
+// Elf64_Phdr, {type, flags, offset, vaddr, paddr, filesz, memsz, align}
+enum { PHDR_TYPE, PHDR_FLAGS, PHDR_VADDR = 3, PHDR_MEMSZ = 6 };
+
+// calls the C function `name`, declared with the types of the first `fixed`
+// arguments (all by default) and variable arguments after them
+static LLVMValueRef call_libc(const char *name, LLVMTypeRef returns,
+                              std::vector<LLVMValueRef> args,
+                              size_t fixed = SIZE_MAX) {
+  fixed = std::min(fixed, args.size());
+  std::vector<LLVMTypeRef> params;
+  for (size_t i = 0; i < fixed; i++)
+    params.push_back(LLVMTypeOf(args[i]));
+  LLVMTypeRef type = LLVMFunctionType(returns, params.data(), params.size(),
+                                      fixed < args.size());
+  LLVMValueRef func = LLVMGetNamedFunction(curr_module, name);
+  if (!func)
+    func = LLVMAddFunction(curr_module, name, type);
+  // the program may have declared it with other types
+  func = LLVMConstBitCast(func, LLVMPointerType(type, 0));
+  return LLVMBuildCall2(curr_builder, type, func, args.data(), args.size(),
+                        UN);
+}
+
+static LLVMValueRef const_i64(uint64_t value) {
+  return LLVMConstInt(LLVMInt64TypeInContext(curr_ctx), value, false);
+}
+static LLVMValueRef const_i32(uint64_t value) {
+  return LLVMConstInt(LLVMInt32TypeInContext(curr_ctx), value, false);
+}
+// `value` rounded down to a multiple of `size`, a power of two
+static LLVMValueRef gen_align_down(LLVMValueRef value, uint64_t size) {
+  return LLVMBuildAnd(curr_builder, value, const_i64(~(size - 1)), UN);
+}
+static LLVMValueRef gen_align_up(LLVMValueRef value, uint64_t size) {
+  return gen_align_down(
+      LLVMBuildAdd(curr_builder, value, const_i64(size - 1), UN), size);
+}
+static LLVMValueRef gen_to_ptr(LLVMValueRef address) {
+  return LLVMBuildIntToPtr(
+      curr_builder, address,
+      LLVMPointerType(LLVMInt8TypeInContext(curr_ctx), 0), UN);
+}
+
+// generates `then` in a block run if `cond` holds, the builder continues
+// after it
+static void gen_if(LLVMValueRef func, LLVMValueRef cond,
+                   std::function<void()> then) {
+  LLVMBasicBlockRef then_block =
+      LLVMAppendBasicBlockInContext(curr_ctx, func, "then");
+  LLVMBasicBlockRef after = LLVMAppendBasicBlockInContext(curr_ctx, func, "");
+  LLVMBuildCondBr(curr_builder, cond, then_block, after);
+  LLVMPositionBuilderAtEnd(curr_builder, then_block);
+  then();
+  LLVMBuildBr(curr_builder, after);
+  LLVMPositionBuilderAtEnd(curr_builder, after);
+}
+
+// a field of the program header `phdr`, zero extended to 64 bits
+static LLVMValueRef gen_phdr_field(LLVMTypeRef phdr_type, LLVMValueRef phdr,
+                                   unsigned field) {
+  LLVMTypeRef type = LLVMStructGetTypeAtIndex(phdr_type, field);
+  LLVMValueRef value = LLVMBuildLoad2(
+      curr_builder, type,
+      LLVMBuildStructGEP2(curr_builder, phdr_type, phdr, field, UN), UN);
+  return LLVMBuildZExt(curr_builder, value, LLVMInt64TypeInContext(curr_ctx),
+                       UN);
+}
+
+// generates a loop running `body` with each program header of the
+// executable
+static void gen_segment_loop(LLVMValueRef func, LLVMTypeRef phdr_type,
+                             LLVMValueRef phdrs, LLVMValueRef count,
+                             std::function<void(LLVMValueRef)> body) {
+  LLVMTypeRef i64 = LLVMInt64TypeInContext(curr_ctx);
+  LLVMBasicBlockRef before = LLVMGetInsertBlock(curr_builder);
+  LLVMBasicBlockRef cond_block =
+      LLVMAppendBasicBlockInContext(curr_ctx, func, "segments");
+  LLVMBasicBlockRef body_block =
+      LLVMAppendBasicBlockInContext(curr_ctx, func, "segment");
+  LLVMBuildBr(curr_builder, cond_block);
+  LLVMPositionBuilderAtEnd(curr_builder, cond_block);
+  LLVMValueRef index = LLVMBuildPhi(curr_builder, i64, "i");
+  LLVMValueRef zero = const_i64(0);
+  LLVMAddIncoming(index, &zero, &before, 1);
+  LLVMBasicBlockRef after =
+      LLVMAppendBasicBlockInContext(curr_ctx, func, "segments_end");
+  LLVMBuildCondBr(curr_builder,
+                  LLVMBuildICmp(curr_builder, LLVMIntULT, index, count, UN),
+                  body_block, after);
+  LLVMPositionBuilderAtEnd(curr_builder, body_block);
+  body(LLVMBuildGEP2(curr_builder, phdr_type, phdrs, &index, 1, UN));
+  LLVMValueRef next = LLVMBuildAdd(curr_builder, index, const_i64(1), UN);
+  LLVMBasicBlockRef latch = LLVMGetInsertBlock(curr_builder);
+  LLVMAddIncoming(index, &next, &latch, 1);
+  LLVMBuildBr(curr_builder, cond_block);
+  LLVMPositionBuilderAtEnd(curr_builder, after);
+}
+
+// generates fy.hugepage_text, which finds the segments in the program
+// headers (getauxval(AT_PHDR)), prefaults the writable ones and moves a
+// huge page copy of the text over it with mremap. The text stays mapped the
+// whole time, so it may run from the text it remaps
+static LLVMValueRef gen_remap_function() {
+  LLVMTypeRef i32 = LLVMInt32TypeInContext(curr_ctx);
+  LLVMTypeRef i64 = LLVMInt64TypeInContext(curr_ctx);
+  LLVMTypeRef i8_ptr = LLVMPointerType(LLVMInt8TypeInContext(curr_ctx), 0);
+  LLVMTypeRef phdr_fields[] = {i32, i32, i64, i64, i64, i64, i64, i64};
+  LLVMTypeRef phdr_type =
+      LLVMStructTypeInContext(curr_ctx, phdr_fields, 8, false);
+  LLVMValueRef func = LLVMAddFunction(
+      curr_module, "fy.hugepage_text",
+      LLVMFunctionType(LLVMVoidTypeInContext(curr_ctx), nullptr, 0, false));
+  LLVMSetLinkage(func, LLVMInternalLinkage);
+  // it runs once, layout_functions places it with the cold code
+  add_function_attr(func, "cold");
+  add_function_attr(func, "noinline");
+  LLVMPositionBuilderAtEnd(curr_builder,
+                           LLVMAppendBasicBlockInContext(curr_ctx, func, ""));
+  LLVMValueRef bias = LLVMBuildAlloca(curr_builder, i64, "bias");
+  LLVMValueRef text_start = LLVMBuildAlloca(curr_builder, i64, "text_start");
+  LLVMValueRef text_end = LLVMBuildAlloca(curr_builder, i64, "text_end");
+  for (LLVMValueRef var : {bias, text_start, text_end})
+    LLVMBuildStore(curr_builder, const_i64(0), var);
+  LLVMValueRef phdrs_address =
+      call_libc("getauxval", i64, {const_i64(AT_PHDR)});
+  LLVMValueRef phdrs = LLVMBuildIntToPtr(
+      curr_builder, phdrs_address, LLVMPointerType(phdr_type, 0), UN);
+  LLVMValueRef count = call_libc("getauxval", i64, {const_i64(AT_PHNUM)});
+  auto has_type = [&](LLVMValueRef phdr, unsigned type) {
+    return LLVMBuildICmp(curr_builder, LLVMIntEQ,
+                         gen_phdr_field(phdr_type, phdr, PHDR_TYPE),
+                         const_i64(type), UN);
+  };
+  auto has_flag = [&](LLVMValueRef phdr, unsigned flag) {
+    LLVMValueRef flags = gen_phdr_field(phdr_type, phdr, PHDR_FLAGS);
+    return LLVMBuildAnd(
+        curr_builder, has_type(phdr, PT_LOAD),
+        LLVMBuildICmp(curr_builder, LLVMIntNE,
+                      LLVMBuildAnd(curr_builder, flags, const_i64(flag), UN),
+                      const_i64(0), UN),
+        UN);
+  };
+  // position independent executables are loaded at an offset
+  gen_segment_loop(func, phdr_type, phdrs, count, [&](LLVMValueRef phdr) {
+    gen_if(func, has_type(phdr, PT_PHDR), [&] {
+      LLVMBuildStore(
+          curr_builder,
+          LLVMBuildSub(curr_builder, phdrs_address,
+                       gen_phdr_field(phdr_type, phdr, PHDR_VADDR), UN),
+          bias);
+    });
+  });
+  gen_segment_loop(func, phdr_type, phdrs, count, [&](LLVMValueRef phdr) {
+    LLVMValueRef start = LLVMBuildAdd(
+        curr_builder, LLVMBuildLoad2(curr_builder, i64, bias, UN),
+        gen_phdr_field(phdr_type, phdr, PHDR_VADDR), UN);
+    LLVMValueRef end = LLVMBuildAdd(
+        curr_builder, start, gen_phdr_field(phdr_type, phdr, PHDR_MEMSZ), UN);
+    gen_if(func, has_flag(phdr, PF_X), [&] {
+      LLVMBuildStore(curr_builder, start, text_start);
+      LLVMBuildStore(curr_builder, end, text_end);
+    });
+    // fails before Linux 5.14, which only loses the prefaulting
+    gen_if(func, has_flag(phdr, PF_W), [&] {
+      LLVMValueRef page = gen_align_down(start, PAGE_SIZE);
+      call_libc("madvise", i32,
+                {gen_to_ptr(page), LLVMBuildSub(curr_builder, end, page, UN),
+                 const_i32(MADV_POPULATE_WRITE)});
+    });
+  });
+
+  // the whole huge pages of the text
+  LLVMValueRef start = gen_align_up(
+      LLVMBuildLoad2(curr_builder, i64, text_start, UN), HUGE_PAGE_SIZE);
+  LLVMValueRef end = gen_align_down(
+      LLVMBuildLoad2(curr_builder, i64, text_end, UN), HUGE_PAGE_SIZE);
+  gen_if(func, LLVMBuildICmp(curr_builder, LLVMIntUGT, end, start, UN), [&] {
+    LLVMValueRef size = LLVMBuildSub(curr_builder, end, start, UN);
+    // room to align the copy to a huge page
+    LLVMValueRef mapped_size =
+        LLVMBuildAdd(curr_builder, size, const_i64(HUGE_PAGE_SIZE), UN);
+    LLVMValueRef mapped = call_libc(
+        "mmap", i8_ptr,
+        {LLVMConstNull(i8_ptr), mapped_size,
+         const_i32(PROT_READ | PROT_WRITE),
+         const_i32(MAP_PRIVATE | MAP_ANONYMOUS), const_i32(-1), const_i64(0)});
+    gen_if(func,
+           LLVMBuildICmp(curr_builder, LLVMIntNE, mapped,
+                         LLVMConstIntToPtr(const_i64(-1), i8_ptr), UN),
+           [&] {
+             LLVMValueRef copy = gen_to_ptr(gen_align_up(
+                 LLVMBuildPtrToInt(curr_builder, mapped, i64, UN),
+                 HUGE_PAGE_SIZE));
+             call_libc("madvise", i32, {copy, size, const_i32(MADV_HUGEPAGE)});
+             LLVMBuildMemCpy(curr_builder, copy, HUGE_PAGE_SIZE,
+                             gen_to_ptr(start), HUGE_PAGE_SIZE, size);
+             call_libc("mprotect", i32,
+                       {copy, size, const_i32(PROT_READ | PROT_EXEC)});
+             // replaces the text at once, it's kept if this fails
+             call_libc("mremap", i8_ptr,
+                       {copy, size, size,
+                        const_i32(MREMAP_MAYMOVE | MREMAP_FIXED),
+                        gen_to_ptr(start)},
+                       4);
+             // what's left of the mapping around the moved copy (or the
+             // copy)
+             call_libc("munmap", i32, {mapped, mapped_size});
+           });
+  });
+  LLVMBuildRetVoid(curr_builder);
+  return func;
+}
+
+void gen_hugepage_text(LLVMValueRef main_func) {
+  LLVMValueRef remap = gen_remap_function();
+  // before the global variables' initializers in main
+  LLVMBasicBlockRef entry = LLVMGetEntryBasicBlock(main_func);
+  LLVMPositionBuilderBefore(curr_builder, LLVMGetFirstInstruction(entry));
+  LLVMBuildCall2(curr_builder, LLVMGlobalGetValueType(remap), remap, nullptr,
+                 0, "");
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "utils.h"
+// Huge page text (--hugepage-text) for large AOT binaries. `fy build` links
+// with 2 MiB segment alignment (-z max-page-size=0x200000, which binaries
+// from `fy com` need too), and main starts by copying the whole 2 MiB pages
+// of its text segment to transparent huge pages, which are moved over the
+// text in place. Hot functions are at the start of .text (see layout.h).
+// It also prefaults the writable segments (.data and .bss), so their page
+// faults aren't spread over the run. It's best effort, without THP (or on
+// old kernels) the program runs as it would without it.
+
+// the linker flags that align the segments to huge pages
+extern const std::vector<std::string> hugepage_link_flags;
+// calls the remapping at the start of `main_func`
+void gen_hugepage_text(LLVMValueRef main_func);
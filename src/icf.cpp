@@ -0,0 +1,58 @@
+#include "icf.h"
+#include "compiler.h"
+#include "options.h"
+
+std::atomic<size_t> merged_functions = 0, merged_instructions = 0;
+
+// fy doesn't compare function addresses, unnamed_addr lets LLVM replace every
+// use of a folded function
+void allow_folding(LLVMValueRef func) {
+  if (!options.icf.empty())
+    LLVMSetUnnamedAddress(func, LLVMGlobalUnnamedAddr);
+}
+// linking keeps unnamed_addr only if every module has it, so it's enough that
+// the worker that took the address clears it
+void mark_address_taken(LLVMValueRef func) {
+  if (options.icf == "safe")
+    LLVMSetUnnamedAddress(func, LLVMNoUnnamedAddr);
+}
+
+// instructions of every function with a body, by name
+static std::unordered_map<std::string, size_t>
+count_instructions(LLVMModuleRef module) {
+  std::unordered_map<std::string, size_t> counts;
+  for (LLVMValueRef func = LLVMGetFirstFunction(module); func;
+       func = LLVMGetNextFunction(func)) {
+    if (!LLVMGetFirstBasicBlock(func))
+      continue;
+    size_t &count = counts[LLVMGetValueName(func)];
+    for (LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(func); block;
+         block = LLVMGetNextBasicBlock(block))
+      for (LLVMValueRef inst = LLVMGetFirstInstruction(block); inst;
+           inst = LLVMGetNextInstruction(inst))
+        count++;
+  }
+  return counts;
+}
+
+void merge_functions(LLVMModuleRef module,
+                     LLVMTargetMachineRef target_machine) {
+  auto before = count_instructions(module);
+  run_passes(module, "mergefunc", target_machine);
+  auto after = count_instructions(module);
+  // folded functions are gone or became a thunk
+  for (auto &[name, count] : before) {
+    auto folded = after.find(name);
+    size_t left = folded == after.end() ? 0 : folded->second;
+    if (left < count) {
+      debug_log("Folded " << name);
+      merged_functions++;
+      merged_instructions += count - left;
+    }
+  }
+  for (LLVMValueRef func = LLVMGetFirstFunction(module); func;
+       func = LLVMGetNextFunction(func))
+    if (LLVMGetFirstBasicBlock(func) && !LLVMGetSection(func))
+      LLVMSetSection(func,
+                     (std::string(".text.") + LLVMGetValueName(func)).c_str());
+}
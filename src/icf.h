@@ -0,0 +1,18 @@
+#pragma once
+#include "utils.h"
+#include <atomic>
+// Identical code folding (--icf=all|safe). LLVM's MergeFunctions folds
+// functions with equivalent IR, and every function gets its own section so the
+// linker (gold's --icf) can fold identical machine code too. With --icf=safe
+// functions whose address is taken keep a distinct address, callers of a
+// folded copy still reach it through a thunk.
+
+// functions folded into another one, and the IR instructions that saved
+extern std::atomic<size_t> merged_functions, merged_instructions;
+
+// lets `func`, a function fy generates, be folded if --icf is given
+void allow_folding(LLVMValueRef func);
+// the address of `func` is taken, it keeps its own with --icf=safe
+void mark_address_taken(LLVMValueRef func);
+// runs MergeFunctions on `module` and gives every function a section
+void merge_functions(LLVMModuleRef module, LLVMTargetMachineRef target_machine);
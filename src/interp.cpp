@@ -0,0 +1,535 @@
+#include "interp.h"
+#include "compiler.h"
+#include "options.h"
+#include "specialize.h"
+#include <algorithm>
+#include <map>
+#include <unordered_set>
+
+/// FunctionInfo - what decides which tier runs a function.
+struct FunctionInfo {
+  // uses something the interpreter can't run
+  bool needs_native = false;
+  bool has_loop = false;
+  // calls through a function pointer or takes the address of a function
+  bool uses_function_pointers = false;
+  // the functions with bodies it calls
+  std::vector<LLVMValueRef> callees;
+};
+
+// prefixes of the intrinsics the interpreter lowers to calls or runs itself
+static const char *interpreted_intrinsics[] = {
+    "llvm.memcpy.", "llvm.memmove.", "llvm.memset.", "llvm.lifetime.",
+    "llvm.dbg.",    "llvm.expect.",  "llvm.ctpop.",  "llvm.bswap.",
+    "llvm.ctlz.",   "llvm.cttz.",    "llvm.sqrt.",   "llvm.sin.",
+    "llvm.cos.",    "llvm.pow.",     "llvm.exp.",    "llvm.exp2.",
+    "llvm.log.",    "llvm.log2.",    "llvm.log10.",  "llvm.floor.",
+    "llvm.ceil.",   "llvm.trunc.",   "llvm.round.",  "llvm.copysign.",
+    "llvm.va_start", "llvm.va_end", "llvm.va_copy"};
+static bool is_interpreted_intrinsic(LLVMValueRef func) {
+  std::string name = LLVMGetValueName(func);
+  for (const char *prefix : interpreted_intrinsics)
+    if (name.starts_with(prefix))
+      return true;
+  return false;
+}
+// whether libffi can pass `type` between the interpreter and machine code
+static bool is_ffi_type(LLVMTypeRef type) {
+  switch (LLVMGetTypeKind(type)) {
+  case LLVMVoidTypeKind:
+  case LLVMFloatTypeKind:
+  case LLVMDoubleTypeKind:
+  case LLVMPointerTypeKind:
+    return true;
+  case LLVMIntegerTypeKind:
+    switch (LLVMGetIntTypeWidth(type)) {
+    case 8:
+    case 16:
+    case 32:
+    case 64:
+      return true;
+    }
+    [[fallthrough]];
+  default:
+    return false;
+  }
+}
+static bool is_ffi_signature(LLVMValueRef func) {
+  LLVMTypeRef type = LLVMGlobalGetValueType(func);
+  std::vector<LLVMTypeRef> params(LLVMCountParamTypes(type));
+  LLVMGetParamTypes(type, params.data());
+  return is_ffi_type(LLVMGetReturnType(type)) &&
+         std::all_of(params.begin(), params.end(), is_ffi_type);
+}
+
+static bool is_aggregate(LLVMTypeRef type) {
+  LLVMTypeKind kind = LLVMGetTypeKind(type);
+  return kind == LLVMStructTypeKind || kind == LLVMArrayTypeKind;
+}
+// the interpreter can't make array values, undefined ones have no elements
+static bool has_array(LLVMTypeRef type) {
+  switch (LLVMGetTypeKind(type)) {
+  case LLVMArrayTypeKind:
+    return true;
+  case LLVMStructTypeKind:
+    for (unsigned i = 0; i < LLVMCountStructElementTypes(type); i++)
+      if (has_array(LLVMStructGetTypeAtIndex(type, i)))
+        return true;
+    [[fallthrough]];
+  default:
+    return false;
+  }
+}
+
+static LLVMValueRef strip_casts(LLVMValueRef value) {
+  while (LLVMIsAConstantExpr(value) && LLVMGetConstOpcode(value) == LLVMBitCast)
+    value = LLVMGetOperand(value, 0);
+  return value;
+}
+// whether `value` is a function or a constant using one
+static bool refers_to_function(LLVMValueRef value) {
+  if (LLVMIsAFunction(value))
+    return true;
+  if (LLVMIsAConstant(value) && !LLVMIsAGlobalValue(value))
+    for (int i = 0; i < LLVMGetNumOperands(value); i++)
+      if (refers_to_function(LLVMGetOperand(value, i)))
+        return true;
+  return false;
+}
+// whether `value` is a block address or a constant using one
+static bool refers_to_block(LLVMValueRef value) {
+  if (LLVMIsABlockAddress(value))
+    return true;
+  if (LLVMIsAConstant(value) && !LLVMIsAGlobalValue(value))
+    for (int i = 0; i < LLVMGetNumOperands(value); i++)
+      if (refers_to_block(LLVMGetOperand(value, i)))
+        return true;
+  return false;
+}
+// whether the control flow of `func` has a cycle, a depth-first search for
+// an edge back to a block on the stack
+static bool has_loop(LLVMValueRef func) {
+  enum { UNSEEN, ON_STACK, DONE };
+  std::unordered_map<LLVMBasicBlockRef, int> states;
+  LLVMBasicBlockRef entry = LLVMGetEntryBasicBlock(func);
+  std::vector<std::pair<LLVMBasicBlockRef, unsigned>> stack = {{entry, 0}};
+  states[entry] = ON_STACK;
+  while (!stack.empty()) {
+    LLVMBasicBlockRef block = stack.back().first;
+    LLVMValueRef terminator = LLVMGetBasicBlockTerminator(block);
+    unsigned next = stack.back().second++;
+    if (next >= LLVMGetNumSuccessors(terminator)) {
+      states[block] = DONE;
+      stack.pop_back();
+      continue;
+    }
+    LLVMBasicBlockRef successor = LLVMGetSuccessor(terminator, next);
+    int &state = states[successor];
+    if (state == ON_STACK)
+      return true;
+    if (state == UNSEEN) {
+      state = ON_STACK;
+      stack.push_back({successor, 0});
+    }
+  }
+  return false;
+}
+static FunctionInfo scan_function(LLVMValueRef func) {
+  FunctionInfo info;
+  info.has_loop = has_loop(func);
+  for (LLVMValueRef param = LLVMGetFirstParam(func); param;
+       param = LLVMGetNextParam(param))
+    info.needs_native |= has_array(LLVMTypeOf(param));
+  for (LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(func); block;
+       block = LLVMGetNextBasicBlock(block))
+    for (LLVMValueRef inst = LLVMGetFirstInstruction(block); inst;
+         inst = LLVMGetNextInstruction(inst)) {
+      LLVMOpcode op = LLVMGetInstructionOpcode(inst);
+      if (op == LLVMAtomicRMW || op == LLVMAtomicCmpXchg || op == LLVMFence ||
+          op == LLVMFreeze || op == LLVMCallBr)
+        info.needs_native = true;
+      int operands = LLVMGetNumOperands(inst);
+      if (op == LLVMCall || op == LLVMInvoke) {
+        // the arguments are checked below
+        operands = LLVMGetNumArgOperands(inst);
+        LLVMValueRef callee = strip_casts(LLVMGetCalledValue(inst));
+        if (LLVMIsAInlineAsm(callee))
+          info.needs_native = true;
+        else if (!LLVMIsAFunction(callee))
+          info.uses_function_pointers = true;
+        else if (LLVMGetIntrinsicID(callee))
+          info.needs_native |= !is_interpreted_intrinsic(callee);
+        else if (LLVMGetFirstBasicBlock(callee))
+          info.callees.push_back(callee);
+        else
+          info.needs_native |=
+              !is_ffi_signature(callee) ||
+              LLVMIsFunctionVarArg(LLVMGlobalGetValueType(callee));
+      }
+      // it loads and stores scalars and vectors, and has no aggregate
+      // constants
+      if (op == LLVMLoad || op == LLVMStore) {
+        LLVMValueRef value = op == LLVMLoad ? inst : LLVMGetOperand(inst, 0);
+        info.needs_native |= is_aggregate(LLVMTypeOf(value));
+      }
+      info.needs_native |= has_array(LLVMTypeOf(inst));
+      for (int i = 0; i < operands; i++) {
+        LLVMValueRef operand = LLVMGetOperand(inst, i);
+        if (refers_to_block(operand) || has_array(LLVMTypeOf(operand)) ||
+            (LLVMIsAConstant(operand) && !LLVMIsUndef(operand) &&
+             is_aggregate(LLVMTypeOf(operand))))
+          info.needs_native = true;
+        else if (refers_to_function(operand))
+          info.uses_function_pointers = true;
+      }
+    }
+  return info;
+}
+
+// makes the calls to C functions with variable arguments (e.g. printf) call
+// functions with fixed ones that call them. libffi can't call them from the
+// interpreter, and it prints with its own buffer
+static void wrap_var_arg_calls(LLVMModuleRef module) {
+  std::map<std::pair<LLVMValueRef, LLVMTypeRef>, LLVMValueRef> wrappers;
+  std::vector<LLVMValueRef> calls;
+  for (LLVMValueRef func = LLVMGetFirstFunction(module); func;
+       func = LLVMGetNextFunction(func))
+    if (!LLVMGetFirstBasicBlock(func) && !LLVMGetIntrinsicID(func) &&
+        LLVMIsFunctionVarArg(LLVMGlobalGetValueType(func)))
+      for (LLVMUseRef use = LLVMGetFirstUse(func); use;
+           use = LLVMGetNextUse(use)) {
+        LLVMValueRef call = LLVMGetUser(use);
+        if (LLVMIsACallInst(call) && LLVMGetCalledValue(call) == func)
+          calls.push_back(call);
+      }
+  // the wrappers take odd sized integers (e.g. bools) zero extended
+  auto ffi_type = [](LLVMTypeRef type) {
+    if (LLVMGetTypeKind(type) != LLVMIntegerTypeKind)
+      return type;
+    for (unsigned width : {8, 16, 32, 64})
+      if (LLVMGetIntTypeWidth(type) <= width)
+        return LLVMIntType(width);
+    return type;
+  };
+  LLVMBuilderRef builder = LLVMCreateBuilder();
+  for (LLVMValueRef call : calls) {
+    LLVMValueRef callee = LLVMGetCalledValue(call);
+    std::vector<LLVMValueRef> args;
+    std::vector<LLVMTypeRef> arg_types;
+    LLVMPositionBuilderBefore(builder, call);
+    for (unsigned i = 0; i < LLVMGetNumArgOperands(call); i++) {
+      LLVMValueRef arg = LLVMGetOperand(call, i);
+      arg_types.push_back(ffi_type(LLVMTypeOf(arg)));
+      args.push_back(arg_types.back() == LLVMTypeOf(arg)
+                         ? arg
+                         : LLVMBuildZExt(builder, arg, arg_types.back(), ""));
+    }
+    LLVMTypeRef type = LLVMFunctionType(LLVMTypeOf(call), arg_types.data(),
+                                        args.size(), false);
+    LLVMValueRef &wrapper = wrappers[{callee, type}];
+    if (!wrapper) {
+      std::string name = LLVMGetValueName(callee);
+      wrapper = LLVMAddFunction(module, ("fy.varargs." + name).c_str(), type);
+      LLVMSetLinkage(wrapper, LLVMInternalLinkage);
+      LLVMPositionBuilderAtEnd(builder,
+                               LLVMAppendBasicBlock(wrapper, "entry"));
+      std::vector<LLVMValueRef> params(args.size());
+      LLVMGetParams(wrapper, params.data());
+      for (unsigned i = 0; i < params.size(); i++) {
+        LLVMTypeRef arg_type = LLVMTypeOf(LLVMGetOperand(call, i));
+        if (arg_type != arg_types[i])
+          params[i] = LLVMBuildTrunc(builder, params[i], arg_type, "");
+      }
+      LLVMValueRef result =
+          LLVMBuildCall2(builder, LLVMGlobalGetValueType(callee), callee,
+                         params.data(), params.size(), "");
+      if (LLVMGetTypeKind(LLVMTypeOf(call)) == LLVMVoidTypeKind)
+        LLVMBuildRetVoid(builder);
+      else
+        LLVMBuildRet(builder, result);
+    }
+    LLVMPositionBuilderBefore(builder, call);
+    LLVMValueRef wrapped =
+        LLVMBuildCall2(builder, type, wrapper, args.data(), args.size(), "");
+    LLVMReplaceAllUsesWith(call, wrapped);
+    LLVMInstructionEraseFromParent(call);
+  }
+  LLVMDisposeBuilder(builder);
+}
+
+// makes the C functions returning fy's void, an empty struct, return void,
+// libffi has no empty structs
+static void void_empty_returns(LLVMModuleRef module) {
+  std::vector<LLVMValueRef> funcs;
+  for (LLVMValueRef func = LLVMGetFirstFunction(module); func;
+       func = LLVMGetNextFunction(func)) {
+    LLVMTypeRef returns = LLVMGetReturnType(LLVMGlobalGetValueType(func));
+    if (LLVMGetFirstBasicBlock(func) || LLVMGetIntrinsicID(func) ||
+        LLVMGetTypeKind(returns) != LLVMStructTypeKind ||
+        LLVMCountStructElementTypes(returns))
+      continue;
+    bool only_called = true;
+    for (LLVMUseRef use = LLVMGetFirstUse(func); use; use = LLVMGetNextUse(use))
+      only_called &= LLVMIsACallInst(LLVMGetUser(use)) &&
+                     LLVMGetCalledValue(LLVMGetUser(use)) == func;
+    if (only_called)
+      funcs.push_back(func);
+  }
+  LLVMBuilderRef builder = LLVMCreateBuilder();
+  for (LLVMValueRef func : funcs) {
+    LLVMTypeRef type = LLVMGlobalGetValueType(func);
+    std::vector<LLVMTypeRef> params(LLVMCountParamTypes(type));
+    LLVMGetParamTypes(type, params.data());
+    LLVMTypeRef void_type =
+        LLVMFunctionType(LLVMVoidType(), params.data(), params.size(),
+                         LLVMIsFunctionVarArg(type));
+    std::string name = LLVMGetValueName(func);
+    LLVMSetValueName2(func, "", 0);
+    LLVMValueRef declaration =
+        LLVMAddFunction(module, name.c_str(), void_type);
+    while (LLVMUseRef use = LLVMGetFirstUse(func)) {
+      LLVMValueRef call = LLVMGetUser(use);
+      std::vector<LLVMValueRef> args;
+      for (unsigned i = 0; i < LLVMGetNumArgOperands(call); i++)
+        args.push_back(LLVMGetOperand(call, i));
+      LLVMPositionBuilderBefore(builder, call);
+      LLVMBuildCall2(builder, void_type, declaration, args.data(), args.size(),
+                     "");
+      LLVMReplaceAllUsesWith(call, LLVMGetUndef(LLVMTypeOf(call)));
+      LLVMInstructionEraseFromParent(call);
+    }
+    LLVMDeleteFunction(func);
+  }
+  LLVMDisposeBuilder(builder);
+}
+
+// builds `constant`, a struct, with insertvalue from its elements. The
+// interpreter has no struct constants but undefined structs
+static LLVMValueRef build_struct(LLVMBuilderRef builder,
+                                 LLVMValueRef constant) {
+  LLVMTypeRef type = LLVMTypeOf(constant);
+  if (LLVMGetTypeKind(type) != LLVMStructTypeKind || LLVMIsUndef(constant))
+    return constant;
+  unsigned count = LLVMCountStructElementTypes(type);
+  if (count == 0)
+    return LLVMGetUndef(type);
+  // the builder would fold insertvalue into undef, it starts from a
+  // placeholder
+  LLVMValueRef placeholder = LLVMBuildPhi(builder, type, "");
+  LLVMValueRef value = placeholder;
+  for (unsigned i = 0; i < count; i++) {
+    LLVMValueRef element =
+        LLVMIsAConstantAggregateZero(constant)
+            ? LLVMConstNull(LLVMStructGetTypeAtIndex(type, i))
+            : LLVMGetOperand(constant, i);
+    value = LLVMBuildInsertValue(builder, value, build_struct(builder, element),
+                                 i, "");
+  }
+  LLVMReplaceAllUsesWith(placeholder, LLVMGetUndef(type));
+  LLVMInstructionEraseFromParent(placeholder);
+  return value;
+}
+// replaces the operands that are struct constants
+static void build_struct_constants(LLVMModuleRef module) {
+  LLVMBuilderRef builder = LLVMCreateBuilder();
+  for (LLVMValueRef func = LLVMGetFirstFunction(module); func;
+       func = LLVMGetNextFunction(func))
+    for (LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(func); block;
+         block = LLVMGetNextBasicBlock(block))
+      for (LLVMValueRef inst = LLVMGetFirstInstruction(block); inst;
+           inst = LLVMGetNextInstruction(inst)) {
+        if (LLVMGetInstructionOpcode(inst) == LLVMLandingPad)
+          continue;
+        for (int i = 0; i < LLVMGetNumOperands(inst); i++) {
+          LLVMValueRef operand = LLVMGetOperand(inst, i);
+          LLVMTypeRef type = LLVMTypeOf(operand);
+          if (!LLVMIsAConstant(operand) || LLVMIsUndef(operand) ||
+              LLVMGetTypeKind(type) != LLVMStructTypeKind || has_array(type))
+            continue;
+          // a phi's value is built at the end of the incoming block
+          if (LLVMIsAPHINode(inst))
+            LLVMPositionBuilderBefore(
+                builder, LLVMGetBasicBlockTerminator(
+                             LLVMGetIncomingBlock(inst, i)));
+          else
+            LLVMPositionBuilderBefore(builder, inst);
+          LLVMSetOperand(inst, i, build_struct(builder, operand));
+        }
+      }
+  LLVMDisposeBuilder(builder);
+}
+
+// the function an instruction or constant using a function is in, nullptr
+// for constants
+static LLVMValueRef user_function(LLVMValueRef user) {
+  if (!LLVMIsAInstruction(user))
+    return nullptr;
+  return LLVMGetBasicBlockParent(LLVMGetInstructionParent(user));
+}
+
+// the native engines, they live as long as the program
+static std::vector<LLVMExecutionEngineRef> native_engines;
+
+// JIT compiles the `native` functions of `clone`, a copy of `module` made
+// before its native functions were replaced by `declarations` (with the
+// names of the functions). The copy's global variables are the interpreter's
+static void compile_native(
+    LLVMModuleRef module, LLVMModuleRef clone,
+    std::unordered_set<LLVMValueRef> &native,
+    std::vector<std::pair<LLVMValueRef, std::string>> &declarations,
+    LLVMExecutionEngineRef interpreter) {
+  // the copy has its globals in the same order
+  std::vector<std::pair<LLVMValueRef, LLVMValueRef>> globals;
+  for (LLVMValueRef global = LLVMGetFirstGlobal(clone),
+                    original = LLVMGetFirstGlobal(module);
+       global; global = LLVMGetNextGlobal(global),
+                    original = LLVMGetNextGlobal(original))
+    if (LLVMGetInitializer(global))
+      globals.push_back({global, original});
+  for (const char *list : {"llvm.global_ctors", "llvm.global_dtors",
+                           "llvm.used", "llvm.compiler.used"})
+    if (LLVMValueRef global = LLVMGetNamedGlobal(clone, list)) {
+      std::erase_if(globals, [&](auto &pair) { return pair.first == global; });
+      LLVMDeleteGlobal(global);
+    }
+  // the interpreter's thread locals are plain global variables
+  for (size_t i = 0; i < globals.size(); i++) {
+    LLVMValueRef global = globals[i].first;
+    LLVMValueRef declaration =
+        LLVMAddGlobal(clone, LLVMGlobalGetValueType(global), "");
+    LLVMReplaceAllUsesWith(global, declaration);
+    // MCJIT maps globals by name
+    std::string name = LLVMGetValueName(global);
+    if (name.empty())
+      name = "fy.global." + std::to_string(i);
+    LLVMDeleteGlobal(global);
+    LLVMSetValueName2(declaration, name.c_str(), name.size());
+    globals[i].first = declaration;
+  }
+  // libffi calls them with the C calling convention, not e.g. fastcc
+  std::vector<LLVMValueRef> interpreted;
+  for (LLVMValueRef func = LLVMGetFirstFunction(clone); func;
+       func = LLVMGetNextFunction(func))
+    if (native.count(func)) {
+      LLVMSetLinkage(func, LLVMExternalLinkage);
+      LLVMSetFunctionCallConv(func, LLVMCCallConv);
+      for (LLVMUseRef use = LLVMGetFirstUse(func); use;
+           use = LLVMGetNextUse(use))
+        if (LLVMIsACallInst(LLVMGetUser(use)))
+          LLVMSetInstructionCallConv(LLVMGetUser(use), LLVMCCallConv);
+    } else if (LLVMGetFirstBasicBlock(func))
+      interpreted.push_back(func);
+  for (LLVMValueRef func : interpreted)
+    LLVMReplaceAllUsesWith(func, LLVMConstNull(LLVMTypeOf(func)));
+  for (LLVMValueRef func : interpreted)
+    LLVMDeleteFunction(func);
+
+  LLVMExecutionEngineRef engine;
+  char *err;
+  if (LLVMCreateJITCompilerForModule(&engine, clone, 0, &err)) {
+    std::string message = err;
+    LLVMDisposeMessage(err);
+    error("JIT Failed: " << message);
+  }
+  native_engines.push_back(engine);
+  for (auto &[declaration, original] : globals)
+    LLVMAddGlobalMapping(engine, declaration,
+                         LLVMGetPointerToGlobal(interpreter, original));
+  for (auto &[declaration, name] : declarations)
+    LLVMAddGlobalMapping(
+        interpreter, declaration,
+        (void *)LLVMGetFunctionAddress(engine, name.c_str()));
+}
+
+LLVMExecutionEngineRef create_interpreter(LLVMModuleRef module,
+                                          LLVMValueRef &main_function) {
+  // specializations and aliases need the JIT
+  if (LLVMGetNamedFunction(module, SPECIALIZE_HOOK) ||
+      LLVMGetFirstGlobalAlias(module))
+    return nullptr;
+  // splits loads and stores of structs and arrays into their elements
+  run_passes(module, "function(sroa,instcombine)", nullptr);
+  void_empty_returns(module);
+  wrap_var_arg_calls(module);
+  build_struct_constants(module);
+  std::vector<LLVMValueRef> funcs;
+  std::unordered_map<LLVMValueRef, FunctionInfo> infos;
+  for (LLVMValueRef func = LLVMGetFirstFunction(module); func;
+       func = LLVMGetNextFunction(func))
+    if (LLVMGetFirstBasicBlock(func)) {
+      funcs.push_back(func);
+      infos[func] = scan_function(func);
+    }
+  std::unordered_set<LLVMValueRef> native;
+  // makes `seed` native with everything it calls, and the callers of the
+  // ones libffi can't call, if none of them uses function pointers
+  auto try_native = [&](LLVMValueRef seed) {
+    std::unordered_set<LLVMValueRef> added;
+    std::vector<LLVMValueRef> stack = {seed};
+    while (!stack.empty()) {
+      LLVMValueRef func = stack.back();
+      stack.pop_back();
+      if (native.count(func) || !added.insert(func).second)
+        continue;
+      if (infos[func].uses_function_pointers)
+        return false;
+      stack.insert(stack.end(), infos[func].callees.begin(),
+                   infos[func].callees.end());
+      if (is_ffi_signature(func))
+        continue;
+      for (LLVMUseRef use = LLVMGetFirstUse(func); use;
+           use = LLVMGetNextUse(use)) {
+        LLVMValueRef user = user_function(LLVMGetUser(use));
+        if (!user)
+          return false;
+        stack.push_back(user);
+      }
+    }
+    native.insert(added.begin(), added.end());
+    return true;
+  };
+  for (LLVMValueRef func : funcs)
+    if (infos[func].needs_native && !native.count(func) && !try_native(func))
+      return nullptr;
+  if (options.interp == "auto")
+    for (LLVMValueRef func : funcs)
+      if (infos[func].has_loop && !native.count(func))
+        try_native(func);
+
+  LLVMModuleRef clone = native.empty() ? nullptr : LLVMCloneModule(module);
+  // the copies of the native functions, it has its functions in the same
+  // order
+  std::unordered_set<LLVMValueRef> native_copies;
+  if (clone)
+    for (LLVMValueRef func = LLVMGetFirstFunction(clone),
+                      original = LLVMGetFirstFunction(module);
+         func; func = LLVMGetNextFunction(func),
+                      original = LLVMGetNextFunction(original))
+      if (native.count(original))
+        native_copies.insert(func);
+  // stand-ins the interpreter calls through libffi, under names it doesn't
+  // find in the process first
+  std::vector<std::pair<LLVMValueRef, std::string>> declarations;
+  for (LLVMValueRef func : funcs)
+    if (native.count(func)) {
+      std::string name = LLVMGetValueName(func);
+      LLVMValueRef declaration = LLVMAddFunction(
+          module, ("fy.native." + name).c_str(), LLVMGlobalGetValueType(func));
+      LLVMReplaceAllUsesWith(func, declaration);
+      if (func == main_function)
+        main_function = declaration;
+      declarations.push_back({declaration, name});
+      LLVMDeleteFunction(func);
+    }
+  LLVMLinkInInterpreter();
+  LLVMExecutionEngineRef interpreter;
+  char *err;
+  if (LLVMCreateInterpreterForModule(&interpreter, module, &err)) {
+    std::string message = err;
+    LLVMDisposeMessage(err);
+    error("Interpreter Failed: " << message);
+  }
+  if (clone)
+    compile_native(module, clone, native_copies, declarations, interpreter);
+  return interpreter;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "utils.h"
+// Interpreted `fy run` (--interp), for scripts that finish before machine
+// code generation would. The program runs in LLVM's IR interpreter, which
+// calls C functions through libffi. Functions it can't run (inline assembly,
+// block addresses, atomics, array values and most intrinsics) are JIT
+// compiled with everything they call, and so are the functions with loops
+// with --interp=auto. Natively compiled functions can't call through
+// function pointers or take the address of a function, the interpreter's
+// function pointers aren't machine code.
+
+// an interpreter running `module` with its native functions, nullptr if
+// it has to be JIT compiled as a whole (e.g. it calls specialize()). It owns
+// `module` then, and `main_function` may be replaced by a native one
+LLVMExecutionEngineRef create_interpreter(LLVMModuleRef module,
+                                          LLVMValueRef &main_function);
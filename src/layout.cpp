@@ -0,0 +1,93 @@
+#include "layout.h"
+#include "options.h"
+#include <algorithm>
+#include <fstream>
+
+// share of the profiled samples that hot functions have to cover
+#define HOT_SAMPLE_SHARE 0.9
+
+// reads "<symbol> <count>" lines, other lines are ignored
+static std::unordered_map<std::string, uint64_t>
+read_profile(std::string path) {
+  std::ifstream file(path);
+  if (!file)
+    error("Can't open profile '" + path + "'");
+  std::unordered_map<std::string, uint64_t> counts;
+  std::string line;
+  while (std::getline(file, line)) {
+    size_t space = line.find_last_of(" \t");
+    if (space == std::string::npos)
+      continue;
+    try {
+      counts[line.substr(0, space)] += std::stoull(line.substr(space + 1));
+    } catch (std::exception &) {
+      continue; // header or comment line
+    }
+  }
+  return counts;
+}
+
+struct FuncHeat {
+  LLVMValueRef func;
+  std::string name;
+  uint64_t count;
+};
+
+void layout_functions(LLVMModuleRef module) {
+  std::unordered_map<std::string, uint64_t> profile;
+  if (!options.profile_path.empty())
+    profile = read_profile(options.profile_path);
+  std::vector<FuncHeat> hot, cold, profiled;
+  uint64_t total = 0;
+  for (LLVMValueRef func = LLVMGetFirstFunction(module); func;
+       func = LLVMGetNextFunction(func)) {
+    if (LLVMCountBasicBlocks(func) == 0)
+      continue; // declarations don't have code to place
+    std::string name = LLVMGetValueName(func);
+    // explicit flags take priority over the profile
+    if (has_function_attr(func, "cold"))
+      cold.push_back({func, name, 0});
+    else if (has_function_attr(func, "hot"))
+      hot.push_back({func, name, UINT64_MAX});
+    else if (!profile.empty()) {
+      uint64_t count = profile.count(name) ? profile[name] : 0;
+      if (count == 0)
+        cold.push_back({func, name, 0});
+      else
+        profiled.push_back({func, name, count});
+      total += count;
+    }
+  }
+  // hottest functions first, until they cover HOT_SAMPLE_SHARE of the samples
+  std::stable_sort(profiled.begin(), profiled.end(),
+                   [](auto &a, auto &b) { return a.count > b.count; });
+  uint64_t covered = 0;
+  for (auto &heat : profiled) {
+    if (covered >= total * HOT_SAMPLE_SHARE)
+      break;
+    covered += heat.count;
+    hot.push_back(heat);
+  }
+  std::stable_sort(hot.begin(), hot.end(),
+                   [](auto &a, auto &b) { return a.count > b.count; });
+  for (auto &heat : hot) {
+    LLVMSetSection(heat.func, (".text.hot." + heat.name).c_str());
+    if (!has_function_attr(heat.func, "hot"))
+      add_function_attr(heat.func, "hot");
+  }
+  for (auto &heat : cold) {
+    LLVMSetSection(heat.func, (".text.unlikely." + heat.name).c_str());
+    if (!has_function_attr(heat.func, "cold"))
+      add_function_attr(heat.func, "cold");
+  }
+  debug_log("Laid out " << hot.size() << " hot and " << cold.size()
+                        << " cold functions");
+  if (options.symbol_ordering_path.empty())
+    return;
+  std::ofstream ordering(options.symbol_ordering_path);
+  if (!ordering)
+    error("Can't write symbol ordering file '" + options.symbol_ordering_path +
+          "'");
+  for (auto &heat : hot)
+    ordering << heat.name << '\n';
+}
@@ -0,0 +1,5 @@
+#pragma once
+#include "utils.h"
+// hot/cold function layout, places hot functions in .text.hot.* and cold ones
+// in .text.unlikely.*, optionally writing a linker symbol ordering file.
+void layout_functions(LLVMModuleRef module);
@@ -1,16 +1,19 @@
 #include "lexer.h"
 #include <sstream>
 
-std::string
+thread_local std::string
     identifier_string; // [a-zA-Z][a-zA-Z0-9]* - Filled in if T_IDENTIFIER
-char char_value;       // '[^']' - Filled in if T_CHAR
-std::string num_value; // Filled in if T_NUMBER
-uint num_base;         // Filled in if T_NUMBER
-bool num_has_dot;      // Whether num_value contains '.' - Filled in if T_NUMBER
-char num_type;         // Type of number. 'd' => double, 'f' => float, 'i' =>
-                       // int32, 'u' => uint32, 'b' => byte/char/uint8
-std::string string_value; // "[^"]*" - Filled in if T_STRING
-StringType string_type; // Type of string. 'c' => C-string, otherwise char[len]
+thread_local char char_value;       // '[^']' - Filled in if T_CHAR
+thread_local std::string num_value; // Filled in if T_NUMBER
+thread_local uint num_base;         // Filled in if T_NUMBER
+thread_local bool
+    num_has_dot;              // Whether num_value contains '.' - if T_NUMBER
+thread_local char num_type;   // Type of number. 'd' => double, 'f' => float,
+                              // 'i' => int32, 'u' => uint32, 'b' => uint8
+thread_local bool num_has_suffix; // Whether num_type was given - if T_NUMBER
+thread_local std::string string_value; // "[^"]*" - Filled in if T_STRING
+thread_local StringType
+    string_type; // Type of string. 'c' => C-string, otherwise char[len]
 
 std::string token_to_str(const int token) {
   switch (token) {
@@ -23,7 +26,7 @@ std::string token_to_str(const int token) {
       return std::string(1, token);
   }
 }
-char last_char = ' ';
+thread_local char last_char = ' ';
 std::string read_str(bool (*predicate)(char)) {
   std::stringstream stream;
   stream << last_char;
@@ -86,8 +89,10 @@ int next_token() {
     return T_EOF;
   if (isalpha(last_char) || last_char == '_') {
     identifier_string = read_str(&is_alphaish);
-    if (Token keyword = keywords[identifier_string])
-      return keyword;
+    // find, not [], the keyword table is shared by all threads
+    auto keyword = keywords.find(identifier_string);
+    if (keyword != keywords.end())
+      return keyword->second;
     return T_IDENTIFIER;
   } else if (isdigit(last_char)) {
     // Number: [0-9]+.?[0-9]*
@@ -128,8 +133,10 @@ int next_token() {
     if (last_char == 'd' || last_char == 'l' || last_char == 'f' ||
         last_char == 'i' || last_char == 'u' || last_char == 'b') {
       num_type = last_char;
+      num_has_suffix = true;
       last_char = next_char();
     } else {
+      num_has_suffix = false;
       // if floating-point, default to double (float64)
       if (num_has_dot)
         num_type = 'd';
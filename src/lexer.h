@@ -2,21 +2,22 @@
 #include "reader.h"
 #include "utils.h"
 
-extern std::string
+extern thread_local std::string
     identifier_string;  // [a-zA-Z][a-zA-Z0-9]* - Filled in if T_IDENTIFIER
-extern char char_value; // '[^']' - Filled in if T_CHAR
-extern std::string num_value; // Filled in if T_NUMBER
-extern uint num_base;         // Filled in if T_NUMBER
-extern bool
+extern thread_local char char_value; // '[^']' - Filled in if T_CHAR
+extern thread_local std::string num_value; // Filled in if T_NUMBER
+extern thread_local uint num_base;         // Filled in if T_NUMBER
+extern thread_local bool
     num_has_dot;      // Whether num_value contains '.' - Filled in if T_NUMBER
-extern char num_type; // Type of number. 'd' => double, 'f' => float, 'i' =>
+extern thread_local char num_type; // Type of number. 'd' => double, 'f' => float, 'i' =>
                       // int32, 'u' => uint32, 'b' => byte/char/uint8
-extern std::string string_value; // "[^"]*" - Filled in if T_STRING
+extern thread_local bool num_has_suffix; // Whether num_type was given - Filled in if T_NUMBER
+extern thread_local std::string string_value; // "[^"]*" - Filled in if T_STRING
 enum StringType { C_STRING, CHAR_ARRAY, PTR_CHAR_ARRAY };
-extern StringType string_type; // Type of string
+extern thread_local StringType string_type; // Type of string
 
 std::string token_to_str(const int token);
-extern char last_char;
+extern thread_local char last_char;
 std::string read_str(bool (*predicate)(char));
 bool is_numish(char c);
 bool isnt_quot(char c);
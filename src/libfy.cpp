@@ -0,0 +1,221 @@
+#include "libfy.h"
+#include "compiler.h"
+#include "reader.h"
+#include "specialize.h"
+#include <memory>
+extern "C" {
+#include "llvm-c-14/llvm-c/LLJIT.h"
+}
+
+/// Source - a queued file, or in-memory source code if `in_memory` is set.
+struct Source {
+  std::string name;
+  std::string source;
+  bool in_memory;
+};
+
+/// SessionSpecializer - specializes the functions of one compile, into its
+/// JIT.
+class SessionSpecializer : public Specializer {
+  LLVMOrcThreadSafeContextRef ts_ctx = nullptr;
+  LLVMContextRef create_context() override {
+    ts_ctx = LLVMOrcCreateNewThreadSafeContext();
+    return LLVMOrcThreadSafeContextGetContext(ts_ctx);
+  }
+  void *add_module(LLVMModuleRef module, std::string name) override;
+
+public:
+  LLVMOrcLLJITRef jit = nullptr;
+  using Specializer::Specializer;
+};
+
+struct fy_session {
+  std::vector<Source> sources;
+  std::vector<std::string> include_paths;
+  // one JIT per compile, looked up newest first
+  std::vector<LLVMOrcLLJITRef> jits;
+  // the specializers of the compiles after fy_session_enable_specialize,
+  // in the same order
+  std::vector<std::unique_ptr<SessionSpecializer>> specializers;
+  bool specialize = false;
+  std::string error_message;
+  bool failed = false;
+};
+
+static int fail(fy_session *session, std::string message) {
+  session->error_message = message;
+  session->failed = true;
+  return 1;
+}
+static int fail(fy_session *session, LLVMErrorRef err) {
+  char *message = LLVMGetErrorMessage(err);
+  fail(session, message);
+  LLVMDisposeErrorMessage(message);
+  return 1;
+}
+
+fy_session *fy_session_create() { return new fy_session(); }
+void fy_session_destroy(fy_session *session) {
+  session->specializers.clear();
+  for (auto jit : session->jits)
+    if (LLVMErrorRef err = LLVMOrcDisposeLLJIT(jit))
+      LLVMConsumeError(err);
+  delete session;
+}
+
+void fy_session_add_file(fy_session *session, const char *path) {
+  session->sources.push_back({path, "", false});
+}
+void fy_session_add_source(fy_session *session, const char *name,
+                           const char *source) {
+  session->sources.push_back({name, source, true});
+}
+void fy_session_add_include_path(fy_session *session, const char *path) {
+  session->include_paths.push_back(path);
+}
+void fy_session_enable_specialize(fy_session *session) {
+  session->specialize = true;
+}
+
+// parses and generates the queued sources into a module in `ctx`, returns
+// nullptr and sets the session's error if compilation failed
+static LLVMModuleRef compile_sources(fy_session *session, LLVMContextRef ctx,
+                                     unsigned opt_level) {
+  LLVMModuleRef module = nullptr;
+  compile_on_new_thread([&] {
+    LLVMTargetMachineRef target_machine = nullptr;
+    try {
+      include_paths = session->include_paths;
+      target_machine = create_host_target_machine();
+      create_module("fy_session", ctx, target_machine);
+      for (auto &source : session->sources)
+        if (source.in_memory)
+          compile_source(source.name, source.source);
+        else
+          compile_file(source.name);
+      finish_module();
+      optimize_module(curr_module, target_machine, opt_level);
+      module = curr_module;
+    } catch (CompileError &err) {
+      fail(session, err.what());
+      if (curr_module)
+        LLVMDisposeModule(curr_module);
+    }
+    if (curr_builder)
+      LLVMDisposeBuilder(curr_builder);
+    if (target_data)
+      LLVMDisposeTargetData(target_data);
+    if (target_machine)
+      LLVMDisposeTargetMachine(target_machine);
+  });
+  session->sources.clear();
+  return module;
+}
+
+int fy_session_compile(fy_session *session, unsigned opt_level) {
+  session->failed = false;
+  LLVMOrcThreadSafeContextRef ts_ctx = LLVMOrcCreateNewThreadSafeContext();
+  LLVMModuleRef module = compile_sources(
+      session, LLVMOrcThreadSafeContextGetContext(ts_ctx), opt_level);
+  if (!module) {
+    LLVMOrcDisposeThreadSafeContext(ts_ctx);
+    return 1;
+  }
+  bool has_init = LLVMGetNamedFunction(module, "__fy_init__");
+  // keeps the module's IR, before the JIT takes it
+  std::unique_ptr<SessionSpecializer> specializer;
+  if (session->specialize)
+    specializer = std::make_unique<SessionSpecializer>(module, opt_level);
+  LLVMOrcThreadSafeModuleRef ts_module =
+      LLVMOrcCreateNewThreadSafeModule(module, ts_ctx);
+  // the module keeps the context alive from here on
+  LLVMOrcDisposeThreadSafeContext(ts_ctx);
+
+  LLVMOrcLLJITRef jit;
+  if (LLVMErrorRef err = LLVMOrcCreateLLJIT(&jit, nullptr)) {
+    LLVMOrcDisposeThreadSafeModule(ts_module);
+    return fail(session, err);
+  }
+  session->jits.push_back(jit);
+  if (specializer) {
+    specializer->jit = jit;
+    session->specializers.push_back(std::move(specializer));
+  }
+  LLVMOrcJITDylibRef dylib = LLVMOrcLLJITGetMainJITDylib(jit);
+  // resolve the C library (printf, malloc, ...) from the host process
+  LLVMOrcDefinitionGeneratorRef process_symbols;
+  if (LLVMErrorRef err = LLVMOrcCreateDynamicLibrarySearchGeneratorForProcess(
+          &process_symbols, LLVMOrcLLJITGetGlobalPrefix(jit), nullptr,
+          nullptr)) {
+    LLVMOrcDisposeThreadSafeModule(ts_module);
+    return fail(session, err);
+  }
+  LLVMOrcJITDylibAddGenerator(dylib, process_symbols);
+  if (LLVMErrorRef err = LLVMOrcLLJITAddLLVMIRModule(jit, dylib, ts_module))
+    return fail(session, err);
+  if (has_init) {
+    LLVMOrcExecutorAddress init;
+    if (LLVMErrorRef err = LLVMOrcLLJITLookup(jit, &init, "__fy_init__"))
+      return fail(session, err);
+    ((void (*)())init)();
+  }
+  return 0;
+}
+
+void *fy_session_lookup(fy_session *session, const char *name) {
+  session->failed = false;
+  for (auto jit = session->jits.rbegin(); jit != session->jits.rend(); jit++) {
+    LLVMOrcExecutorAddress address;
+    if (LLVMErrorRef err = LLVMOrcLLJITLookup(*jit, &address, name))
+      LLVMConsumeError(err);
+    else
+      return (void *)address;
+  }
+  fail(session, std::string("Symbol '") + name + "' not found");
+  return nullptr;
+}
+
+void *SessionSpecializer::add_module(LLVMModuleRef module, std::string name) {
+  LLVMOrcThreadSafeModuleRef ts_module =
+      LLVMOrcCreateNewThreadSafeModule(module, ts_ctx);
+  LLVMOrcDisposeThreadSafeContext(ts_ctx);
+  LLVMOrcExecutorAddress address;
+  LLVMErrorRef err = LLVMOrcLLJITAddLLVMIRModule(
+      jit, LLVMOrcLLJITGetMainJITDylib(jit), ts_module);
+  if (!err)
+    err = LLVMOrcLLJITLookup(jit, &address, name.c_str());
+  if (err) {
+    char *message = LLVMGetErrorMessage(err);
+    std::string message_str = message;
+    LLVMDisposeErrorMessage(message);
+    error(message_str);
+  }
+  return (void *)address;
+}
+
+void *fy_session_specialize(fy_session *session, const char *name,
+                            const fy_arg *args, unsigned count) {
+  session->failed = false;
+  std::vector<SpecializedArg> fixed;
+  for (unsigned i = 0; i < count; i++)
+    fixed.push_back({args[i].index, args[i].value});
+  for (auto specializer = session->specializers.rbegin();
+       specializer != session->specializers.rend(); specializer++)
+    if ((*specializer)->defines(name))
+      try {
+        return (*specializer)->specialize(name, fixed);
+      } catch (CompileError &err) {
+        fail(session, err.what());
+        return nullptr;
+      }
+  fail(session, std::string("Function '") + name +
+                    (session->specialize
+                         ? "' not found"
+                         : "' can't be specialized, specialization isn't "
+                           "enabled (fy_session_enable_specialize)"));
+  return nullptr;
+}
+
+const char *fy_session_error(fy_session *session) {
+  return session->failed ? session->error_message.c_str() : nullptr;
+}
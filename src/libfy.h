@@ -0,0 +1,61 @@
+#pragma once
+// libfy - compile fy source in-process and call it through an ORC JIT.
+//
+//   fy_session *session = fy_session_create();
+//   fy_session_add_include_path(session, "/usr/local/lib/fy");
+//   fy_session_add_source(session, "kernel.fy", source);
+//   if (fy_session_compile(session, 2) != 0)
+//     puts(fy_session_error(session));
+//   int (*kernel)(int) = fy_session_lookup(session, "kernel");
+//
+// Functions are exported with the always_compile(true) flag (or by being
+// main). Sessions share no state and may be used from different threads, one
+// thread per session at a time.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fy_session fy_session;
+
+fy_session *fy_session_create(void);
+// frees the session along with all the code it compiled
+void fy_session_destroy(fy_session *session);
+
+// queues a file or an in-memory source for the next compile, queued sources
+// are compiled into one module in the order they were added
+void fy_session_add_file(fy_session *session, const char *path);
+void fy_session_add_source(fy_session *session, const char *name,
+                           const char *source);
+// adds a directory to search for includes (e.g. fy's lib directory for std)
+void fy_session_add_include_path(fy_session *session, const char *path);
+
+// lets fy_session_specialize specialize the functions of the following
+// compiles. They keep a copy of their IR for it, so it's off by default
+void fy_session_enable_specialize(fy_session *session);
+
+// compiles the queued sources at optimization level 0-3 and adds them to the
+// JIT, global variables are initialized before it returns. Returns 0 on
+// success, otherwise the message is in fy_session_error
+int fy_session_compile(fy_session *session, unsigned opt_level);
+// address of a compiled function or global variable, NULL if there isn't one.
+// Newer compiles shadow older ones.
+void *fy_session_lookup(fy_session *session, const char *name);
+// an argument fixed by fy_session_specialize, `value` points to it in the
+// memory layout of the argument's type
+typedef struct fy_arg {
+  unsigned index;
+  const void *value;
+} fy_arg;
+// JIT compiles a copy of the function `name` with the arguments in `args`
+// fixed to their values, as constants the optimizer folds. It's called like
+// the function, ignoring the fixed arguments, and cached by their values.
+// NULL if it fails, e.g. if `name` wasn't compiled after
+// fy_session_enable_specialize
+void *fy_session_specialize(fy_session *session, const char *name,
+                            const fy_arg *args, unsigned count);
+// message of the last failed call, NULL if it succeeded
+const char *fy_session_error(fy_session *session);
+
+#ifdef __cplusplus
+}
+#endif
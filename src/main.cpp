@@ -1,217 +1,204 @@
-#include "parser.h"
-#include "ucr.h"
-#include "utils.h"
-#include <cstring>
+#include "bounds.h"
+#include "cache.h"
+#include "compiler.h"
+#include "hugepage.h"
+#include "icf.h"
+#include "interp.h"
+#include "options.h"
+#include "reader.h"
+#include "share.h"
+#include "specialize.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
-void handle_global_include() {
-  std::string file_name = parse_include();
-  debug_log("Parsed an include (" << file_name << ")");
-  size_t os_loc = file_name.find("{os}");
-  if (os_loc != std::string::npos) {
-    file_name = file_name.replace(os_loc, 4, os_name);
-    debug_log("Replaced {os} with '" << os_name << "'");
-  }
-  CharReader *curr_file = queue.back();
-  add_file_to_queue(curr_file->file_path, file_name);
-  eat(T_STRING);
-}
-
-void handle_toplevel();
-
-void handle_space() {
-  eat(T_SPACE);
-  auto id = identifier_string;
-  eat(T_IDENTIFIER);
-  eat('{');
-  push_space(id);
-  while (curr_token != '}')
-    handle_toplevel();
-  pop_space();
-  eat('}');
-}
+#define USAGE                                                                  \
+  "Usage: %s [run|com] (--flags) <filename> (output)\n"                        \
+  "       %s build (--flags) <output> <filenames...>\n"
 
-void handle_toplevel() {
-  switch (curr_token) {
-  case ';': // ignore top-level semicolons.
-    get_next_token();
-    break;
-  case T_SPACE:
-    handle_space();
-    break;
-  case T_FUNCTION:
-  case T_INLINE: {
-    auto ast = parse_definition();
-    debug_log("Parsed a function definition (name: " << ast->name << ")");
-    ast->add();
-    break;
-  }
-  case T_DECLARE: {
-    auto ast = parse_declare();
-    debug_log("Parsed a declare\n");
-    auto val = ast->gen_toplevel();
-    if (DEBUG && val)
-      LLVMDumpValue(val);
-    break;
-  }
-  case T_CONST:
-  case T_LET: {
-    auto ast = parse_let_expr();
-    debug_log("Parsed a global variable\n");
-    auto val = ast->gen_toplevel();
-    if (DEBUG)
-      LLVMDumpValue(val);
-    break;
-  }
-  case T_STRUCT: {
-    auto ast = parse_struct();
-    debug_log("Parsed a struct definition\n");
-    ast->gen_toplevel();
-    break;
-  }
-  case T_INCLUDE:
-    handle_global_include();
-    break;
-  case T_TYPE: {
-    auto ast = parse_type_definition();
-    debug_log("Parsed a type definition\n");
-    ast->gen_toplevel();
-    break;
-  }
-  case T_ASM: {
-    auto ast = parse_global_asm();
-    debug_log("Parsed global assembly");
-    ast->gen_toplevel();
-    break;
-  }
-  default:
-    error("Unexpected token '" + token_to_str(curr_token) + "' at top-level");
+// compiles each input as a unit of one program (see --units) in parallel and
+// links them, the objects are kept in <out>.objs/
+static void build(std::string out, std::vector<std::string> inputs) {
+  options.units = inputs;
+  std::string objects_dir = out + ".objs";
+  std::filesystem::create_directories(objects_dir);
+  std::vector<std::string> objects;
+  for (auto input : inputs) {
+    if (input.ends_with(".fy"))
+      input.resize(input.size() - 3);
+    std::replace(input.begin(), input.end(), '/', '_');
+    objects.push_back(objects_dir + "/" + input + ".o");
   }
+  std::atomic<size_t> next_unit = 0;
+  std::atomic<bool> failed = false;
+  std::mutex error_lock;
+  Options build_options = options;
+  bool debug = DEBUG;
+  std::vector<std::string> build_include_paths = include_paths;
+  auto compile_units = [&] {
+    options = build_options;
+    DEBUG = debug;
+    include_paths = build_include_paths;
+    for (size_t i; (i = next_unit++) < inputs.size();) {
+      try {
+        // every unit gets its own thread (and so its own compiler state)
+        compile_on_new_thread([&] {
+          LLVMTargetMachineRef target_machine = create_host_target_machine();
+          LLVMContextRef ctx = LLVMContextCreate();
+          create_module(inputs[i], ctx, target_machine);
+          compile_file(inputs[i]);
+          finish_module();
+          optimize_module(curr_module, target_machine, options.opt_level);
+          emit_module(curr_module, target_machine, objects[i]);
+          LLVMDisposeBuilder(curr_builder);
+          LLVMDisposeModule(curr_module);
+          LLVMContextDispose(ctx);
+          LLVMDisposeTargetData(target_data);
+          LLVMDisposeTargetMachine(target_machine);
+        });
+      } catch (CompileError &err) {
+        std::lock_guard<std::mutex> guard(error_lock);
+        std::cerr << "Error: " << inputs[i] << ": " << err.what() << std::endl;
+        failed = true;
+      }
+    }
+  };
+  unsigned jobs =
+      options.jobs ? options.jobs : std::thread::hardware_concurrency();
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < std::max(jobs, 1u) && i < inputs.size(); i++)
+    workers.emplace_back(compile_units);
+  for (auto &worker : workers)
+    worker.join();
+  if (failed)
+    error("Couldn't compile all units of " << out);
+  const char *cc = getenv("CC");
+  std::vector<std::string> link = {cc ? cc : "cc", "-no-pie", "-o", out};
+  // every function is in its own section for the linker to fold
+  if (!options.icf.empty())
+    link.insert(link.end(), {"-fuse-ld=gold", "-Wl,--icf=" + options.icf});
+  if (options.hugepage_text)
+    link.insert(link.end(), hugepage_link_flags.begin(),
+                hugepage_link_flags.end());
+  link.insert(link.end(), objects.begin(), objects.end());
+  if (!run_command(link))
+    error("Linking " << out << " failed");
 }
 
-void main_loop() {
-  get_next_token();
-  while (1) {
-    if (curr_token == T_EOF)
-      break;
-    handle_toplevel();
+static void print_stats(bool quiet) {
+  if (!quiet && !options.cache_dir.empty())
+    std::cout << "[fy] Function cache: " << cache_hits << " hits, "
+              << cache_misses << " misses" << std::endl;
+  if (!quiet && options.stats)
+    std::cout << "[fy] Shared generic instances: " << shared_instances
+              << " bodies, " << shared_instructions
+              << " IR instructions saved" << std::endl;
+  if (!quiet && options.stats && !options.icf.empty())
+    std::cout << "[fy] Folded functions: " << merged_functions << ", "
+              << merged_instructions << " IR instructions saved" << std::endl;
+  if (!quiet && options.stats && options.bounds_check) {
+    std::cout << "[fy] Bounds checks: " << removed_bounds_checks << " of "
+              << bounds_checks << " removed" << std::endl;
+    for (auto &[func, left] : remaining_bounds_checks)
+      std::cout << "[fy]   " << func << ": " << left << " left" << std::endl;
   }
 }
 
-std::string get_os(std::string triple) {
-  // triple: "x86_64-unknown-linux-gnu"
-  // slice away first two parts, triple: "linux-gnu"
-  size_t start = triple.find('-', triple.find('-') + 1) + 1;
-  // slice away last part, triple: "linux"
-  return triple.substr(start, triple.find('-', start) - start);
-}
-
 int main(int argc, char **argv, char **envp) {
-  if (argc < 2) {
-    printf("Usage: %s [run|com] <filename> (output)\n", argv[0]);
+  if (argc < 3) {
+    printf(USAGE, argv[0], argv[0]);
     return 1;
   }
-  char *input = argv[2];
   std::string mode_str = argv[1];
-  enum { COMPILE, RUN } mode;
+  enum { COMPILE, RUN, BUILD } mode;
   if (mode_str == "run")
     mode = RUN;
   else if (mode_str == "com")
     mode = COMPILE;
+  else if (mode_str == "build")
+    mode = BUILD;
   else {
-    printf("Usage: %s [run|com] <filename> (output)\n", argv[0]);
+    printf(USAGE, argv[0], argv[0]);
     return 1;
   }
+  try {
+    // flags go between the mode and the filename
+    int arg_i = 2;
+    for (; arg_i < argc && argv[arg_i][0] == '-'; arg_i++)
+      if (!parse_option(argv[arg_i]))
+        error("Unknown flag: " << argv[arg_i]);
+    if (arg_i >= argc)
+      error("No input file given");
+    char *input = argv[arg_i];
 
-  if (getenv("DEBUG"))
-    DEBUG = true;
-  bool QUIET = getenv("QUIET");
-  std_dir = get_executable_path().append("../lib").string();
-  // host machine triple
-  char *target_triple = LLVMGetDefaultTargetTriple();
-  LLVMTargetRef target;
-  char *error_message;
-  LLVMInitializeNativeTarget();
-  if (LLVMGetTargetFromTriple(target_triple, &target, &error_message) != 0)
-    error(error_message);
-  os_name = get_os(target_triple);
-  char *host_cpu_name = LLVMGetHostCPUName();
-  char *host_cpu_features = LLVMGetHostCPUFeatures();
-  LLVMTargetMachineRef target_machine = LLVMCreateTargetMachine(
-      target, target_triple, host_cpu_name, host_cpu_features,
-      LLVMCodeGenLevelAggressive, LLVMRelocStatic, LLVMCodeModelSmall);
-  target_data = LLVMCreateTargetDataLayout(target_machine);
-  // create module
-  curr_module = LLVMModuleCreateWithName(input);
-  // set target to current machine
-  LLVMSetTarget(curr_module, target_triple);
-  LLVMSetModuleDataLayout(curr_module, target_data);
-  // create builder, context, and pass manager (for optimization)
-  curr_builder = LLVMCreateBuilder();
-  curr_ctx = LLVMGetGlobalContext();
-  // open .fy file
-  add_file_to_queue(".", input);
-  // parse and compile everything into LLVM IR
-  main_loop();
-  auto main_func = curr_scope->get_function("main");
-  LLVMValueRef main_function =
-      main_func ? main_func->gen_ptr()->gen_val() : nullptr;
-  std::vector<LLVMValueRef> entry_functions;
-  if (main_function)
-    entry_functions.push_back(main_function);
-  for (auto func : always_compile_functions)
-    entry_functions.push_back(func->gen_ptr()->gen_val());
-  if (!getenv("NO_UCR") && entry_functions.size() > 0)
-    remove_unused_globals(curr_module, entry_functions);
-  if (main_function)
-    add_stores_before_main(main_function);
-  if (mode == COMPILE) {
-    std::string out = argv[3];
-    size_t ext_pos = out.rfind('.');
-    size_t slash_pos = out.rfind('/');
-    std::string ext = ext_pos == std::string::npos || slash_pos > ext_pos
-                          ? "ll" // default to LLVM IR
-                          : out.substr(ext_pos + 1);
-    char *err = nullptr;
-    // export LLVM IR into other file
-    if (ext == "bc")
-      LLVMWriteBitcodeToFile(curr_module, out.c_str());
-    else if (ext == "asm")
-      LLVMTargetMachineEmitToFile(target_machine, curr_module,
-                                  strdup(out.c_str()), LLVMAssemblyFile, &err);
-    else if (ext == "o")
-      LLVMTargetMachineEmitToFile(target_machine, curr_module,
-                                  strdup(out.c_str()), LLVMObjectFile, &err);
-    else if (ext == "ll")
-      LLVMPrintModuleToFile(curr_module, out.c_str(), &err);
-    else
-      error("Unknown file extension: " + ext);
-
-    if (err)
-      error(err);
-    if (!QUIET)
-      std::cout << "\n\033[32m[fy] Successfully compiled " << input << " to "
-                << out << "\n\033[0m" << std::endl;
-    return 0;
-  } else if (mode == RUN) {
-    if (!main_function)
-      error("No main function found, cannot run");
-    LLVMInitializeNativeAsmPrinter();
-    LLVMInitializeNativeAsmParser();
-    LLVMLinkInMCJIT();
-    LLVMExecutionEngineRef engine;
-    char *err;
-    bool errored =
-        LLVMCreateJITCompilerForModule(&engine, curr_module, 0, &err);
-    if (errored)
-      error(std::string("JIT Failed: ") + err);
-    int nargc = argc - 2;
-    char **nargv = argv + 2;
-    int exit_code =
-        LLVMRunFunctionAsMain(engine, main_function, nargc, nargv, envp);
-    if (!QUIET)
-      std::cout << "\n\033[32m[fy] Executed with exit code " << exit_code
-                << "\n\033[0m" << std::endl;
-    return exit_code;
+    if (getenv("DEBUG"))
+      DEBUG = true;
+    bool QUIET = getenv("QUIET");
+    include_paths.push_back(get_executable_path().append("../lib").string());
+    if (mode == BUILD) {
+      if (arg_i + 1 >= argc)
+        error("No input files given");
+      std::string out = argv[arg_i];
+      build(out, std::vector<std::string>(argv + arg_i + 1, argv + argc));
+      if (!QUIET)
+        std::cout << "\n\033[32m[fy] Successfully built " << out
+                  << "\n\033[0m" << std::endl;
+      print_stats(QUIET);
+      return 0;
+    }
+    options.run_specialize = mode == RUN;
+    // JIT compiled code isn't in the text of an executable
+    if (mode == RUN)
+      options.hugepage_text = false;
+    LLVMTargetMachineRef target_machine = create_host_target_machine();
+    create_module(input, LLVMGetGlobalContext(), target_machine);
+    // parse and compile everything into LLVM IR
+    compile_file(input);
+    LLVMValueRef main_function = finish_module();
+    optimize_module(curr_module, target_machine, options.opt_level);
+    if (mode == COMPILE) {
+      if (arg_i + 1 >= argc)
+        error("No output file given");
+      std::string out = argv[arg_i + 1];
+      emit_module(curr_module, target_machine, out);
+      if (!QUIET)
+        std::cout << "\n\033[32m[fy] Successfully compiled " << input << " to "
+                  << out << "\n\033[0m" << std::endl;
+      print_stats(QUIET);
+      return 0;
+    } else if (mode == RUN) {
+      if (!main_function)
+        error("No main function found, cannot run");
+      LLVMLinkInMCJIT();
+      prepare_run_specializer(curr_module, options.opt_level);
+      LLVMExecutionEngineRef engine =
+          options.interp.empty()
+              ? nullptr
+              : create_interpreter(curr_module, main_function);
+      if (!engine) {
+        char *err;
+        bool errored =
+            LLVMCreateJITCompilerForModule(&engine, curr_module, 0, &err);
+        if (errored)
+          error(std::string("JIT Failed: ") + err);
+        start_run_specializer(curr_module, engine);
+      }
+      print_stats(QUIET);
+      int nargc = argc - arg_i;
+      char **nargv = argv + arg_i;
+      int exit_code =
+          LLVMRunFunctionAsMain(engine, main_function, nargc, nargv, envp);
+      // e.g. the memoize statistics
+      LLVMRunStaticDestructors(engine);
+      if (!QUIET)
+        std::cout << "\n\033[32m[fy] Executed with exit code " << exit_code
+                  << "\n\033[0m" << std::endl;
+      return exit_code;
+    }
+    error("Unreachable");
+  } catch (CompileError &err) {
+    std::cerr << "Error: " << err.what() << std::endl;
+    return 1;
   }
-  error("Unreachable");
-}
\ No newline at end of file
+}
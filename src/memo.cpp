@@ -0,0 +1,224 @@
+#include "memo.h"
+#include "options.h"
+#include <cstring>
+
+#define CACHE_PREFIX "fy.memo."
+#define STATS_PREFIX "fy.memo_stats."
+
+// appends the 64-bit words holding the bits of `value` to `words`
+static void gen_words(LLVMValueRef value, std::vector<LLVMValueRef> &words) {
+  LLVMTypeRef type = LLVMTypeOf(value);
+  LLVMTypeRef i64 = LLVMInt64TypeInContext(curr_ctx);
+  switch (LLVMGetTypeKind(type)) {
+  case LLVMIntegerTypeKind: {
+    unsigned width = LLVMGetIntTypeWidth(type);
+    for (unsigned low = 0; low < width; low += 64) {
+      LLVMValueRef part =
+          low ? LLVMBuildLShr(curr_builder, value,
+                              LLVMConstInt(type, low, false), UN)
+              : value;
+      words.push_back(LLVMBuildZExtOrBitCast(
+          curr_builder,
+          width > 64 ? LLVMBuildTrunc(curr_builder, part, i64, UN) : part, i64,
+          UN));
+    }
+    break;
+  }
+  case LLVMHalfTypeKind:
+  case LLVMFloatTypeKind:
+  case LLVMDoubleTypeKind:
+  case LLVMX86_FP80TypeKind:
+  case LLVMFP128TypeKind: {
+    unsigned width = LLVMSizeOfTypeInBits(target_data, type);
+    gen_words(LLVMBuildBitCast(curr_builder, value,
+                               LLVMIntTypeInContext(curr_ctx, width), UN),
+              words);
+    break;
+  }
+  case LLVMPointerTypeKind:
+    words.push_back(LLVMBuildPtrToInt(curr_builder, value, i64, UN));
+    break;
+  case LLVMStructTypeKind:
+    for (unsigned i = 0; i < LLVMCountStructElementTypes(type); i++)
+      gen_words(LLVMBuildExtractValue(curr_builder, value, i, UN), words);
+    break;
+  case LLVMArrayTypeKind:
+    for (unsigned i = 0; i < LLVMGetArrayLength(type); i++)
+      gen_words(LLVMBuildExtractValue(curr_builder, value, i, UN), words);
+    break;
+  case LLVMVectorTypeKind:
+    for (unsigned i = 0; i < LLVMGetVectorSize(type); i++)
+      gen_words(LLVMBuildExtractElement(
+                    curr_builder, value,
+                    LLVMConstInt(LLVMInt32TypeInContext(curr_ctx), i, false),
+                    UN),
+                words);
+    break;
+  default:
+    error("memoize can't compare arguments of LLVM type "
+          << LLVMPrintTypeToString(type) << ".");
+  }
+}
+
+static LLVMValueRef field_ptr(LLVMValueRef entry, unsigned field) {
+  return LLVMBuildStructGEP2(
+      curr_builder, LLVMGetElementType(LLVMTypeOf(entry)), entry, field, UN);
+}
+// counts a hit (0) or a miss (1) with --stats
+static void gen_count(LLVMValueRef counters, unsigned counter) {
+  if (!counters)
+    return;
+  LLVMTypeRef i64 = LLVMInt64TypeInContext(curr_ctx);
+  LLVMValueRef indices[] = {LLVMConstInt(i64, 0, false),
+                            LLVMConstInt(i64, counter, false)};
+  LLVMBuildAtomicRMW(
+      curr_builder, LLVMAtomicRMWBinOpAdd,
+      LLVMBuildInBoundsGEP2(curr_builder, LLVMArrayType(i64, 2), counters,
+                            indices, 2, UN),
+      LLVMConstInt(i64, 1, false), LLVMAtomicOrderingMonotonic, false);
+}
+
+MemoCall gen_memo_lookup(LLVMValueRef func, std::vector<LLVMValueRef> args,
+                         LLVMTypeRef result_type, unsigned capacity,
+                         bool per_thread, LLVMBasicBlockRef ret_block,
+                         LLVMValueRef ret_phi) {
+  std::string name = LLVMGetValueName(func);
+  LLVMTypeRef i64 = LLVMInt64TypeInContext(curr_ctx);
+  // an entry is {valid, args..., result}
+  std::vector<LLVMTypeRef> fields{LLVMInt1TypeInContext(curr_ctx)};
+  for (LLVMValueRef arg : args)
+    fields.push_back(LLVMTypeOf(arg));
+  fields.push_back(result_type);
+  LLVMTypeRef entry_type =
+      LLVMStructTypeInContext(curr_ctx, fields.data(), fields.size(), false);
+  LLVMTypeRef cache_type = LLVMArrayType(entry_type, capacity);
+  LLVMValueRef cache =
+      LLVMAddGlobal(curr_module, cache_type, (CACHE_PREFIX + name).c_str());
+  LLVMSetLinkage(cache, LLVMPrivateLinkage);
+  LLVMSetInitializer(cache, LLVMConstNull(cache_type));
+  LLVMSetThreadLocal(cache, per_thread);
+  MemoCall call{nullptr, args, nullptr, nullptr, nullptr};
+  if (options.stats) {
+    LLVMTypeRef counters_type = LLVMArrayType(i64, 2);
+    call.counters = LLVMAddGlobal(curr_module, counters_type,
+                                  (STATS_PREFIX + name).c_str());
+    LLVMSetLinkage(call.counters, LLVMPrivateLinkage);
+    LLVMSetInitializer(call.counters, LLVMConstNull(counters_type));
+  }
+
+  // FNV-1a over the words of the arguments, the high bits folded in
+  std::vector<LLVMValueRef> words;
+  for (LLVMValueRef arg : args)
+    gen_words(arg, words);
+  LLVMValueRef hash = LLVMConstInt(i64, 0xcbf29ce484222325, false);
+  for (LLVMValueRef word : words)
+    hash = LLVMBuildMul(curr_builder,
+                        LLVMBuildXor(curr_builder, hash, word, UN),
+                        LLVMConstInt(i64, 0x100000001b3, false), UN);
+  hash = LLVMBuildXor(
+      curr_builder, hash,
+      LLVMBuildLShr(curr_builder, hash, LLVMConstInt(i64, 32, false), UN), UN);
+  LLVMValueRef indices[] = {
+      LLVMConstInt(i64, 0, false),
+      LLVMBuildURem(curr_builder, hash, LLVMConstInt(i64, capacity, false),
+                    UN)};
+  call.entry = LLVMBuildInBoundsGEP2(curr_builder, cache_type, cache, indices,
+                                     2, ("memo_" + name).c_str());
+
+  // a hit needs a valid entry with the same bits in every argument
+  LLVMValueRef hit = LLVMBuildLoad2(curr_builder, fields[0],
+                                    field_ptr(call.entry, 0), UN);
+  std::vector<LLVMValueRef> cached_words;
+  for (size_t i = 0; i < args.size(); i++)
+    gen_words(LLVMBuildLoad2(curr_builder, fields[i + 1],
+                             field_ptr(call.entry, i + 1), UN),
+              cached_words);
+  for (size_t i = 0; i < words.size(); i++)
+    hit = LLVMBuildAnd(curr_builder, hit,
+                       LLVMBuildICmp(curr_builder, LLVMIntEQ, words[i],
+                                     cached_words[i], UN),
+                       UN);
+  LLVMBasicBlockRef hit_block = LLVMAppendBasicBlockInContext(
+      curr_ctx, func, ("memo_hit_" + name).c_str());
+  LLVMBasicBlockRef miss_block = LLVMAppendBasicBlockInContext(
+      curr_ctx, func, ("memo_miss_" + name).c_str());
+  LLVMBuildCondBr(curr_builder, hit, hit_block, miss_block);
+
+  LLVMPositionBuilderAtEnd(curr_builder, hit_block);
+  gen_count(call.counters, 0);
+  LLVMValueRef cached =
+      LLVMBuildLoad2(curr_builder, result_type,
+                     field_ptr(call.entry, args.size() + 1), "cached");
+  LLVMBuildBr(curr_builder, ret_block);
+  LLVMAddIncoming(ret_phi, &cached, &hit_block, 1);
+
+  call.store_block = LLVMAppendBasicBlockInContext(
+      curr_ctx, func, ("memo_store_" + name).c_str());
+  LLVMPositionBuilderAtEnd(curr_builder, call.store_block);
+  call.result_phi = LLVMBuildPhi(curr_builder, result_type, "result");
+  LLVMPositionBuilderAtEnd(curr_builder, miss_block);
+  gen_count(call.counters, 1);
+  return call;
+}
+
+void gen_memo_store(MemoCall &call, LLVMBasicBlockRef ret_block,
+                    LLVMValueRef ret_phi) {
+  LLVMMoveBasicBlockAfter(call.store_block, LLVMGetInsertBlock(curr_builder));
+  LLVMPositionBuilderAtEnd(curr_builder, call.store_block);
+  for (size_t i = 0; i < call.args.size(); i++)
+    LLVMBuildStore(curr_builder, call.args[i], field_ptr(call.entry, i + 1));
+  LLVMBuildStore(curr_builder, call.result_phi,
+                 field_ptr(call.entry, call.args.size() + 1));
+  LLVMBuildStore(curr_builder,
+                 LLVMConstInt(LLVMInt1TypeInContext(curr_ctx), 1, false),
+                 field_ptr(call.entry, 0));
+  LLVMBuildBr(curr_builder, ret_block);
+  LLVMAddIncoming(ret_phi, &call.result_phi, &call.store_block, 1);
+}
+
+LLVMValueRef gen_memo_stats(LLVMModuleRef module) {
+  std::vector<LLVMValueRef> counters;
+  for (LLVMValueRef global = LLVMGetFirstGlobal(module); global;
+       global = LLVMGetNextGlobal(global))
+    if (!strncmp(LLVMGetValueName(global), STATS_PREFIX, strlen(STATS_PREFIX)))
+      counters.push_back(global);
+  if (counters.empty())
+    return nullptr;
+  LLVMTypeRef i32 = LLVMInt32TypeInContext(curr_ctx);
+  LLVMTypeRef i64 = LLVMInt64TypeInContext(curr_ctx);
+  LLVMTypeRef i8_ptr = LLVMPointerType(LLVMInt8TypeInContext(curr_ctx), 0);
+  LLVMTypeRef printf_type = LLVMFunctionType(i32, &i8_ptr, 1, true);
+  LLVMValueRef printf_func = LLVMGetNamedFunction(module, "printf");
+  if (!printf_func)
+    printf_func = LLVMAddFunction(module, "printf", printf_type);
+  // the program may have declared it with other argument types
+  printf_func =
+      LLVMConstBitCast(printf_func, LLVMPointerType(printf_type, 0));
+  LLVMValueRef printer = LLVMAddFunction(
+      module, "fy.memo_stats",
+      LLVMFunctionType(LLVMVoidTypeInContext(curr_ctx), nullptr, 0, false));
+  LLVMSetLinkage(printer, LLVMInternalLinkage);
+  LLVMPositionBuilderAtEnd(
+      curr_builder, LLVMAppendBasicBlockInContext(curr_ctx, printer, ""));
+  for (LLVMValueRef global : counters) {
+    std::string format = "[fy] Memoized " +
+                         std::string(LLVMGetValueName(global) +
+                                     strlen(STATS_PREFIX)) +
+                         ": %llu hits, %llu misses\n";
+    LLVMValueRef args[] = {
+        LLVMBuildGlobalStringPtr(curr_builder, format.c_str(), UN), nullptr,
+        nullptr};
+    for (unsigned i = 0; i < 2; i++) {
+      LLVMValueRef indices[] = {LLVMConstInt(i64, 0, false),
+                                LLVMConstInt(i64, i, false)};
+      args[i + 1] = LLVMBuildLoad2(
+          curr_builder, i64,
+          LLVMBuildInBoundsGEP2(curr_builder, LLVMArrayType(i64, 2), global,
+                                indices, 2, UN),
+          UN);
+    }
+    LLVMBuildCall2(curr_builder, printf_type, printf_func, args, 3, UN);
+  }
+  LLVMBuildRetVoid(curr_builder);
+  return printer;
+}
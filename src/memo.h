@@ -0,0 +1,38 @@
+#pragma once
+#include "utils.h"
+// Result caches of memoized functions, `memoize(N)` and `shared_memoize(N)`.
+// A call looks its arguments up in a direct-mapped cache of N entries before
+// running the body, and a computed result replaces the entry. Arguments are
+// hashed and compared by the bits of their fields, so arguments with data
+// pointers are rejected: a pointer would match by address, even after what
+// it points to changed. Function pointers are fine. memoize(N) gives every
+// thread its own cache, the one of shared_memoize(N) is shared by every
+// thread and only safe in single-threaded programs, a racing thread can read
+// an entry that's half written.
+
+/// MemoCall - the cache entry of the arguments of a memoized function.
+/// Returns from the body go to `store_block` with the result in
+/// `result_phi`, which stores it in the entry.
+struct MemoCall {
+  LLVMValueRef entry;
+  std::vector<LLVMValueRef> args;
+  // hits and misses with --stats, nullptr otherwise
+  LLVMValueRef counters;
+  LLVMBasicBlockRef store_block;
+  LLVMValueRef result_phi;
+};
+
+// looks up `args` in the cache of `func` (`capacity` entries). A hit returns
+// the cached result through `ret_phi` in `ret_block`, the builder continues
+// in the block that computes the result.
+MemoCall gen_memo_lookup(LLVMValueRef func, std::vector<LLVMValueRef> args,
+                         LLVMTypeRef result_type, unsigned capacity,
+                         bool per_thread, LLVMBasicBlockRef ret_block,
+                         LLVMValueRef ret_phi);
+// generates `call.store_block` after the current block, it stores the result
+// and returns it through `ret_phi` in `ret_block`
+void gen_memo_store(MemoCall &call, LLVMBasicBlockRef ret_block,
+                    LLVMValueRef ret_phi);
+// with --stats, generates a function that prints the hits and misses of the
+// memoized functions in `module`, nullptr if there aren't any
+LLVMValueRef gen_memo_stats(LLVMModuleRef module);
@@ -0,0 +1,84 @@
+#include "options.h"
+
+thread_local Options options;
+
+bool Options::set_by_string(std::string name, std::string value) {
+  if (name == "opt") {
+    if (value.size() != 1 || value[0] < '0' || value[0] > '3')
+      return false;
+    opt_level = value[0] - '0';
+  } else if (name == "units") {
+    units.clear();
+    for (size_t start = 0; start <= value.size();) {
+      size_t comma = value.find(',', start);
+      if (comma == std::string::npos)
+        comma = value.size();
+      units.push_back(value.substr(start, comma - start));
+      start = comma + 1;
+    }
+  } else if (name == "jobs") {
+    try {
+      jobs = std::stoul(value);
+    } catch (std::exception &) {
+      return false;
+    }
+  } else if (name == "codegen-jobs") {
+    try {
+      codegen_jobs = std::stoul(value);
+    } catch (std::exception &) {
+      return false;
+    }
+  } else if (name == "cache-size") {
+    try {
+      cache_size = std::stoul(value);
+    } catch (std::exception &) {
+      return false;
+    }
+  } else if (name == "cache-dir")
+    cache_dir = value;
+  else if (name == "thinlto")
+    thinlto = value == "true";
+  else if (name == "emit") {
+    if (value != "fir")
+      return false;
+    emit = value;
+  } else if (name == "profile")
+    profile_path = value;
+  else if (name == "symbol-ordering-file")
+    symbol_ordering_path = value;
+  else if (name == "icf") {
+    if (value == "true")
+      value = "all";
+    if (value != "all" && value != "safe")
+      return false;
+    icf = value;
+  } else if (name == "interp") {
+    if (value == "true")
+      value = "all";
+    if (value != "all" && value != "auto")
+      return false;
+    interp = value;
+  } else if (name == "lean")
+    lean = value == "true";
+  else if (name == "stats")
+    stats = value == "true";
+  else if (name == "bounds-check")
+    bounds_check = value == "true";
+  else if (name == "hugepage-text")
+    hugepage_text = value == "true";
+  else
+    return false;
+  return true;
+}
+
+bool parse_option(std::string arg) {
+  if (arg.starts_with("-O"))
+    return options.set_by_string("opt", arg.substr(2));
+  if (!arg.starts_with("--"))
+    return false;
+  arg = arg.substr(2);
+  size_t eq_pos = arg.find('=');
+  if (eq_pos == std::string::npos)
+    return options.set_by_string(arg, "true");
+  return options.set_by_string(arg.substr(0, eq_pos), arg.substr(eq_pos + 1));
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/// Options - compiler options set from `--name(=value)` command line flags.
+struct Options {
+  // --opt=<0-3> or -O<0-3>, LLVM optimization pipeline to run
+  unsigned opt_level = 0;
+  // --units=<a.fy,b.fy,...>, compile the input as one of these separately
+  // compiled units of a program
+  std::vector<std::string> units;
+  // --jobs=<n>, units `fy build` compiles in parallel, 0 for one per core
+  unsigned jobs = 0;
+  // --codegen-jobs=<n>, threads generating the function bodies of a module
+  unsigned codegen_jobs = 1;
+  // --thinlto, .bc output carries a ThinLTO summary for cross-language LTO
+  bool thinlto = false;
+  // --cache-dir=<dir>, per-function object cache for .o output
+  std::string cache_dir;
+  // --cache-size=<MiB>, the cache drops least recently used objects above it
+  unsigned cache_size = 1024;
+  // --emit=fir, write a FIR dump (see fir.h) instead of the output format of
+  // the output file's extension
+  std::string emit;
+  // --profile=<file>, "<symbol> <count>" lines (e.g. from `perf report`)
+  std::string profile_path;
+  // --symbol-ordering-file=<file>, hot functions in link order for the linker
+  std::string symbol_ordering_path;
+  // --icf=<all|safe>, fold identical functions, safe keeps the addresses of
+  // functions whose address is taken distinct. --icf means all
+  std::string icf;
+  // --lean, leaner IR for fast -O0 builds: unnamed values, reused loads,
+  // one condition block per loop and no unreachable blocks. At -O0 the
+  // backend doesn't optimize either
+  bool lean = false;
+  // --stats, print what the module-level passes saved
+  bool stats = false;
+  // --bounds-check, trap on out of bounds indexes of arrays and
+  // __bounds_check__, see bounds.h
+  bool bounds_check = false;
+  // --hugepage-text, main remaps the text to transparent huge pages and
+  // `fy build` aligns it for them, see hugepage.h
+  bool hugepage_text = false;
+  // --interp=<all|auto>, `fy run` runs the program in LLVM's interpreter,
+  // auto JIT compiles the functions with loops. --interp means all, see
+  // interp.h
+  std::string interp;
+  // set by `fy run`, specialize() JIT compiles its specializations instead of
+  // returning the function itself, see specialize.h
+  bool run_specialize = false;
+  bool set_by_string(std::string name, std::string value);
+};
+extern thread_local Options options;
+
+// parses "--name=value", "--name" or "-O<level>", returns false if it isn't
+// a known flag
+bool parse_option(std::string arg);
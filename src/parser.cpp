@@ -1,6 +1,6 @@
 #include "parser.h"
 
-int curr_token;
+thread_local int curr_token;
 int get_next_token() { return curr_token = next_token(); }
 void eat(const int expected_token) {
   if (curr_token != expected_token)
@@ -207,7 +207,7 @@ TypeAST *parse_type_postfix() {
       break;
     }
     case '|': {
-      static bool pass = false;
+      static thread_local bool pass = false;
       if (pass)
         return prev;
       eat('|');
@@ -240,6 +240,7 @@ TypeAST *parse_type_unary() {
 }
 NumberExprAST *parse_number_expr() {
   auto result = new NumberExprAST(num_value, num_type, num_has_dot, num_base);
+  result->untyped = !num_has_suffix;
   eat(T_NUMBER);
   return result;
 }
@@ -311,6 +312,21 @@ ExprAST *parse_identifier_expr() {
   std::vector<std::string> spaces;
   spaces.push_back(identifier_string);
   eat(T_IDENTIFIER);
+  // 'branchless' ifexpr, 'branchy' ifexpr
+  if (curr_token == T_IF &&
+      (spaces[0] == "branchless" || spaces[0] == "branchy")) {
+    auto if_expr = dynamic_cast<IfExprAST *>(parse_if_expr());
+    if (!if_expr)
+      error("'" + spaces[0] + "' needs an if expression");
+    if_expr->hint = spaces[0] == "branchless" ? BranchHint::Branchless
+                                              : BranchHint::Branchy;
+    return if_expr;
+  }
+  // label ::= identifier ':'
+  if (curr_token == ':') {
+    eat(':');
+    return new LabelExprAST(spaces[0]);
+  }
   while (curr_token == T_DOUBLE_COLON) {
     eat(T_DOUBLE_COLON);
     spaces.push_back(identifier_string);
@@ -546,6 +562,31 @@ ExprAST *parse_asm_expr() {
   return new ASMExprAST(type, asm_str, output_reg, args);
 }
 
+/// gotoexpr
+///   ::= 'goto' identifier
+///   ::= 'goto' '*' unary
+GotoExprAST *parse_goto_expr() {
+  eat(T_GOTO);
+  if (curr_token == '*') {
+    eat('*');
+    return new GotoExprAST("", parse_unary());
+  }
+  std::string label = identifier_string;
+  eat(T_IDENTIFIER);
+  return new GotoExprAST(label, nullptr);
+}
+
+/// boundscheckexpr ::= '__bounds_check__' '(' expression ',' expression ')'
+BoundsCheckExprAST *parse_bounds_check_expr() {
+  eat(T_BOUNDS_CHECK);
+  eat('(');
+  ExprAST *index = parse_expr();
+  eat(',');
+  ExprAST *length = parse_expr();
+  eat(')');
+  return new BoundsCheckExprAST(index, length);
+}
+
 GlobalASMExprAST *parse_global_asm() {
   eat(T_ASM);
   eat('(');
@@ -604,6 +645,10 @@ ExprAST *parse_primary() {
     return parse_type_assertion();
   case T_ASM:
     return parse_asm_expr();
+  case T_GOTO:
+    return parse_goto_expr();
+  case T_BOUNDS_CHECK:
+    return parse_bounds_check_expr();
   case '{':
     return parse_block();
   }
@@ -680,7 +725,15 @@ ExprAST *parse_postfix() {
 /// unary
 ///   ::= primary
 ///   ::= '!' unary
+///   ::= '&&' identifier
 ExprAST *parse_unary() {
+  // '&&' identifier, the address of a label
+  if (curr_token == T_LAND) {
+    eat(T_LAND);
+    std::string label = identifier_string;
+    eat(T_IDENTIFIER);
+    return new LabelAddrExprAST(label);
+  }
   if (unaries.count(curr_token) == 0) // not a unary op
     return parse_postfix();
 
@@ -737,8 +790,18 @@ std::tuple<std::string, TypeAST *, FuncFlags>
 parse_prototype_begin(bool parse_name, bool parse_this) {
   FuncFlags flags;
   flags.is_inline = curr_token == T_INLINE;
-  if (flags.is_inline)
+  if (flags.is_inline) {
     eat(T_INLINE);
+    // inline(frame) fun
+    if (curr_token == '(') {
+      eat('(');
+      if (curr_token != T_IDENTIFIER || identifier_string != "frame")
+        error("expected 'frame' in inline(...)");
+      flags.set_by_string("inline", identifier_string);
+      eat(T_IDENTIFIER);
+      eat(')');
+    }
+  }
   eat(T_FUNCTION);
   TypeAST *this_t = nullptr;
   if (parse_this && curr_token == '(') {
@@ -760,6 +823,8 @@ parse_prototype_begin(bool parse_name, bool parse_this) {
         str = string_value;
       else if (curr_token == T_IDENTIFIER)
         str = identifier_string;
+      else if (curr_token == T_NUMBER)
+        str = num_value;
       else
         str = token_to_str(curr_token);
       if (!flags.set_by_string(type, str))
@@ -836,7 +901,8 @@ DeclareExprAST *parse_declare() {
 }
 
 /// struct
-///   ::= 'struct' identifier '{' (identifier: type)* '}'
+///   ::= 'struct' identifier ('derive' '(' identifier* ')')?
+///       '{' (identifier: type)* '}'
 TypeDefAST *parse_struct() {
   eat(T_STRUCT); // eat struct.
   std::string struct_name = identifier_string;
@@ -855,6 +921,24 @@ TypeDefAST *parse_struct() {
     }
     eat('>');
   }
+  std::vector<std::string> derives;
+  if (curr_token == T_IDENTIFIER && identifier_string == "derive") {
+    eat(T_IDENTIFIER);
+    eat('(');
+    while (curr_token != ')') {
+      if (identifier_string != "serialize")
+        error("Unknown derive '" + identifier_string + "' for struct " +
+              struct_name + ", expected 'serialize'");
+      derives.push_back(identifier_string);
+      eat(T_IDENTIFIER);
+      if (curr_token == ')')
+        break;
+      eat(',');
+    }
+    eat(')');
+    if (is_generic && !derives.empty())
+      error("Generic struct " + struct_name + " can't derive serialize");
+  }
   eat('{');
   std::vector<std::pair<std::string, TypeAST *>> members;
   while (curr_token != '}') {
@@ -872,8 +956,8 @@ TypeDefAST *parse_struct() {
     return new GenericTypeDefAST(struct_name, generic_params,
                                  new StructTypeAST(members));
   else
-    return new AbsoluteTypeDefAST(struct_name,
-                                  new NamedStructTypeAST(struct_name, members));
+    return new AbsoluteTypeDefAST(
+        struct_name, new NamedStructTypeAST(struct_name, members), derives);
 }
 
 /// include ::= 'include' string, make sure to eat(T_STRING) after calling!
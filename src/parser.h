@@ -4,7 +4,7 @@
 #include "asts/types.h"
 #include "lexer.h"
 
-extern int curr_token;
+extern thread_local int curr_token;
 int get_next_token();
 void eat(const int expected_token);
 std::string eat_string();
@@ -43,6 +43,8 @@ ExprAST *parse_type_assertion();
 ExprAST *parse_type_dump();
 std::vector<std::pair<std::string, ExprAST *>> parse_asm_expr_params();
 ExprAST *parse_asm_expr();
+GotoExprAST *parse_goto_expr();
+BoundsCheckExprAST *parse_bounds_check_expr();
 GlobalASMExprAST *parse_global_asm();
 ExprAST *parse_primary();
 ExprAST *parse_postfix();
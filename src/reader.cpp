@@ -1,9 +1,11 @@
 #include "reader.h"
+#include "options.h"
 #include "utils.h"
 
 CharReader::CharReader(std::string file_path)
-    : file_path(file_path), file(file_path) {}
-CharReader::~CharReader() { file.close(); }
+    : file_path(file_path), file(new std::ifstream(file_path)) {}
+CharReader::CharReader(std::string file_path, std::string source)
+    : file_path(file_path), file(new std::istringstream(source)) {}
 char CharReader::next_char() {
   if (ended) {
     if (DEBUG)
@@ -11,8 +13,8 @@ char CharReader::next_char() {
     return EOF;
   }
   if (n == 0) {
-    file.read(buf, sizeof(buf));
-    n = file.gcount();
+    file->read(buf, sizeof(buf));
+    n = file->gcount();
     p = buf;
   }
   char ret = n-- > 0 ? *p++ : EOF;
@@ -24,14 +26,17 @@ char CharReader::next_char() {
   return ret;
 }
 
-std::vector<std::string> visited_paths;
-std::vector<CharReader *> queue;
+thread_local std::vector<std::string> visited_paths;
+thread_local std::vector<CharReader *> queue;
+thread_local std::vector<std::string> include_paths;
 int next_char() {
   char ret = EOF;
   while (ret == EOF && queue.size() > 0) {
     ret = queue.back()->next_char();
-    if (ret == EOF)
+    if (ret == EOF) {
+      delete queue.back();
       queue.pop_back();
+    }
   }
   return ret;
 }
@@ -44,14 +49,16 @@ std::string dirname(std::string path) {
 }
 
 CharReader *get_file(std::string base_path, std::string relative_path) {
-  for (unsigned int i = 0; i < 3; i++) {
+  for (size_t i = 0; i < 2 + include_paths.size(); i++) {
     std::string abs;
-    if (i == 0)
+    if (i == 0 && relative_path.starts_with('/'))
+      abs = relative_path;
+    else if (i == 0)
       abs = dirname(base_path) + '/' + relative_path;
     else if (i == 1)
       abs = dirname(base_path) + "/../lib/" + relative_path;
-    else if (i == 2)
-      abs = std_dir + '/' + relative_path;
+    else
+      abs = include_paths[i - 2] + '/' + relative_path;
     if (std::filesystem::exists(abs))
       return new CharReader(abs);
     abs += ".fy";
@@ -65,9 +72,30 @@ void add_file_to_queue(std::string base_path, std::string relative_path) {
   CharReader *file = get_file(base_path, relative_path);
   std::string path = std::filesystem::canonical(file->file_path).string();
   for (auto &visited_path : visited_paths)
-    if (visited_path == path)
+    if (visited_path == path) {
+      delete file;
       return; // only include a file once
+    }
   debug_log("Including file '" + path + "'");
   visited_paths.push_back(path);
   queue.push_back(file);
-}
\ No newline at end of file
+}
+
+void add_source_to_queue(std::string name, std::string source) {
+  debug_log("Including source '" + name + "'");
+  visited_paths.push_back(name);
+  queue.push_back(new CharReader(name, source));
+}
+
+FileOrigin curr_file_origin() {
+  if (options.units.empty())
+    return FileOrigin::Single;
+  std::string path = std::filesystem::canonical(queue.back()->file_path);
+  // the unit itself is the first file read
+  if (path == visited_paths[0])
+    return FileOrigin::Unit;
+  for (auto &unit : options.units)
+    if (std::filesystem::weakly_canonical(unit) == path)
+      return FileOrigin::OtherUnit;
+  return FileOrigin::Library;
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include "consts.h"
 #include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -12,16 +13,29 @@ class CharReader {
 
 public:
   std::string file_path;
-  std::ifstream file;
+  std::unique_ptr<std::istream> file;
   CharReader(std::string file_path);
-  ~CharReader();
+  // reads `source` from memory, `file_path` only names it
+  CharReader(std::string file_path, std::string source);
   char next_char();
 };
 
-extern std::vector<std::string> visited_paths;
-extern std::vector<CharReader *> queue;
+extern thread_local std::vector<std::string> visited_paths;
+extern thread_local std::vector<CharReader *> queue;
+// directories searched for includes, after the including file's own directory
+extern thread_local std::vector<std::string> include_paths;
 int next_char();
 
 CharReader *get_file(std::string base_path, std::string relative_path);
 
-void add_file_to_queue(std::string base_path, std::string relative_path);
\ No newline at end of file
+void add_file_to_queue(std::string base_path, std::string relative_path);
+void add_source_to_queue(std::string name, std::string source);
+
+// what the file being read is to the unit being compiled (see --units)
+enum class FileOrigin {
+  Single,    // not compiling units, the whole program is one module
+  Unit,      // the unit's own file, its definitions are exported
+  OtherUnit, // another unit of the program, which exports its definitions
+  Library,   // an included library, emitted on use as linkonce_odr
+};
+FileOrigin curr_file_origin();
\ No newline at end of file
@@ -0,0 +1,408 @@
+#include "share.h"
+#include <cstring>
+#include <map>
+#include <unordered_map>
+
+#define GENERIC_ATTR "fy-generic"
+
+std::atomic<size_t> shared_instances = 0, shared_instructions = 0;
+
+void mark_generic_instance(LLVMValueRef func, size_t generic_id) {
+  std::string id = std::to_string(generic_id);
+  LLVMAddAttributeAtIndex(
+      func, LLVMAttributeFunctionIndex,
+      LLVMCreateStringAttribute(LLVMGetTypeContext(LLVMTypeOf(func)),
+                                GENERIC_ATTR, strlen(GENERIC_ATTR), id.c_str(),
+                                id.size()));
+}
+static std::string generic_id(LLVMValueRef func) {
+  LLVMAttributeRef attr = LLVMGetStringAttributeAtIndex(
+      func, LLVMAttributeFunctionIndex, GENERIC_ATTR, strlen(GENERIC_ATTR));
+  if (!attr)
+    return "";
+  unsigned length;
+  const char *id = LLVMGetStringAttributeValue(attr, &length);
+  return std::string(id, length);
+}
+
+// whether values of the two types are laid out the same, all pointers are
+static bool same_layout(LLVMTypeRef a, LLVMTypeRef b) {
+  if (a == b)
+    return true;
+  LLVMTypeKind kind = LLVMGetTypeKind(a);
+  if (kind != LLVMGetTypeKind(b))
+    return false;
+  switch (kind) {
+  case LLVMPointerTypeKind:
+    return LLVMGetPointerAddressSpace(a) == LLVMGetPointerAddressSpace(b);
+  case LLVMStructTypeKind: {
+    unsigned count = LLVMCountStructElementTypes(a);
+    if (LLVMIsOpaqueStruct(a) || LLVMIsOpaqueStruct(b) ||
+        LLVMIsPackedStruct(a) != LLVMIsPackedStruct(b) ||
+        count != LLVMCountStructElementTypes(b))
+      return false;
+    for (unsigned i = 0; i < count; i++)
+      if (!same_layout(LLVMStructGetTypeAtIndex(a, i),
+                       LLVMStructGetTypeAtIndex(b, i)))
+        return false;
+    return true;
+  }
+  case LLVMArrayTypeKind:
+    return LLVMGetArrayLength(a) == LLVMGetArrayLength(b) &&
+           same_layout(LLVMGetElementType(a), LLVMGetElementType(b));
+  case LLVMFunctionTypeKind: {
+    unsigned count = LLVMCountParamTypes(a);
+    if (count != LLVMCountParamTypes(b) ||
+        LLVMIsFunctionVarArg(a) != LLVMIsFunctionVarArg(b) ||
+        !same_layout(LLVMGetReturnType(a), LLVMGetReturnType(b)))
+      return false;
+    std::vector<LLVMTypeRef> params_a(count), params_b(count);
+    LLVMGetParamTypes(a, params_a.data());
+    LLVMGetParamTypes(b, params_b.data());
+    for (unsigned i = 0; i < count; i++)
+      if (!same_layout(params_a[i], params_b[i]))
+        return false;
+    return true;
+  }
+  default:
+    // numbers are uniqued, different ones aren't the same
+    return false;
+  }
+}
+
+/// BodyMatcher - compares two function bodies instruction by instruction.
+/// Arguments, blocks and instructions correspond by position, and calls to
+/// generic instances in the same class match.
+class BodyMatcher {
+  std::unordered_map<LLVMValueRef, size_t> &classes;
+  // the value in the second function for each value of the first
+  std::unordered_map<LLVMValueRef, LLVMValueRef> pairs;
+
+  bool constants(LLVMValueRef a, LLVMValueRef b);
+  bool values(LLVMValueRef a, LLVMValueRef b);
+  bool instructions(LLVMValueRef a, LLVMValueRef b);
+
+public:
+  BodyMatcher(std::unordered_map<LLVMValueRef, size_t> &classes)
+      : classes(classes) {}
+  bool match(LLVMValueRef a, LLVMValueRef b);
+};
+
+bool BodyMatcher::constants(LLVMValueRef a, LLVMValueRef b) {
+  LLVMValueKind kind = LLVMGetValueKind(a);
+  if (kind != LLVMGetValueKind(b) ||
+      !same_layout(LLVMTypeOf(a), LLVMTypeOf(b)))
+    return false;
+  switch (kind) {
+  case LLVMConstantIntValueKind:
+    return LLVMGetIntTypeWidth(LLVMTypeOf(a)) <= 64 &&
+           LLVMConstIntGetZExtValue(a) == LLVMConstIntGetZExtValue(b);
+  case LLVMConstantPointerNullValueKind:
+  case LLVMConstantAggregateZeroValueKind:
+  case LLVMUndefValueValueKind:
+  case LLVMPoisonValueValueKind:
+    return true;
+  case LLVMConstantExprValueKind:
+    if (LLVMGetConstOpcode(a) != LLVMGetConstOpcode(b) ||
+        (LLVMGetConstOpcode(a) == LLVMGetElementPtr &&
+         !same_layout(LLVMGetGEPSourceElementType(a),
+                      LLVMGetGEPSourceElementType(b))))
+      return false;
+    [[fallthrough]];
+  case LLVMConstantStructValueKind:
+  case LLVMConstantArrayValueKind: {
+    int count = LLVMGetNumOperands(a);
+    if (count != LLVMGetNumOperands(b))
+      return false;
+    for (int i = 0; i < count; i++)
+      if (!values(LLVMGetOperand(a, i), LLVMGetOperand(b, i)))
+        return false;
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+bool BodyMatcher::values(LLVMValueRef a, LLVMValueRef b) {
+  if (auto pair = pairs.find(a); pair != pairs.end())
+    return pair->second == b;
+  if (a == b)
+    return true;
+  if (LLVMIsAFunction(a) && LLVMIsAFunction(b)) {
+    auto class_a = classes.find(a), class_b = classes.find(b);
+    return class_a != classes.end() && class_b != classes.end() &&
+           class_a->second == class_b->second;
+  }
+  // each instance generates its own string constants
+  if (LLVMIsAGlobalVariable(a) && LLVMIsAGlobalVariable(b))
+    return LLVMIsGlobalConstant(a) && LLVMIsGlobalConstant(b) &&
+           LLVMGetLinkage(a) == LLVMPrivateLinkage &&
+           LLVMGetLinkage(b) == LLVMPrivateLinkage &&
+           LLVMGetInitializer(a) && LLVMGetInitializer(b) &&
+           same_layout(LLVMGlobalGetValueType(a), LLVMGlobalGetValueType(b)) &&
+           values(LLVMGetInitializer(a), LLVMGetInitializer(b));
+  if (LLVMIsAConstant(a) && LLVMIsAConstant(b) && !LLVMIsAGlobalValue(a) &&
+      !LLVMIsAGlobalValue(b))
+    return constants(a, b);
+  return false;
+}
+
+bool BodyMatcher::instructions(LLVMValueRef a, LLVMValueRef b) {
+  LLVMOpcode opcode = LLVMGetInstructionOpcode(a);
+  int count = LLVMGetNumOperands(a);
+  if (opcode != LLVMGetInstructionOpcode(b) ||
+      count != LLVMGetNumOperands(b) ||
+      !same_layout(LLVMTypeOf(a), LLVMTypeOf(b)))
+    return false;
+  switch (opcode) {
+  case LLVMAlloca:
+    if (!same_layout(LLVMGetAllocatedType(a), LLVMGetAllocatedType(b)) ||
+        LLVMGetAlignment(a) != LLVMGetAlignment(b))
+      return false;
+    break;
+  case LLVMLoad:
+  case LLVMStore:
+    if (LLVMGetAlignment(a) != LLVMGetAlignment(b) ||
+        LLVMGetVolatile(a) != LLVMGetVolatile(b))
+      return false;
+    break;
+  case LLVMGetElementPtr:
+    if (!same_layout(LLVMGetGEPSourceElementType(a),
+                     LLVMGetGEPSourceElementType(b)))
+      return false;
+    break;
+  case LLVMICmp:
+    if (LLVMGetICmpPredicate(a) != LLVMGetICmpPredicate(b))
+      return false;
+    break;
+  case LLVMFCmp:
+    if (LLVMGetFCmpPredicate(a) != LLVMGetFCmpPredicate(b))
+      return false;
+    break;
+  case LLVMCall:
+    if (!same_layout(LLVMGetCalledFunctionType(a),
+                     LLVMGetCalledFunctionType(b)) ||
+        LLVMGetInstructionCallConv(a) != LLVMGetInstructionCallConv(b) ||
+        LLVMIsTailCall(a) != LLVMIsTailCall(b))
+      return false;
+    break;
+  case LLVMExtractValue:
+  case LLVMInsertValue: {
+    unsigned indices = LLVMGetNumIndices(a);
+    if (indices != LLVMGetNumIndices(b) ||
+        memcmp(LLVMGetIndices(a), LLVMGetIndices(b),
+               indices * sizeof(unsigned)))
+      return false;
+    break;
+  }
+  case LLVMPHI: {
+    unsigned incoming = LLVMCountIncoming(a);
+    if (incoming != LLVMCountIncoming(b))
+      return false;
+    for (unsigned i = 0; i < incoming; i++)
+      if (!values(LLVMBasicBlockAsValue(LLVMGetIncomingBlock(a, i)),
+                  LLVMBasicBlockAsValue(LLVMGetIncomingBlock(b, i))))
+        return false;
+    break;
+  }
+  case LLVMRet:
+  case LLVMBr:
+  case LLVMUnreachable:
+  case LLVMSelect:
+  case LLVMFNeg:
+  case LLVMAdd:
+  case LLVMFAdd:
+  case LLVMSub:
+  case LLVMFSub:
+  case LLVMMul:
+  case LLVMFMul:
+  case LLVMUDiv:
+  case LLVMSDiv:
+  case LLVMFDiv:
+  case LLVMURem:
+  case LLVMSRem:
+  case LLVMFRem:
+  case LLVMShl:
+  case LLVMLShr:
+  case LLVMAShr:
+  case LLVMAnd:
+  case LLVMOr:
+  case LLVMXor:
+  case LLVMTrunc:
+  case LLVMZExt:
+  case LLVMSExt:
+  case LLVMFPToUI:
+  case LLVMFPToSI:
+  case LLVMUIToFP:
+  case LLVMSIToFP:
+  case LLVMFPTrunc:
+  case LLVMFPExt:
+  case LLVMPtrToInt:
+  case LLVMIntToPtr:
+  case LLVMBitCast:
+    break;
+  default:
+    // not generated by fy, not worth comparing
+    return false;
+  }
+  for (int i = 0; i < count; i++)
+    if (!values(LLVMGetOperand(a, i), LLVMGetOperand(b, i)))
+      return false;
+  return true;
+}
+
+bool BodyMatcher::match(LLVMValueRef a, LLVMValueRef b) {
+  pairs.clear();
+  for (unsigned i = 0, c = LLVMCountParams(a); i < c; i++)
+    pairs[LLVMGetParam(a, i)] = LLVMGetParam(b, i);
+  std::vector<std::pair<LLVMValueRef, LLVMValueRef>> insts;
+  LLVMBasicBlockRef block_b = LLVMGetFirstBasicBlock(b);
+  for (LLVMBasicBlockRef block_a = LLVMGetFirstBasicBlock(a); block_a;
+       block_a = LLVMGetNextBasicBlock(block_a)) {
+    if (!block_b)
+      return false;
+    pairs[LLVMBasicBlockAsValue(block_a)] = LLVMBasicBlockAsValue(block_b);
+    LLVMValueRef inst_b = LLVMGetFirstInstruction(block_b);
+    for (LLVMValueRef inst_a = LLVMGetFirstInstruction(block_a); inst_a;
+         inst_a = LLVMGetNextInstruction(inst_a)) {
+      if (!inst_b)
+        return false;
+      pairs[inst_a] = inst_b;
+      insts.push_back({inst_a, inst_b});
+      inst_b = LLVMGetNextInstruction(inst_b);
+    }
+    if (inst_b)
+      return false;
+    block_b = LLVMGetNextBasicBlock(block_b);
+  }
+  if (block_b)
+    return false;
+  for (auto &[inst_a, inst_b] : insts)
+    if (!instructions(inst_a, inst_b))
+      return false;
+  return true;
+}
+
+static size_t count_instructions(LLVMValueRef func) {
+  size_t count = 0;
+  for (LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(func); block;
+       block = LLVMGetNextBasicBlock(block))
+    for (LLVMValueRef inst = LLVMGetFirstInstruction(block); inst;
+         inst = LLVMGetNextInstruction(inst))
+      count++;
+  return count;
+}
+
+// replaces the body of `func` with a call to `shared`, returns the number of
+// instructions that removed
+static size_t make_wrapper(LLVMValueRef func, LLVMValueRef shared) {
+  size_t removed = count_instructions(func);
+  // uses can be in other blocks, so they're all cut before deleting any
+  for (LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(func); block;
+       block = LLVMGetNextBasicBlock(block))
+    for (LLVMValueRef inst = LLVMGetFirstInstruction(block); inst;
+         inst = LLVMGetNextInstruction(inst))
+      if (LLVMGetTypeKind(LLVMTypeOf(inst)) != LLVMVoidTypeKind)
+        LLVMReplaceAllUsesWith(inst, LLVMGetUndef(LLVMTypeOf(inst)));
+  while (LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(func)) {
+    while (LLVMValueRef inst = LLVMGetFirstInstruction(block))
+      LLVMInstructionEraseFromParent(inst);
+    LLVMDeleteBasicBlock(block);
+  }
+
+  LLVMContextRef ctx = LLVMGetTypeContext(LLVMTypeOf(func));
+  LLVMBuilderRef builder = LLVMCreateBuilderInContext(ctx);
+  LLVMPositionBuilderAtEnd(builder,
+                           LLVMAppendBasicBlockInContext(ctx, func, ""));
+  LLVMTypeRef shared_type = LLVMGlobalGetValueType(shared);
+  unsigned count = LLVMCountParams(func);
+  std::vector<LLVMTypeRef> param_types(count);
+  LLVMGetParamTypes(shared_type, param_types.data());
+  std::vector<LLVMValueRef> args(count);
+  for (unsigned i = 0; i < count; i++) {
+    args[i] = LLVMGetParam(func, i);
+    if (LLVMTypeOf(args[i]) != param_types[i])
+      args[i] = LLVMBuildBitCast(builder, args[i], param_types[i], "");
+  }
+  LLVMValueRef call =
+      LLVMBuildCall2(builder, shared_type, shared, args.data(), count, "");
+  LLVMSetInstructionCallConv(call, LLVMGetFunctionCallConv(shared));
+  LLVMSetTailCall(call, true);
+  LLVMTypeRef return_type = LLVMGetReturnType(LLVMGlobalGetValueType(func));
+  if (LLVMGetTypeKind(return_type) == LLVMVoidTypeKind)
+    LLVMBuildRetVoid(builder);
+  else if (LLVMTypeOf(call) != return_type)
+    LLVMBuildRet(builder, LLVMBuildBitCast(builder, call, return_type, ""));
+  else
+    LLVMBuildRet(builder, call);
+  LLVMDisposeBuilder(builder);
+  return removed - count_instructions(func);
+}
+
+// the instances that can share a body have the same generic function, call
+// conv and parameter and return types, apart from pointer types
+static std::string share_key(LLVMValueRef func) {
+  std::stringstream key;
+  LLVMTypeRef type = LLVMGlobalGetValueType(func);
+  key << generic_id(func) << ' ' << LLVMGetFunctionCallConv(func);
+  unsigned count = LLVMCountParamTypes(type);
+  std::vector<LLVMTypeRef> types(count);
+  LLVMGetParamTypes(type, types.data());
+  types.push_back(LLVMGetReturnType(type));
+  for (LLVMTypeRef type : types)
+    if (LLVMGetTypeKind(type) == LLVMPointerTypeKind)
+      key << " *";
+    else
+      key << ' ' << type;
+  return key.str();
+}
+
+void share_generic_instances(LLVMModuleRef module) {
+  std::map<std::string, std::vector<LLVMValueRef>> groups;
+  for (LLVMValueRef func = LLVMGetFirstFunction(module); func;
+       func = LLVMGetNextFunction(func))
+    if (LLVMGetFirstBasicBlock(func) && generic_id(func) != "" &&
+        !LLVMIsFunctionVarArg(LLVMGlobalGetValueType(func)))
+      groups[share_key(func)].push_back(func);
+  // every group starts as one class, classes are split until all of their
+  // members match the first one. Calls to members of the same class match, so
+  // recursive instances can share too
+  std::vector<std::vector<LLVMValueRef>> classes;
+  std::unordered_map<LLVMValueRef, size_t> class_of;
+  for (auto &[key, funcs] : groups)
+    if (funcs.size() > 1) {
+      for (auto func : funcs)
+        class_of[func] = classes.size();
+      classes.push_back(funcs);
+    }
+  BodyMatcher matcher(class_of);
+  for (bool split = true; split;) {
+    split = false;
+    for (size_t i = 0; i < classes.size(); i++) {
+      std::vector<LLVMValueRef> same = {classes[i][0]}, rest;
+      for (size_t j = 1; j < classes[i].size(); j++)
+        (matcher.match(classes[i][0], classes[i][j]) ? same : rest)
+            .push_back(classes[i][j]);
+      if (rest.empty())
+        continue;
+      split = true;
+      classes[i] = same;
+      for (auto func : rest)
+        class_of[func] = classes.size();
+      classes.push_back(rest);
+    }
+  }
+  for (auto &funcs : classes)
+    for (size_t i = 1; i < funcs.size(); i++) {
+      debug_log("Sharing the body of " << LLVMGetValueName(funcs[0])
+                                       << " with "
+                                       << LLVMGetValueName(funcs[i]));
+      shared_instructions += make_wrapper(funcs[i], funcs[0]);
+      shared_instances++;
+    }
+  for (LLVMValueRef func = LLVMGetFirstFunction(module); func;
+       func = LLVMGetNextFunction(func))
+    LLVMRemoveStringAttributeAtIndex(func, LLVMAttributeFunctionIndex,
+                                     GENERIC_ATTR, strlen(GENERIC_ATTR));
+}
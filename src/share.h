@@ -0,0 +1,14 @@
+#pragma once
+#include "utils.h"
+#include <atomic>
+// Shares the body of generic instances that only differ in types with the
+// same layout, e.g. Array<*Foo>.push and Array<*Bar>.push. One instance keeps
+// the body, the others become wrappers that cast their arguments and call it.
+
+// generic instances that became wrappers, and the IR instructions that saved
+extern std::atomic<size_t> shared_instances, shared_instructions;
+
+// tags `func` as an instance of the generic function numbered `generic_id`
+void mark_generic_instance(LLVMValueRef func, size_t generic_id);
+// shares the bodies of the tagged instances in `module` and removes the tags
+void share_generic_instances(LLVMModuleRef module);
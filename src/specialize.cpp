@@ -0,0 +1,315 @@
+#include "specialize.h"
+#include "compiler.h"
+#include <algorithm>
+#include <cstring>
+extern "C" {
+#include "llvm-c-14/llvm-c/BitReader.h"
+}
+
+Specializer::Specializer(LLVMModuleRef module, unsigned opt_level)
+    : opt_level(std::max(opt_level, 2u)),
+      target_machine(create_host_target_machine()) {
+  LLVMTargetDataRef layout = LLVMGetModuleDataLayout(module);
+  for (LLVMValueRef global = LLVMGetFirstGlobal(module); global;
+       global = LLVMGetNextGlobal(global)) {
+    if (LLVMIsGlobalConstant(global) || !LLVMGetInitializer(global))
+      continue;
+    // e.g. memoize caches, looked up by name like the program's variables,
+    // so unnamed ones get a name
+    size_t length;
+    LLVMGetValueName2(global, &length);
+    if (!length)
+      LLVMSetValueName2(global, "fy.global", 9);
+    LLVMLinkage linkage = LLVMGetLinkage(global);
+    if (linkage == LLVMPrivateLinkage || linkage == LLVMInternalLinkage)
+      LLVMSetLinkage(global, LLVMExternalLinkage);
+  }
+  auto add_sizes = [&](LLVMValueRef value, LLVMValueRef func) {
+    LLVMTypeRef type = LLVMGlobalGetValueType(func);
+    if (LLVMIsFunctionVarArg(type))
+      return;
+    std::vector<LLVMTypeRef> params(LLVMCountParamTypes(type));
+    LLVMGetParamTypes(type, params.data());
+    auto &sizes = arg_sizes[LLVMGetValueName(value)];
+    for (LLVMTypeRef param : params)
+      sizes.push_back(LLVMStoreSizeOfType(layout, param));
+  };
+  for (LLVMValueRef func = LLVMGetFirstFunction(module); func;
+       func = LLVMGetNextFunction(func))
+    if (LLVMGetFirstBasicBlock(func))
+      add_sizes(func, func);
+  for (LLVMValueRef alias = LLVMGetFirstGlobalAlias(module); alias;
+       alias = LLVMGetNextGlobalAlias(alias))
+    add_sizes(alias, alias);
+  LLVMMemoryBufferRef buffer = LLVMWriteBitcodeToMemoryBuffer(module);
+  bitcode.assign(LLVMGetBufferStart(buffer), LLVMGetBufferSize(buffer));
+  LLVMDisposeMemoryBuffer(buffer);
+}
+Specializer::~Specializer() { LLVMDisposeTargetMachine(target_machine); }
+
+bool Specializer::defines(std::string name) { return arg_sizes.count(name); }
+
+void *Specializer::specialize(std::string name,
+                              std::vector<SpecializedArg> args) {
+  auto sizes = arg_sizes.find(name);
+  if (sizes == arg_sizes.end())
+    error("Can't specialize " << name
+                              << ", it isn't a function with a fixed number "
+                                 "of arguments.");
+  std::sort(args.begin(), args.end(),
+            [](auto &a, auto &b) { return a.index < b.index; });
+  // every argument's size is known from its index
+  std::string key = name;
+  for (size_t i = 0; i < args.size(); i++) {
+    unsigned index = args[i].index;
+    if (index >= sizes->second.size())
+      error(name << " has no argument " << index << ".");
+    if (i && index == args[i - 1].index)
+      error("Argument " << index << " of " << name << " is fixed twice.");
+    key += '\0' + std::to_string(index) + ':';
+    key.append((const char *)args[i].value, sizes->second[index]);
+  }
+  std::lock_guard<std::mutex> guard(mutex);
+  if (auto cached = cache.find(key); cached != cache.end())
+    return cached->second;
+  std::string spec_name = name + ".specialized." + std::to_string(cache.size());
+  LLVMModuleRef module = gen_module(create_context(), name, args, spec_name);
+  return cache[key] = add_module(module, spec_name);
+}
+
+// the constant of `type` whose bytes in memory are at `bytes`
+static LLVMValueRef const_from_bytes(LLVMTypeRef type, const char *bytes,
+                                     LLVMTargetDataRef layout) {
+  LLVMContextRef ctx = LLVMGetTypeContext(type);
+  switch (LLVMGetTypeKind(type)) {
+  case LLVMIntegerTypeKind: {
+    unsigned long long size = LLVMStoreSizeOfType(layout, type);
+    std::vector<uint64_t> words((size + 7) / 8);
+    memcpy(words.data(), bytes, size);
+    return LLVMConstIntOfArbitraryPrecision(type, words.size(), words.data());
+  }
+  case LLVMPointerTypeKind: {
+    uintptr_t address;
+    memcpy(&address, bytes, sizeof(address));
+    return LLVMConstIntToPtr(
+        LLVMConstInt(LLVMIntPtrTypeInContext(ctx, layout), address, false),
+        type);
+  }
+  case LLVMStructTypeKind: {
+    std::vector<LLVMValueRef> fields(LLVMCountStructElementTypes(type));
+    for (unsigned i = 0; i < fields.size(); i++)
+      fields[i] = const_from_bytes(LLVMStructGetTypeAtIndex(type, i),
+                                   bytes + LLVMOffsetOfElement(layout, type, i),
+                                   layout);
+    return LLVMConstNamedStruct(type, fields.data(), fields.size());
+  }
+  case LLVMArrayTypeKind:
+  case LLVMVectorTypeKind: {
+    bool is_array = LLVMGetTypeKind(type) == LLVMArrayTypeKind;
+    LLVMTypeRef elem = LLVMGetElementType(type);
+    unsigned long long stride = LLVMABISizeOfType(layout, elem);
+    std::vector<LLVMValueRef> elems(is_array ? LLVMGetArrayLength(type)
+                                             : LLVMGetVectorSize(type));
+    for (size_t i = 0; i < elems.size(); i++)
+      elems[i] = const_from_bytes(elem, bytes + i * stride, layout);
+    return is_array ? LLVMConstArray(elem, elems.data(), elems.size())
+                    : LLVMConstVector(elems.data(), elems.size());
+  }
+  default: {
+    // floating point, from the integer of its bits
+    LLVMTypeRef bits =
+        LLVMIntTypeInContext(ctx, LLVMSizeOfTypeInBits(layout, type));
+    return LLVMConstBitCast(const_from_bytes(bits, bytes, layout), type);
+  }
+  }
+}
+
+// `value` without constant casts
+static LLVMValueRef strip_casts(LLVMValueRef value) {
+  while (LLVMIsAConstantExpr(value) && LLVMGetConstOpcode(value) == LLVMBitCast)
+    value = LLVMGetOperand(value, 0);
+  return value;
+}
+
+LLVMModuleRef Specializer::gen_module(LLVMContextRef ctx, std::string name,
+                                      std::vector<SpecializedArg> &args,
+                                      std::string spec_name) {
+  LLVMMemoryBufferRef buffer = LLVMCreateMemoryBufferWithMemoryRange(
+      bitcode.data(), bitcode.size(), "", false);
+  LLVMModuleRef module;
+  bool failed = LLVMParseBitcodeInContext2(ctx, buffer, &module);
+  LLVMDisposeMemoryBuffer(buffer);
+  if (failed)
+    error("Couldn't read the module " << name << " is in.");
+  // the program's constructors and destructors already ran
+  for (const char *list : {"llvm.global_ctors", "llvm.global_dtors",
+                           "llvm.used", "llvm.compiler.used"})
+    if (LLVMValueRef global = LLVMGetNamedGlobal(module, list))
+      LLVMDeleteGlobal(global);
+  // the variables are the program's, everything else is a private copy for
+  // the optimizer to fold and drop
+  for (LLVMValueRef global = LLVMGetFirstGlobal(module), next; global;
+       global = next) {
+    next = LLVMGetNextGlobal(global);
+    if (!LLVMGetInitializer(global))
+      continue;
+    if (LLVMIsGlobalConstant(global)) {
+      LLVMSetLinkage(global, LLVMInternalLinkage);
+      continue;
+    }
+    LLVMValueRef declaration =
+        LLVMAddGlobal(module, LLVMGlobalGetValueType(global), "");
+    LLVMSetThreadLocalMode(declaration, LLVMGetThreadLocalMode(global));
+    LLVMReplaceAllUsesWith(global, declaration);
+    std::string global_name = LLVMGetValueName(global);
+    LLVMDeleteGlobal(global);
+    LLVMSetValueName2(declaration, global_name.c_str(), global_name.size());
+  }
+  for (LLVMValueRef func = LLVMGetFirstFunction(module); func;
+       func = LLVMGetNextFunction(func))
+    if (LLVMGetFirstBasicBlock(func))
+      LLVMSetLinkage(func, LLVMInternalLinkage);
+  for (LLVMValueRef alias = LLVMGetFirstGlobalAlias(module); alias;
+       alias = LLVMGetNextGlobalAlias(alias))
+    LLVMSetLinkage(alias, LLVMInternalLinkage);
+
+  LLVMValueRef callee = LLVMGetNamedFunction(module, name.c_str());
+  if (!callee)
+    callee = LLVMGetNamedGlobalAlias(module, name.c_str(), name.size());
+  LLVMTypeRef type = LLVMGlobalGetValueType(callee);
+  // calls to an alias can't be inlined
+  if (LLVMIsAGlobalAlias(callee)) {
+    LLVMValueRef aliasee = strip_casts(LLVMAliasGetAliasee(callee));
+    if (LLVMIsAFunction(aliasee) && LLVMGlobalGetValueType(aliasee) == type)
+      callee = aliasee;
+  }
+  unsigned call_conv =
+      LLVMIsAFunction(callee) ? LLVMGetFunctionCallConv(callee)
+                              : (unsigned)LLVMCCallConv;
+  LLVMValueRef func = LLVMAddFunction(module, spec_name.c_str(), type);
+  LLVMSetFunctionCallConv(func, call_conv);
+  std::vector<LLVMValueRef> call_args(LLVMCountParams(func));
+  LLVMGetParams(func, call_args.data());
+  std::vector<LLVMTypeRef> params(call_args.size());
+  LLVMGetParamTypes(type, params.data());
+  for (auto &arg : args)
+    call_args[arg.index] =
+        const_from_bytes(params[arg.index], (const char *)arg.value,
+                         LLVMGetModuleDataLayout(module));
+
+  LLVMBuilderRef builder = LLVMCreateBuilderInContext(ctx);
+  LLVMPositionBuilderAtEnd(builder,
+                           LLVMAppendBasicBlockInContext(ctx, func, "entry"));
+  LLVMValueRef call = LLVMBuildCall2(builder, type, callee, call_args.data(),
+                                     call_args.size(), "");
+  LLVMSetInstructionCallConv(call, call_conv);
+  // the body is copied even if it calls itself or is called elsewhere
+  LLVMAddCallSiteAttribute(
+      call, LLVMAttributeFunctionIndex,
+      LLVMCreateEnumAttribute(
+          ctx, LLVMGetEnumAttributeKindForName("alwaysinline", 12), 0));
+  if (LLVMGetTypeKind(LLVMGetReturnType(type)) == LLVMVoidTypeKind)
+    LLVMBuildRetVoid(builder);
+  else
+    LLVMBuildRet(builder, call);
+  LLVMDisposeBuilder(builder);
+  run_passes(module, "default<O" + std::to_string(opt_level) + ">",
+             target_machine);
+  return module;
+}
+
+/// RunSpecializer - specializes the functions of the program `fy run` runs,
+/// every specialization is compiled by an MCJIT engine of its own.
+class RunSpecializer : public Specializer {
+  LLVMContextRef create_context() override { return LLVMContextCreate(); }
+  void *add_module(LLVMModuleRef module, std::string name) override;
+
+public:
+  LLVMModuleRef program_module = nullptr;
+  LLVMExecutionEngineRef program = nullptr;
+  std::vector<LLVMExecutionEngineRef> engines;
+  // the program's functions by address
+  std::unordered_map<uint64_t, std::string> names;
+  std::once_flag names_found;
+  using Specializer::Specializer;
+};
+static RunSpecializer *run_specializer = nullptr;
+
+// specialize() in `fy run`: `func` with the arguments whose bits are set in
+// `fixed` fixed to `values`, in order. It stays `func` if that fails
+static void *run_specialize(void *func, uint64_t fixed, const void **values) {
+  std::vector<SpecializedArg> args;
+  for (unsigned i = 0; i < 64; i++)
+    if (fixed >> i & 1)
+      args.push_back({i, *values++});
+  RunSpecializer *specializer = run_specializer;
+  std::call_once(specializer->names_found, [&] {
+    auto add_name = [&](LLVMValueRef value) {
+      std::string name = LLVMGetValueName(value);
+      if (!specializer->defines(name))
+        return;
+      if (uint64_t address =
+              LLVMGetGlobalValueAddress(specializer->program, name.c_str()))
+        specializer->names.emplace(address, name);
+    };
+    for (LLVMValueRef f = LLVMGetFirstFunction(specializer->program_module);
+         f; f = LLVMGetNextFunction(f))
+      add_name(f);
+    for (LLVMValueRef alias =
+             LLVMGetFirstGlobalAlias(specializer->program_module);
+         alias; alias = LLVMGetNextGlobalAlias(alias))
+      add_name(alias);
+  });
+  auto name = specializer->names.find((uint64_t)func);
+  if (name == specializer->names.end())
+    return func;
+  try {
+    return specializer->specialize(name->second, args);
+  } catch (CompileError &err) {
+    std::cerr << "Error: " << err.what() << std::endl;
+    return func;
+  }
+}
+
+void *RunSpecializer::add_module(LLVMModuleRef module, std::string name) {
+  LLVMExecutionEngineRef engine;
+  char *err;
+  if (LLVMCreateJITCompilerForModule(&engine, module, 2, &err)) {
+    std::string message = err;
+    LLVMDisposeMessage(err);
+    error("JIT Failed: " << message);
+  }
+  engines.push_back(engine);
+  // the program's functions and variables, others are from the process
+  auto map_to_program = [&](LLVMValueRef declaration) {
+    std::string name = LLVMGetValueName(declaration);
+    if (name == SPECIALIZE_HOOK)
+      LLVMAddGlobalMapping(engine, declaration, (void *)run_specialize);
+    else if (uint64_t address =
+                 LLVMGetGlobalValueAddress(program, name.c_str()))
+      LLVMAddGlobalMapping(engine, declaration, (void *)address);
+  };
+  for (LLVMValueRef func = LLVMGetFirstFunction(module); func;
+       func = LLVMGetNextFunction(func))
+    if (!LLVMGetFirstBasicBlock(func) && !LLVMGetIntrinsicID(func))
+      map_to_program(func);
+  for (LLVMValueRef global = LLVMGetFirstGlobal(module); global;
+       global = LLVMGetNextGlobal(global))
+    if (!LLVMGetInitializer(global))
+      map_to_program(global);
+  return (void *)LLVMGetFunctionAddress(engine, name.c_str());
+}
+
+void prepare_run_specializer(LLVMModuleRef module, unsigned opt_level) {
+  if (LLVMGetNamedFunction(module, SPECIALIZE_HOOK))
+    run_specializer = new RunSpecializer(module, opt_level);
+}
+void start_run_specializer(LLVMModuleRef module,
+                           LLVMExecutionEngineRef engine) {
+  if (!run_specializer)
+    return;
+  run_specializer->program_module = module;
+  run_specializer->program = engine;
+  LLVMAddGlobalMapping(engine, LLVMGetNamedFunction(module, SPECIALIZE_HOOK),
+                       (void *)run_specialize);
+}
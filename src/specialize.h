@@ -0,0 +1,64 @@
+#pragma once
+#include "utils.h"
+#include <mutex>
+// Runtime specialization, `specialize(f, n = 16, ...)` in `fy run` and
+// fy_session_specialize in libfy. The function is cloned from the compiled
+// module with the given arguments replaced by constants, optimized (at least
+// at O2) and JIT compiled, so loops and branches over them fold. The result
+// has the signature of the function and ignores the given arguments, callers
+// pass them anyway: compiled programs get the function itself. It's cached by
+// the arguments' bytes, pointers are constant but not what they point to.
+// Global variables are shared with the program, the clones have their own
+// copies of everything else.
+
+// the function specialize() calls in `fy run`,
+// `*i8 (*i8 func, i64 fixed_args_mask, **i8 fixed_args)`
+#define SPECIALIZE_HOOK "fy.specialize"
+
+/// SpecializedArg - argument `index` fixed to the value at `value`, in the
+/// memory layout of the argument's type.
+struct SpecializedArg {
+  unsigned index;
+  const void *value;
+};
+
+/// Specializer - the IR of a compiled module and the specializations JIT
+/// compiled from it. A JIT adds the modules through the virtual functions.
+class Specializer {
+  std::string bitcode;
+  // arguments' sizes in bytes of the functions (and aliases) the module
+  // defines
+  std::unordered_map<std::string, std::vector<unsigned long long>> arg_sizes;
+  unsigned opt_level;
+  LLVMTargetMachineRef target_machine;
+  std::unordered_map<std::string, void *> cache;
+  std::mutex mutex;
+
+  LLVMModuleRef gen_module(LLVMContextRef ctx, std::string name,
+                           std::vector<SpecializedArg> &args,
+                           std::string spec_name);
+
+protected:
+  // a context for the module of a new specialization
+  virtual LLVMContextRef create_context() = 0;
+  // JIT compiles `module` (in a context of create_context) and returns the
+  // address of its function `name`
+  virtual void *add_module(LLVMModuleRef module, std::string name) = 0;
+
+public:
+  // keeps `module`, an optimized module that's about to be JIT compiled.
+  // Its mutable global variables become visible to the specializations
+  Specializer(LLVMModuleRef module, unsigned opt_level);
+  virtual ~Specializer();
+  bool defines(std::string name);
+  // the specialization of the function `name`, errors if there's no such
+  // function or argument. Safe to call from multiple threads
+  void *specialize(std::string name, std::vector<SpecializedArg> args);
+};
+
+// with a module that calls specialize(), keeps it for the specializer of
+// `fy run` before it's given to MCJIT
+void prepare_run_specializer(LLVMModuleRef module, unsigned opt_level);
+// maps the specialize() calls of the module in `engine` to the specializer
+void start_run_specializer(LLVMModuleRef module,
+                           LLVMExecutionEngineRef engine);
@@ -10,10 +10,11 @@ bool Type::operator!=(Type *other) { return neq(other); }
 PointerType *Type::ptr() { return new PointerType(this); }
 template <typename T> inline size_t hash(T t) { return std::hash<T>()(t); }
 
-LLVMTypeRef llvm_null = LLVMStructType(nullptr, 0, true);
 NullType null_type = NullType();
 NullType::NullType() {}
-LLVMTypeRef NullType::llvm_type() { return llvm_null; }
+LLVMTypeRef NullType::llvm_type() {
+  return LLVMStructTypeInContext(curr_ctx, nullptr, 0, true);
+}
 TypeType NullType::type_type() { return TypeType::Null; }
 bool NullType::eq(Type *other) { return other->type_type() == TypeType::Null; }
 bool NullType::castable_to(Type *other) { return true; }
@@ -31,16 +32,16 @@ NumType::NumType(bool is_signed) : is_floating(false), is_signed(is_signed) {
 NumType::NumType() {}
 LLVMTypeRef NumType::llvm_type() {
   if (!is_floating)
-    return LLVMIntType(bits);
+    return LLVMIntTypeInContext(curr_ctx, bits);
   switch (bits) {
   case 16:
-    return LLVMHalfType();
+    return LLVMHalfTypeInContext(curr_ctx);
   case 32:
-    return LLVMFloatType();
+    return LLVMFloatTypeInContext(curr_ctx);
   case 64:
-    return LLVMDoubleType();
+    return LLVMDoubleTypeInContext(curr_ctx);
   case 128:
-    return LLVMFP128Type();
+    return LLVMFP128TypeInContext(curr_ctx);
   default:
     error("floating " + std::to_string(bits) + "-bit numbers don't exist");
   }
@@ -123,7 +124,8 @@ TupleType::TupleType(std::vector<Type *> types) : types(types) {
   LLVMTypeRef *llvm_types = new LLVMTypeRef[types.size()];
   for (size_t i = 0; i < types.size(); i++)
     llvm_types[i] = types[i]->llvm_type();
-  llvm_struct_type = LLVMStructType(llvm_types, types.size(), true);
+  llvm_struct_type =
+      LLVMStructTypeInContext(curr_ctx, llvm_types, types.size(), true);
 }
 Type *TupleType::get_elem_type(size_t index) {
   if (index >= types.size())
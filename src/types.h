@@ -39,6 +39,18 @@ template <> struct std::hash<std::vector<Type *>> {
     return res ^ std::hash<size_t>()(type.size());
   }
 };
+template <> struct std::equal_to<std::vector<Type *>> {
+  bool operator()(const std::vector<Type *> &a,
+                  const std::vector<Type *> &b) const {
+    if (a.size() != b.size())
+      return false;
+    // both ways, the empty tuple (unknown) is equal to any tuple one way
+    for (size_t i = 0; i < a.size(); i++)
+      if (!a[i]->eq(b[i]) || !b[i]->eq(a[i]))
+        return false;
+    return true;
+  }
+};
 
 class NullType : public Type {
 public:
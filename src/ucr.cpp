@@ -1,17 +1,12 @@
 #include "utils.h"
 
-std::vector<LLVMValueRef> used_globals;
-bool is_global_used(LLVMValueRef global) {
-  for (auto &used_global : used_globals)
-    if (used_global == global)
-      return true;
-  return false;
-}
+// every value reached from the entry points, not just globals
+thread_local std::unordered_set<LLVMValueRef> used_globals;
+bool is_global_used(LLVMValueRef global) { return used_globals.count(global); }
 
 void mark_used_globals(LLVMValueRef entry) {
-  if (is_global_used(entry))
+  if (!used_globals.insert(entry).second)
     return;
-  used_globals.push_back(entry);
   if (LLVMIsAFunction(entry)) {
     LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(entry);
     while (block != NULL) {
@@ -29,7 +24,7 @@ void mark_used_globals(LLVMValueRef entry) {
       mark_used_globals(LLVMGetOperand(entry, i));
 }
 
-std::unordered_set<LLVMValueRef> removed_globals;
+thread_local std::unordered_set<LLVMValueRef> removed_globals;
 inline void loop_and_delete(LLVMModuleRef module,
                             LLVMValueRef (*first)(LLVMModuleRef mod),
                             LLVMValueRef (*next)(LLVMValueRef last),
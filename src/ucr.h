@@ -1,4 +1,4 @@
 #pragma once
-extern std::unordered_set<LLVMValueRef> removed_globals;
+extern thread_local std::unordered_set<LLVMValueRef> removed_globals;
 void remove_unused_globals(LLVMModuleRef module,
                            std::vector<LLVMValueRef> entryPoints);
\ No newline at end of file
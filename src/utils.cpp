@@ -1,9 +1,12 @@
 #include "utils.h"
+#include "options.h"
 #include <cmath>
 
-size_t unnamed_acc = 0;
+thread_local size_t unnamed_acc = 0;
 // incrementing base52 (a-zA-Z) number for unnamed symbols
 const char *next_unnamed() {
+  if (options.lean)
+    return "";
   size_t num = unnamed_acc++;
   if (num == 0)
     return "a"; // log(0) would fail so shortcut with correct result
@@ -30,23 +33,50 @@ LLVMCallConv get_call_conv(std::string name) {
 bool FuncFlags::set_by_string(std::string str, std::string value) {
   if (str == "call_conv" || str == "cc")
     call_conv = get_call_conv(value);
-  else {
+  else if (str == "memoize" || str == "shared_memoize") {
+    // memoize(N) caches N results
+    size_t end = 0;
+    try {
+      memoize = std::stoul(value, &end);
+    } catch (std::exception &) {
+    }
+    if (memoize == 0 || end != value.size())
+      error(str + " needs a number of cached results, got " + value + ".");
+    memoize_per_thread = str == "memoize";
+  } else {
     // boolean flags
     bool enabled = value == "true";
     if (str == "vararg")
       is_vararg = enabled;
-    else if (str == "inline")
-      is_inline = enabled;
+    else if (str == "inline") {
+      // inline(frame)
+      is_inline = enabled || value == "frame";
+      inline_frame = value == "frame";
+    }
     // might rename to "export" or "extern"? not sure.
     else if (str == "always_compile")
       always_compile = enabled;
+    else if (str == "hot")
+      is_hot = enabled;
+    else if (str == "cold")
+      is_cold = enabled;
     else
       return false;
   }
   return true;
 }
+void add_function_attr(LLVMValueRef func, std::string name) {
+  unsigned kind = LLVMGetEnumAttributeKindForName(name.c_str(), name.size());
+  LLVMAddAttributeAtIndex(func, LLVMAttributeFunctionIndex,
+                          LLVMCreateEnumAttribute(curr_ctx, kind, 0));
+}
+bool has_function_attr(LLVMValueRef func, std::string name) {
+  unsigned kind = LLVMGetEnumAttributeKindForName(name.c_str(), name.size());
+  return LLVMGetEnumAttributeAtIndex(func, LLVMAttributeFunctionIndex, kind);
+}
 bool FuncFlags::eq(FuncFlags other) {
   return is_vararg == other.is_vararg && is_inline == other.is_inline &&
+         inline_frame == other.inline_frame &&
          always_compile == other.always_compile && call_conv == other.call_conv;
 }
 bool FuncFlags::neq(FuncFlags other) { return !eq(other); }
@@ -71,4 +101,17 @@ std::filesystem::path get_executable_path() {
 std::filesystem::path get_executable_path() {
   static_assert(false, "Unsupported platform (expected _WIN32 or __linux__)");
 }
-#endif
\ No newline at end of file
+#endif
+
+bool run_command(std::vector<std::string> args) {
+  std::string command;
+  for (auto &arg : args) {
+    // single quote every argument, a quote becomes '\''
+    command += " '";
+    for (char c : arg)
+      command += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    command += '\'';
+  }
+  debug_log("Running" << command);
+  return std::system(command.c_str()) == 0;
+}
@@ -2,6 +2,8 @@
 #include "consts.h"
 #include <filesystem>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
 #include <vector>
 
 template <typename A, typename B>
@@ -13,9 +15,9 @@ std::vector<B> seconds(const std::vector<std::pair<A, B>> &array) {
   return res;
 }
 
-extern size_t unnamed_acc;
+extern thread_local size_t unnamed_acc;
 const char *next_unnamed();
-// Unnamed symbol
+// Unnamed symbol, LLVM numbers them with --lean
 #define UN next_unnamed()
 
 consteval const char *__file_name__(const char *path) {
@@ -26,19 +28,32 @@ consteval const char *__file_name__(const char *path) {
   return last;
 }
 
-#define error(err) (std::cerr << "Error: " << err << std::endl), exit(1)
+/// CompileError - thrown by `error`, caught by the fy driver or the libfy
+/// session that started the compilation.
+struct CompileError : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+#define error(err) throw CompileError((std::stringstream() << err).str())
 #define debug_log(format)                                                      \
   if (DEBUG)                                                                   \
   std::cerr << "[" << __file_name__(__FILE__) << ":" << __LINE__ << "] "       \
             << format << std::endl
 
 LLVMCallConv get_call_conv(std::string name);
+void add_function_attr(LLVMValueRef func, std::string name);
+bool has_function_attr(LLVMValueRef func, std::string name);
 
 struct FuncFlags {
   bool is_vararg = false, // is the function vararg
       is_inline = false,  // should instructions be inlined into the call-site
-      always_compile = false; // should the function be compiled even if it
+      inline_frame = false, // is the body generated into every caller, e.g.
+                            // so its allocations live in the caller's frame
+      always_compile = false, // should the function be compiled even if it
                               // isn't referenced
+      is_hot = false,         // is the function frequently executed
+      is_cold = false;        // is the function rarely executed
+  unsigned memoize = 0;       // how many results are cached, see memo.h
+  bool memoize_per_thread = false; // every thread has a cache, not shared
   LLVMCallConv call_conv = LLVMCCallConv; // calling convention
   bool set_by_string(std::string str, std::string value);
   bool eq(FuncFlags other);
@@ -52,4 +67,6 @@ template <class Facet> struct deletable_facet : Facet {
   ~deletable_facet() {}
 };
 
-std::filesystem::path get_executable_path();
\ No newline at end of file
+std::filesystem::path get_executable_path();
+// runs a program through the shell, returns whether it exited successfully
+bool run_command(std::vector<std::string> args);
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "values.h"
+#include "options.h"
 
 ConstValue::ConstValue(Type *type, LLVMValueRef val) : type(type), val(val) {}
 Type *ConstValue::get_type() { return type; };
@@ -39,8 +40,39 @@ bool FuncValue::is_constant() { return true; }
 BasicLoadValue::BasicLoadValue(Type *type, LLVMValueRef variable)
     : type(type), variable(variable) {}
 Type *BasicLoadValue::get_type() { return type; }
+thread_local size_t block_epoch = 0;
+// instructions after a load that are checked for writes before reusing it
+#define LOAD_REUSE_WINDOW 16
+// whether `load` is in the current block and nothing after it can write memory
+static bool can_reuse_load(LLVMValueRef load) {
+  if (LLVMGetInstructionParent(load) != LLVMGetInsertBlock(curr_builder))
+    return false;
+  LLVMValueRef inst = LLVMGetNextInstruction(load);
+  for (size_t i = 0; inst; i++, inst = LLVMGetNextInstruction(inst)) {
+    if (i == LOAD_REUSE_WINDOW)
+      return false;
+    switch (LLVMGetInstructionOpcode(inst)) {
+    case LLVMStore:
+    case LLVMCall:
+    case LLVMInvoke:
+    case LLVMAtomicRMW:
+    case LLVMAtomicCmpXchg:
+    case LLVMFence:
+    case LLVMVAArg:
+      return false;
+    default:
+      break;
+    }
+  }
+  return true;
+}
 LLVMValueRef BasicLoadValue::gen_val() {
-  return LLVMBuildLoad2(curr_builder, type->llvm_type(), variable, UN);
+  if (options.lean && last_load && last_load_epoch == block_epoch &&
+      can_reuse_load(last_load))
+    return last_load;
+  last_load_epoch = block_epoch;
+  return last_load =
+             LLVMBuildLoad2(curr_builder, type->llvm_type(), variable, UN);
 };
 LLVMValueRef BasicLoadValue::gen_ptr() { return variable; };
 bool BasicLoadValue::has_ptr() { return true; }
@@ -180,4 +212,119 @@ LLVMValueRef CastValue::gen_ptr() { error("Can't get the pointer to a cast"); }
 bool CastValue::has_ptr() { return false; }
 bool CastValue::is_constant() { return source->is_constant(); }
 
-CastValue *Value::cast_to(Type *to) { return new CastValue(this, to); }
\ No newline at end of file
+CastValue *Value::cast_to(Type *to) { return new CastValue(this, to); }
+
+static LLVMValueRef i8_ptr(LLVMValueRef ptr) {
+  LLVMTypeRef type = LLVMPointerType(LLVMInt8TypeInContext(curr_ctx), 0);
+  return LLVMBuildPointerCast(curr_builder, ptr, type, UN);
+}
+static LLVMValueRef mem_intrinsic(std::string name,
+                                  std::vector<LLVMTypeRef> params) {
+  LLVMTypeRef type = LLVMFunctionType(LLVMVoidTypeInContext(curr_ctx),
+                                      params.data(), params.size(), false);
+  LLVMValueRef func = LLVMGetNamedFunction(curr_module, name.c_str());
+  return func ? func : LLVMAddFunction(curr_module, name.c_str(), type);
+}
+// the known alignment of the pointer arguments of a memory intrinsic call
+static void set_mem_align(LLVMValueRef call, unsigned pointers,
+                          unsigned align) {
+  for (unsigned i = 1; i <= pointers; i++)
+    LLVMSetInstrParamAlignment(call, i, align);
+}
+void gen_mem_copy(LLVMValueRef dest, LLVMValueRef src, LLVMValueRef size,
+                  unsigned align, bool may_overlap) {
+  LLVMTypeRef i8_ptr_t = LLVMPointerType(LLVMInt8TypeInContext(curr_ctx), 0);
+  LLVMTypeRef i1 = LLVMInt1TypeInContext(curr_ctx);
+  size = LLVMBuildZExtOrBitCast(curr_builder, size,
+                                LLVMInt64TypeInContext(curr_ctx), UN);
+  LLVMValueRef func = mem_intrinsic(
+      may_overlap ? "llvm.memmove.p0i8.p0i8.i64" : "llvm.memcpy.p0i8.p0i8.i64",
+      {i8_ptr_t, i8_ptr_t, LLVMTypeOf(size), i1});
+  LLVMValueRef args[] = {i8_ptr(dest), i8_ptr(src), size,
+                         LLVMConstNull(i1)};
+  LLVMValueRef call = LLVMBuildCall2(
+      curr_builder, LLVMGetElementType(LLVMTypeOf(func)), func, args, 4, "");
+  set_mem_align(call, 2, align);
+}
+void gen_mem_set(LLVMValueRef dest, LLVMValueRef byte, LLVMValueRef size,
+                 unsigned align) {
+  LLVMTypeRef i8_ptr_t = LLVMPointerType(LLVMInt8TypeInContext(curr_ctx), 0);
+  LLVMTypeRef i1 = LLVMInt1TypeInContext(curr_ctx);
+  size = LLVMBuildZExtOrBitCast(curr_builder, size,
+                                LLVMInt64TypeInContext(curr_ctx), UN);
+  LLVMValueRef func =
+      mem_intrinsic("llvm.memset.p0i8.i64",
+                    {i8_ptr_t, LLVMTypeOf(byte), LLVMTypeOf(size), i1});
+  LLVMValueRef args[] = {i8_ptr(dest), byte, size, LLVMConstNull(i1)};
+  LLVMValueRef call = LLVMBuildCall2(
+      curr_builder, LLVMGetElementType(LLVMTypeOf(func)), func, args, 4, "");
+  set_mem_align(call, 1, align);
+}
+
+// the alloca or global variable `ptr` points into, nullptr if it isn't one
+static LLVMValueRef base_object(LLVMValueRef ptr) {
+  while (LLVMIsAGetElementPtrInst(ptr) || LLVMIsABitCastInst(ptr) ||
+         (LLVMIsAConstantExpr(ptr) &&
+          (LLVMGetConstOpcode(ptr) == LLVMGetElementPtr ||
+           LLVMGetConstOpcode(ptr) == LLVMBitCast)))
+    ptr = LLVMGetOperand(ptr, 0);
+  return LLVMIsAAllocaInst(ptr) || LLVMIsAGlobalVariable(ptr) ? ptr : nullptr;
+}
+// whether the tuple type `from` has the bytes of the array type `to`, all
+// of its members are the array's elements
+static bool tuple_is_array(Type *from, Type *to) {
+  auto tup = dynamic_cast<TupleType *>(from);
+  auto arr = dynamic_cast<ArrayType *>(to);
+  if (!tup || !arr || tup->types.size() != arr->count)
+    return false;
+  for (Type *member : tup->types)
+    if (member->neq(arr->elem))
+      return false;
+  return true;
+}
+// `value` without the casts that keep its bytes, e.g. a tuple loaded as an
+// array of the same elements
+static Value *uncast(Value *value) {
+  while (auto cast = dynamic_cast<CastValue *>(value)) {
+    Type *from = cast->source->get_type();
+    if (!from->eq(cast->to) && !tuple_is_array(from, cast->to))
+      break;
+    value = cast->source;
+  }
+  return value;
+}
+void gen_store(Value *value, LLVMValueRef ptr) {
+  LLVMTypeRef type = value->get_type()->llvm_type();
+  LLVMTypeKind kind = LLVMGetTypeKind(type);
+  if ((kind != LLVMStructTypeKind && kind != LLVMArrayTypeKind) ||
+      LLVMABISizeOfType(target_data, type) < AGGREGATE_MEMCPY_SIZE) {
+    LLVMBuildStore(curr_builder, value->gen_val(), ptr);
+    return;
+  }
+  LLVMValueRef size = LLVMConstInt(LLVMInt64TypeInContext(curr_ctx),
+                                   LLVMStoreSizeOfType(target_data, type),
+                                   false);
+  unsigned align = LLVMABIAlignmentOfType(target_data, type);
+  Value *source = uncast(value);
+  if (source->has_ptr()) {
+    LLVMValueRef src = source->gen_ptr();
+    LLVMValueRef src_base = base_object(src), dest_base = base_object(ptr);
+    gen_mem_copy(ptr, src, size, align,
+                 !src_base || !dest_base || src_base == dest_base);
+    return;
+  }
+  LLVMValueRef val = value->gen_val();
+  if (LLVMIsNull(val))
+    gen_mem_set(ptr, LLVMConstNull(LLVMInt8TypeInContext(curr_ctx)), size,
+                align);
+  else if (LLVMIsConstant(val)) {
+    // copied from a constant, like C's aggregate initializers
+    LLVMValueRef init = LLVMAddGlobal(curr_module, type, "");
+    LLVMSetLinkage(init, LLVMPrivateLinkage);
+    LLVMSetGlobalConstant(init, true);
+    LLVMSetUnnamedAddress(init, LLVMGlobalUnnamedAddr);
+    LLVMSetInitializer(init, val);
+    gen_mem_copy(ptr, init, size, align, false);
+  } else
+    LLVMBuildStore(curr_builder, val, ptr);
+}
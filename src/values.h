@@ -63,7 +63,13 @@ public:
   bool is_constant();
 };
 /// BasicLoadValue - generates a load op.
+// incremented when codegen deletes blocks, their loads can't be reused
+extern thread_local size_t block_epoch;
 class BasicLoadValue : public Value {
+  // with --lean, the last load, reused while it's still valid
+  LLVMValueRef last_load = nullptr;
+  size_t last_load_epoch = 0;
+
 public:
   LLVMValueRef variable;
   Type *type;
@@ -93,4 +99,15 @@ public:
   LLVMValueRef gen_ptr();
   bool has_ptr();
   bool is_constant();
-};
\ No newline at end of file
+};
+// aggregates of at least this many bytes are copied with memcpy and zeroed
+// with memset instead of being loaded and stored as one SSA value
+#define AGGREGATE_MEMCPY_SIZE 64
+// copies `size` bytes with llvm.memcpy, or llvm.memmove if the two may overlap
+void gen_mem_copy(LLVMValueRef dest, LLVMValueRef src, LLVMValueRef size,
+                  unsigned align, bool may_overlap);
+// sets `size` bytes to `byte` (an i8) with llvm.memset
+void gen_mem_set(LLVMValueRef dest, LLVMValueRef byte, LLVMValueRef size,
+                 unsigned align);
+// stores `value` at `ptr`, see AGGREGATE_MEMCPY_SIZE
+void gen_store(Value *value, LLVMValueRef ptr);
@@ -33,6 +33,8 @@ for file in $dir/tests/*.fy $dir/tests/**/*.fy
 do
   file=${file##$dir/tests/}
   file=${file%.fy}
+  [[ $file == errors/* || $file == units/* || $file == out-of-bounds/* ]] &&
+    continue
   export QUIET=1
   args="run tests/$file.fy 2>&1"
   try
@@ -45,6 +47,104 @@ do
     fi
   fi
 done
+# the same programs with --lean, at -O2, and in LLVM's interpreter (see
+# src/interp.h)
+for mode in --lean -O2 --interp --interp=auto
+do
+  for file in $dir/tests/*.fy $dir/tests/**/*.fy
+  do
+    file=${file##$dir/tests/}
+    file=${file%.fy}
+    [[ $file == errors/* || $file == units/* || $file == out-of-bounds/* ]] &&
+      continue
+    [ -f "tests/$file.txt" ] || continue
+    args="run $mode tests/$file.fy 2>&1"
+    try
+    expected=$(<"tests/$file.txt")
+    if [ "$out" != "$expected" ]; then
+      echo "Wrong output for $file with $mode, expected '$expected', got '$out'"
+      exit 1
+    fi
+  done
+  echo " - Tests pass with $mode"
+done
+# with --bounds-check, bounds.fy keeps its output with the checks in
+# bounds.stats removed, and the programs in tests/out-of-bounds trap with
+# the error in their .txt
+args="run --bounds-check tests/bounds.fy 2>&1"
+file=bounds
+try
+if [ "$out" != "$(<tests/bounds.txt)" ]; then
+  echo "Wrong output for bounds with --bounds-check, got '$out'"
+  exit 1
+fi
+out=$(env -u QUIET $dir/build/fy com --bounds-check --stats tests/bounds \
+  /dev/null | grep "^\[fy\] Bounds\|^\[fy\]   ")
+expected=$(<tests/bounds.stats)
+if [ "$out" != "$expected" ]; then
+  echo "Wrong bounds checks removed, expected '$expected', got '$out'"
+  exit 1
+fi
+for file in $dir/tests/out-of-bounds/*.fy
+do
+  file=${file##$dir/tests/}
+  file=${file%.fy}
+  echo " - $file"
+  out=$($dir/build/fy run --bounds-check tests/$file.fy 2>&1)
+  if [ $? -eq 0 ]; then
+    echo " - $file didn't trap"
+    exit 1
+  fi
+  expected=$(<"tests/$file.txt")
+  if [ "$out" != "$expected" ]; then
+    echo "Wrong error for $file, expected '$expected', got '$out'"
+    exit 1
+  fi
+done
+echo " - Bounds checks work"
+# the units of tests/units built as one program
+args="build /tmp/fy-units tests/units/main.fy tests/units/twice.fy"
+file=units
+try
+out=$(/tmp/fy-units)
+expected=$(<"tests/units/main.txt")
+if [ "$out" != "$expected" ]; then
+  echo "Wrong output for units, expected '$expected', got '$out'"
+  exit 1
+fi
+echo " - Units build"
+# every program has to lift to FIR with --emit=fir
+for file in $dir/examples/*.fy $dir/tests/*.fy $dir/tests/**/*.fy
+do
+  file=${file##$dir/}
+  file=${file%.fy}
+  [[ $file == tests/errors/* ]] && continue
+  args="com --emit=fir $file /tmp/fy-test.fir"
+  try
+  if [ -f "$file.fir" ] && ! diff -u "$file.fir" /tmp/fy-test.fir; then
+    echo "Wrong FIR for $file"
+    exit 1
+  fi
+done
+echo " - All programs lift to FIR"
+# programs that must not compile, with the expected error
+for file in $dir/tests/errors/*.fy
+do
+  file=${file##$dir/tests/}
+  file=${file%.fy}
+  echo " - $file"
+  out=$(QUIET=1 $dir/build/fy run tests/$file.fy 2>&1)
+  if [ $? -eq 0 ]; then
+    echo " - $file compiled, expected an error"
+    exit 1
+  fi
+  expected=$(<"tests/$file.txt")
+  if [ "$out" != "$expected" ]; then
+    echo "Wrong error for $file, expected '$expected', got '$out'"
+    exit 1
+  fi
+  echo " - $file failed as expected"
+done
 tput setaf 2
 echo " - All tests passed"
 tput sgr0
\ No newline at end of file